@@ -73,6 +73,8 @@ struct conn_cache_entry {
 #ifndef NO_MIGRATION
     struct addrinfo * migr_peer;
 #endif
+    sq_head(pend_list, stream_entry) pend; ///< Requests waiting for a stream.
+    uint_t active;                        ///< Requests in flight.
     bool migrated;
     uint8_t _unused[7];
 };
@@ -84,8 +86,12 @@ KHASH_MAP_INIT_INT64(conn_cache, struct conn_cache_entry *)
 static uint32_t vers = 0;
 static uint32_t timeout = 10;
 static uint32_t initial_rtt = 500;
+static uint32_t keepalive = 0;
 static uint32_t num_bufs = 100000;
 static uint32_t reps = 1;
+static uint32_t par_strms = 0;
+static uint32_t par_conns = 1;
+static uint32_t rng_kb = 0;
 static bool do_h3 = false;
 static bool prefer_v6 = false;
 static bool do_chacha = false;
@@ -103,28 +109,47 @@ static bool switch_ip = false;
 
 struct stream_entry {
     sl_entry(stream_entry) next;
+    sq_entry(stream_entry) next_pend;
     struct conn_cache_entry * cce;
     struct q_stream * s;
     char * url;
     uint64_t req_t;
     uint64_t rep_t;
+    uint64_t sid;
+    uint64_t rng_off; ///< Offset of the requested range, in range mode.
+    uint64_t rep_len; ///< Length of the range, after it was written out.
     struct w_iov_sq req;
     struct w_iov_sq rep;
+    bool done;
+    bool rng;
+    uint8_t _unused[6];
 };
 
 
 static sl_head(stream_list, stream_entry) sl = sl_head_initializer(sl);
 
 
+KHASH_MAP_INIT_INT64(strm_map, struct stream_entry *)
+
+static khash_t(strm_map) sm = {0}; ///< Stream entries of streams in flight.
+static uint_t n_open = 0;          ///< Requests not yet complete.
+
+#define RNG_STRMS 4 ///< Ranges in flight per connection, if -p is 0.
+
+static uint64_t rng_next = 0; ///< Offset of the next range to request.
+static bool rng_eof = false;  ///< A range came back short.
+static int rng_fd = -1;       ///< Output file in range mode.
+
+
 static inline uint64_t __attribute__((nonnull))
-conn_cache_key(const struct sockaddr * const sock)
+conn_cache_key(const struct sockaddr * const sock, const uint16_t shard)
 {
     const struct sockaddr_in * const sock4 =
         (const struct sockaddr_in *)(const void *)sock;
 
     return ((uint64_t)sock4->sin_addr.s_addr
             << sizeof(sock4->sin_addr.s_addr) * 8) |
-           (uint64_t)sock4->sin_port;
+           ((uint64_t)shard << 16) | (uint64_t)sock4->sin_port;
 }
 
 
@@ -148,9 +173,18 @@ usage(const char * const name,
            *tls_ca_store ? tls_ca_store : "WebPKI");
     printf("\t[-e version]\tQUIC version to use; default 0x%08x\n",
            vers ? vers : DRAFT_VERSION);
+    printf("\t[-f kb]\t\tfetch the first URL in ranges of this size over "
+           "parallel streams (0 = off); default %u\n",
+           rng_kb);
     printf("\t[-g]\t\tenable greasing the QUIC bit; default %s\n",
            enable_grease ? "true" : "false");
     printf("\t[-i interface]\tinterface to run over; default %s\n", ifname);
+    printf("\t[-j conns]\tconnections per peer to spread URLs over; "
+           "default %u\n",
+           par_conns);
+    printf("\t[-k interval]\tkeepalive PING interval in seconds (0 = off); "
+           "default %u\n",
+           keepalive);
     printf("\t[-l log]\tlog file for TLS keys; default %s\n",
            *tls_log ? tls_log : "false");
     printf("\t[-m]\t\ttest multi-pkt initial (\"quantum-readiness\"); default "
@@ -163,6 +197,9 @@ usage(const char * const name,
 #endif
     printf("\t[-o]\t\tdisable PMTUD; default %s\n",
            disable_pmtud ? "true" : "false");
+    printf("\t[-p strms]\tmax. concurrent streams per connection "
+           "(0 = peer limit); default %u\n",
+           par_strms);
     printf("\t[-q log]\twrite qlog events to directory; default %s\n",
            *qlog_dir ? qlog_dir : "false");
     printf("\t[-r reps]\trepetitions for all URLs; default %u\n", reps);
@@ -245,8 +282,166 @@ get_addr(const char * const dest,
 }
 
 
+static int __attribute__((nonnull)) open_object(char * const url)
+{
+    char * const slash = strrchr(url, '/');
+    if (slash && *(slash + 1) == 0)
+        // this URL ends in a slash, so strip that to name the file
+        *slash = 0;
+
+    const int fd = open(*basename(url) == 0 ? "index.html" : basename(url),
+                        O_CREAT | O_WRONLY | O_CLOEXEC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+    ensure(fd != -1, "cannot open %s", basename(url));
+    return fd;
+}
+
+
+static void __attribute__((nonnull(2)))
+write_iovs(const int fd, const struct w_iov_sq * const q, off_t off)
+{
+    struct iovec vec[IOV_MAX];
+    struct w_iov * v = sq_first(q);
+    int i = 0;
+    while (v) {
+        vec[i].iov_base = v->buf;
+        vec[i].iov_len = v->len;
+        if (++i == IOV_MAX || sq_next(v, next) == 0) {
+            const ssize_t n = pwritev(fd, vec, i, off);
+            ensure(n != -1, "cannot pwritev");
+            off += n;
+            i = 0;
+        }
+        v = sq_next(v, next);
+    }
+}
+
+
+static void __attribute__((nonnull)) rng_done(struct stream_entry * const se)
+{
+    // write the range to its place in the file and drop it, so memory use
+    // doesn't grow with the object size
+    se->rep_len = w_iov_sq_len(&se->rep);
+    if (rng_fd != -1)
+        write_iovs(rng_fd, &se->rep, (off_t)se->rng_off);
+    q_free(&se->rep);
+
+    // a short range means we have reached the end of the object
+    if (se->rep_len < (uint64_t)rng_kb * 1024)
+        rng_eof = true;
+}
+
+
+static bool __attribute__((nonnull))
+can_issue(const struct conn_cache_entry * const cce)
+{
+    return q_strms_avail(cce->c, true) &&
+           (par_strms == 0 || cce->active < par_strms);
+}
+
+
+static void __attribute__((nonnull)) track(struct stream_entry * const se)
+{
+    se->sid = q_sid(se->s);
+    se->cce->active++;
+    int ret;
+    const khiter_t k =
+        kh_put(strm_map, &sm, (khint64_t)(uintptr_t)se->s, &ret);
+    ensure(ret >= 1, "inserted returned %d", ret);
+    kh_val(&sm, k) = se;
+}
+
+
+static void __attribute__((nonnull)) issue(struct stream_entry * const se)
+{
+    se->s = q_rsv_stream(se->cce->c, true);
+    if (se->s == 0) {
+        se->done = true;
+        n_open--;
+        return;
+    }
+    se->req_t = w_now(CLOCK_MONOTONIC_RAW);
+    q_write(se->s, &se->req, true);
+    track(se);
+}
+
+
+static void __attribute__((nonnull))
+issue_pend(struct conn_cache_entry * const cce)
+{
+    while (sq_empty(&cce->pend) == false && can_issue(cce)) {
+        struct stream_entry * const p = sq_first(&cce->pend);
+        sq_remove_head(&cce->pend, next_pend);
+        issue(p);
+    }
+}
+
+
+static void __attribute__((nonnull)) complete(struct stream_entry * const se)
+{
+    se->done = true;
+    se->rep_t = w_now(CLOCK_MONOTONIC_RAW);
+    n_open--;
+    if (se->rng)
+        rng_done(se);
+
+    // the stream slot is free, so send the next queued request on this conn
+    se->cce->active--;
+    issue_pend(se->cce);
+}
+
+
+static void __attribute__((nonnull)) rx(struct q_conn * const c)
+{
+    // read whichever streams have data, in the order it arrived
+    struct w_iov_sq q = w_iov_sq_initializer(q);
+    struct q_stream * s;
+    while ((s = q_read(c, &q, false))) {
+        const khiter_t k = kh_get(strm_map, &sm, (khint64_t)(uintptr_t)s);
+        if (k == kh_end(&sm)) {
+            // not one of ours, e.g., the server's H3 control stream
+            q_free(&q);
+            if (q_is_stream_closed(s))
+                q_free_stream(s);
+            continue;
+        }
+
+        struct stream_entry * const se = kh_val(&sm, k);
+        sq_concat(&se->rep, &q);
+        try_migrate(se->cce);
+        if (se->done == false && q_peer_closed_stream(s))
+            complete(se);
+
+        if (q_is_stream_closed(s)) {
+            // retrieve the TX'ed request and release the stream early
+            q_stream_get_written(s, &se->req);
+            kh_del(strm_map, &sm, k);
+            q_free_stream(s);
+            se->s = 0;
+        }
+    }
+}
+
+
+static void __attribute__((nonnull)) abort_conn(struct q_conn * const c)
+{
+    struct stream_entry * se;
+    sl_foreach (se, &sl, next)
+        if (se->cce && se->cce->c == c && se->done == false) {
+            se->done = true;
+            n_open--;
+            // don't request more ranges after losing one
+            rng_eof |= se->rng;
+        }
+}
+
+
 static struct q_conn * __attribute__((nonnull))
-get(char * const url, struct w_engine * const w, khash_t(conn_cache) * cc)
+get(char * const url,
+    struct w_engine * const w,
+    khash_t(conn_cache) * cc,
+    const uint16_t shard,
+    const bool rng)
 {
     // parse and verify the URIs passed on the command line
     struct http_parser_url u = {0};
@@ -282,7 +477,7 @@ get(char * const url, struct w_engine * const w, khash_t(conn_cache) * cc)
 #endif
 
     // do we have a connection open to this peer?
-    khiter_t k = kh_get(conn_cache, cc, conn_cache_key(peer->ai_addr));
+    khiter_t k = kh_get(conn_cache, cc, conn_cache_key(peer->ai_addr, shard));
     struct conn_cache_entry * cce = (k == kh_end(cc) ? 0 : kh_val(cc, k));
 
     // add to stream list
@@ -313,10 +508,21 @@ get(char * const url, struct w_engine * const w, khash_t(conn_cache) * cc)
         }
 
     } else {
-        // assemble an HTTP/0.9 request
-        char req_str[sizeof(path) + 6];
-        const int req_str_len =
-            snprintf(req_str, sizeof(req_str), "GET %s\r\n", path);
+        // assemble an HTTP/0.9 request, with a range header if needed
+        char req_str[sizeof(path) + 64];
+        int req_str_len;
+        if (rng) {
+            se->rng = true;
+            se->rng_off = rng_next;
+            rng_next += (uint64_t)rng_kb * 1024;
+            req_str_len =
+                snprintf(req_str, sizeof(req_str),
+                         "GET %s\r\nRange: bytes=%" PRIu64 "-%" PRIu64
+                         "\r\n\r\n",
+                         path, se->rng_off, rng_next - 1);
+        } else
+            req_str_len =
+                snprintf(req_str, sizeof(req_str), "GET %s\r\n", path);
         q_chunk_str(w, cce ? cce->c : 0, peer->ai_family, req_str,
                     (uint32_t)req_str_len, &se->req);
     }
@@ -356,25 +562,35 @@ get(char * const url, struct w_engine * const w, khash_t(conn_cache) * cc)
 #ifndef NO_MIGRATION
         cce->migr_peer = migr_peer;
 #endif
+        sq_init(&cce->pend);
 
         // insert into connection cache
         int ret;
-        k = kh_put(conn_cache, cc, conn_cache_key(peer->ai_addr), &ret);
+        k = kh_put(conn_cache, cc, conn_cache_key(peer->ai_addr, shard), &ret);
         ensure(ret >= 1, "inserted returned %d", ret);
         kh_val(cc, k) = cce;
 
+        se->cce = cce;
+        se->url = url;
+        if (se->s) {
+            n_open++;
+            track(se);
+        } else
+            se->done = true;
+
     } else {
         freeaddrinfo(peerinfo);
-        se->s = q_rsv_stream(cce->c, true);
-        if (se->s) {
-            se->req_t = w_now(CLOCK_MONOTONIC_RAW);
-            q_write(se->s, &se->req, true);
-        }
+        se->cce = cce;
+        se->url = url;
+        n_open++;
+        if (can_issue(cce))
+            issue(se);
+        else
+            // wait for a request on this conn to complete
+            sq_insert_tail(&cce->pend, se, next_pend);
     }
     try_migrate(cce);
 
-    se->cce = cce;
-    se->url = url;
     return cce->c;
 
 fail:
@@ -420,29 +636,8 @@ static void free_sl(void)
 static void __attribute__((nonnull))
 write_object(struct stream_entry * const se)
 {
-    char * const slash = strrchr(se->url, '/');
-    if (slash && *(slash + 1) == 0)
-        // this URL ends in a slash, so strip that to name the file
-        *slash = 0;
-
-    const int fd =
-        open(*basename(se->url) == 0 ? "index.html" : basename(se->url),
-             O_CREAT | O_WRONLY | O_CLOEXEC,
-             S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-    ensure(fd != -1, "cannot open %s", basename(se->url));
-
-    struct iovec vec[IOV_MAX];
-    struct w_iov * v = sq_first(&se->rep);
-    int i = 0;
-    while (v) {
-        vec[i].iov_base = v->buf;
-        vec[i].iov_len = v->len;
-        if (++i == IOV_MAX || sq_next(v, next) == 0) {
-            ensure(writev(fd, vec, i) != -1, "cannot writev");
-            i = 0;
-        }
-        v = sq_next(v, next);
-    }
+    const int fd = open_object(se->url);
+    write_iovs(fd, &se->rep, 0);
     close(fd);
 }
 
@@ -472,7 +667,7 @@ int main(int argc, char * argv[])
     }
 
     while ((ch = getopt(argc, argv,
-                        "hi:v:s:t:l:c:u36azb:wr:q:me:x:og"
+                        "hi:v:s:t:l:c:u36azb:wr:q:me:x:ogk:p:j:f:"
 #ifndef NO_MIGRATION
                         "n"
 #endif
@@ -493,6 +688,16 @@ int main(int argc, char * argv[])
         case 'b':
             num_bufs = (uint32_t)MIN(strtoul(optarg, 0, 10), UINT32_MAX);
             break;
+        case 'p':
+            par_strms = (uint32_t)MIN(strtoul(optarg, 0, 10), UINT32_MAX);
+            break;
+        case 'f':
+            rng_kb = (uint32_t)MIN(strtoul(optarg, 0, 10), UINT32_MAX / 1024);
+            break;
+        case 'j':
+            par_conns =
+                (uint32_t)MAX(1, MIN(strtoul(optarg, 0, 10), UINT16_MAX));
+            break;
         case 'r':
             reps = (uint32_t)MAX(1, MIN(strtoul(optarg, 0, 10), UINT32_MAX));
             break;
@@ -502,6 +707,9 @@ int main(int argc, char * argv[])
         case 'x':
             initial_rtt = MAX(1, (uint32_t)strtoul(optarg, 0, 10));
             break;
+        case 'k':
+            keepalive = (uint32_t)MIN(600, strtoul(optarg, 0, 10));
+            break;
         case 'l':
             strncpy(tls_log, optarg, sizeof(tls_log) - 1);
             break;
@@ -555,6 +763,12 @@ int main(int argc, char * argv[])
         }
     }
 
+    if (rng_kb && do_h3) {
+        warn(ERR, "range requests are only supported for hq, ignoring -f");
+        rng_kb = 0;
+    }
+    const uint_t rng_win = par_conns * (par_strms ? par_strms : RNG_STRMS);
+
     struct w_engine * const w = q_init(
         ifname,
         &(const struct q_conf){
@@ -564,6 +778,7 @@ int main(int argc, char * argv[])
                                       .enable_spinbit = true,
                                       .enable_udp_zero_checksums = true,
                                       .idle_timeout = timeout,
+                                      .keepalive = keepalive,
                                       .version = vers,
                                       .disable_pmtud = disable_pmtud,
                                       .enable_grease = enable_grease,
@@ -582,49 +797,85 @@ int main(int argc, char * argv[])
     double sum_len = 0;
     double sum_elapsed = 0;
     for (uint64_t r = 1; r <= reps; r++) {
-        int url_idx = optind;
+        const uint64_t rep_start_t = w_now(CLOCK_MONOTONIC_RAW);
+        uint_t rng_cnt = 0;
+        if (rng_kb && optind < argc) {
+            // fetch the first URL as a sequence of ranges, keeping rng_win of
+            // them in flight over the connections
+            rng_next = 0;
+            rng_eof = false;
+            if (write_files)
+                rng_fd = open_object(argv[optind]);
+            while (rng_cnt < rng_win)
+                get(argv[optind], w, &cc,
+                    (uint16_t)(rng_cnt++ % par_conns), true);
+        }
+
+        int url_idx = rng_kb ? argc : optind;
         while (url_idx < argc) {
-            // open a new connection, or get an open one
+            // open a new connection, or get an open one; URLs are spread
+            // round-robin over the connections to each peer
             warn(INF, "%s retrieving %s", basename(argv[0]), argv[url_idx]);
-            get(argv[url_idx++], w, &cc);
+            const uint16_t shard = (uint16_t)((uint32_t)(url_idx - optind) %
+                                              par_conns);
+            get(argv[url_idx++], w, &cc, shard, false);
         }
 
-        // collect the replies
-        bool all_closed;
-        do {
-            all_closed = true;
-            bool rxed_new = false;
-            struct stream_entry * se = 0;
-            struct stream_entry * tmp = 0;
-            sl_foreach_safe (se, &sl, next, tmp) {
-                if (se->cce == 0 || se->cce->c == 0 || se->s == 0) {
-                    sl_remove(&sl, se, stream_entry, next);
-                    free_se(se);
-                    continue;
-                }
-                try_migrate(se->cce);
-                rxed_new |= q_read_stream(se->s, &se->rep, false);
-
-                const bool is_closed = q_peer_closed_stream(se->s);
-                all_closed &= is_closed;
-                if (is_closed)
-                    se->rep_t = w_now(CLOCK_MONOTONIC_RAW);
+        // collect the replies, from whichever connection has data
+        while (n_open) {
+            struct q_conn * c;
+            q_ready(w, timeout * NS_PER_S, &c);
+            if (c == 0)
+                break;
+            rx(c);
+            if (q_is_conn_closed(c))
+                abort_conn(c);
+            else {
+                // MAX_STREAMS may have arrived with no stream completing
+                struct conn_cache_entry * cce;
+                kh_foreach_value(&cc, cce, {
+                    if (cce->c == c)
+                        issue_pend(cce);
+                });
             }
 
-            if (rxed_new == false && all_closed == false) {
-                struct q_conn * c;
-                q_ready(w, timeout * NS_PER_S, &c);
-                if (c == 0)
-                    break;
-                if (q_is_conn_closed(c))
-                    break;
-            }
-
-        } while (all_closed == false);
+            // replace completed ranges until one comes back short
+            while (rng_kb && rng_eof == false && n_open < rng_win)
+                get(argv[optind], w, &cc,
+                    (uint16_t)(rng_cnt++ % par_conns), true);
+        }
+        if (rng_fd != -1) {
+            close(rng_fd);
+            rng_fd = -1;
+        }
+        sum_elapsed +=
+            (double)(w_now(CLOCK_MONOTONIC_RAW) - rep_start_t) / NS_PER_S;
+
+        // forget about anything still outstanding, e.g., after a timeout
+        struct conn_cache_entry * cce;
+        kh_foreach_value(&cc, cce, {
+            sq_init(&cce->pend);
+            cce->active = 0;
+        });
+        kh_clear(strm_map, &sm);
+        n_open = 0;
+        uint64_t rng_len = 0;
 
         // print/save the replies
         while (sl_empty(&sl) == false) {
             struct stream_entry * const se = sl_first(&sl);
+            if (se->cce == 0 || se->cce->c == 0) {
+                free_sl_head();
+                continue;
+            }
+            if (se->rng) {
+                // the data was already written out when the range completed
+                rng_len += se->rep_len;
+                if (se->s)
+                    q_free_stream(se->s);
+                free_sl_head();
+                continue;
+            }
             if (ret == -1)
                 ret = w_iov_sq_cnt(&se->rep) == 0;
             else
@@ -636,7 +887,6 @@ int main(int argc, char * argv[])
                     : 0;
             const uint_t rep_len = w_iov_sq_len(&se->rep);
             sum_len += (double)rep_len;
-            sum_elapsed += elapsed;
             if (reps > 1)
                 printf("%" PRIu "\t%f\t\"%s\"\t%s\n", rep_len, elapsed,
                        bps(rep_len, elapsed), se->url);
@@ -645,13 +895,14 @@ int main(int argc, char * argv[])
             q_cid_str(se->cce->c, cid_str, sizeof(cid_str));
             warn(WRN,
                  "read %" PRIu
-                 " byte%s in %.3f sec (%s) on conn %s strm %" PRIu,
+                 " byte%s in %.3f sec (%s) on conn %s strm %" PRIu64,
                  rep_len, plural(rep_len), elapsed < 0 ? 0 : elapsed,
-                 bps(rep_len, elapsed), cid_str, q_sid(se->s));
+                 bps(rep_len, elapsed), cid_str, se->sid);
 #endif
 
-            // retrieve the TX'ed request
-            q_stream_get_written(se->s, &se->req);
+            // retrieve the TX'ed request, unless the stream is already gone
+            if (se->s)
+                q_stream_get_written(se->s, &se->req);
 
             if (write_files)
                 write_object(se);
@@ -691,9 +942,19 @@ int main(int argc, char * argv[])
                 n++;
             }
 
-            q_free_stream(se->s);
+            if (se->s)
+                q_free_stream(se->s);
             free_sl_head();
         }
+
+        if (rng_kb) {
+            sum_len += (double)rng_len;
+            ret = (ret == -1 ? 0 : ret) | (rng_len == 0);
+            const double elapsed =
+                (double)(w_now(CLOCK_MONOTONIC_RAW) - rep_start_t) / NS_PER_S;
+            printf("%" PRIu64 " bytes in %" PRIu " ranges, %.3f sec (%s)\n",
+                   rng_len, rng_cnt, elapsed, bps(rng_len, elapsed));
+        }
     }
 
     if (reps > 1)
@@ -701,6 +962,7 @@ int main(int argc, char * argv[])
 
     free_cc(&cc);
     free_sl();
+    kh_release(strm_map, &sm);
     q_cleanup(w);
     warn(DBG, "%s exiting with %d", basename(argv[0]), ret);
     return ret;
@@ -27,24 +27,31 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <libgen.h>
 #include <net/if.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifndef __linux__
 #include <sys/types.h>
 #endif
 
-#include <http_parser.h>
+#define klib_unused
 
+#include <http_parser.h>
+#include <picohttp/h3zero.h>
 #include <quant/quant.h>
 
 struct q_conn;
@@ -72,32 +79,50 @@ static void __attribute__((noreturn)) usage(const char * const name,
                                             const bool retry,
                                             const bool disable_pmtud,
                                             const bool enable_grease,
-                                            const uint32_t num_bufs)
+                                            const uint32_t num_bufs,
+                                            const char * const srt_key,
+                                            const uint32_t max_conns,
+                                            const uint8_t free_bufs,
+                                            const uint32_t drain_timeout,
+                                            const uint32_t cache_mb)
 {
     printf("%s [options]\n", name);
     printf("\t[-b bufs]\tnumber of network buffers to allocate; default %u\n ",
            num_bufs);
     printf("\t[-c cert]\tTLS certificate; default %s\n", cert);
     printf("\t[-d dir]\tserver root directory; default %s\n", dir);
+    printf("\t[-f pct]\tevict idle conns below this %% of free buffers; "
+           "default %u\n",
+           free_bufs);
     printf("\t[-i interface]\tinterface to run over; default %s\n", ifname);
     printf("\t[-g]\t\tenable greasing the QUIC bit; default %s\n",
            enable_grease ? "true" : "false");
     printf("\t[-k key]\tTLS key; default %s\n", key);
     printf("\t[-l log]\tlog file for TLS keys; default %s\n",
            *tls_log ? tls_log : "false");
+    printf("\t[-m conns]\tevict idle conns beyond this number; default %u\n",
+           max_conns);
     printf("\t[-o]\t\tdisable PMTUD; default %s\n",
            disable_pmtud ? "true" : "false");
     printf("\t[-p port]\tdestination port; default %d\n", port);
     printf("\t[-q log]\twrite qlog events to directory; default %s\n",
            *qlog_dir ? qlog_dir : "false");
     printf("\t[-r]\t\tforce a Retry; default %s\n", retry ? "true" : "false");
+    printf("\t[-s secret]\tkey for stateless reset tokens; default %s\n",
+           *srt_key ? "given" : "random");
     printf("\t[-t timeout]\tidle timeout in seconds; default %u\n", timeout);
 #ifndef NDEBUG
     printf("\t[-v verbosity]\tverbosity level (0-%d, default %d)\n", DLEVEL,
            util_dlevel);
 #endif
+    printf("\t[-w timeout]\tdrain deadline in seconds after SIGTERM; "
+           "default %u\n",
+           drain_timeout);
     printf("\t[-x rtt]\tinitial RTT in milliseconds (default %u)\n",
            initial_rtt);
+    printf("\t[-z MB]\t\tobject cache size, 0 = off, SIGUSR1 prints "
+           "hit rate; default %u\n",
+           cache_mb);
     exit(0);
 }
 
@@ -106,12 +131,307 @@ struct cb_data {
     struct q_stream * s;
     struct q_conn * c;
     struct w_engine * w;
+    uint_t gen_len;     ///< Length of the synthetic object served, if any.
+    uint64_t rng_first; ///< First byte of a requested range.
+    uint64_t rng_last;  ///< Last byte of a requested range (inclusive).
     int dir;
     int af;
+    bool h3;  ///< Frame responses for HTTP/3.
+    bool rng; ///< The request had a "Range: bytes=first-[last]" header.
+    uint8_t _unused[6];
+};
+
+
+/// Per-stream request parsing state.
+struct req {
+    http_parser parser;
+    struct cb_data d;
+    const char * end; ///< End of the w_iov currently being parsed.
+    char * url;       ///< URL (or H3 frame) fragments from earlier w_iovs.
+    size_t url_len;   ///< Length of @p url.
+    bool done;        ///< Request served or rejected, ignore further data.
+    bool in_rng;      ///< The header value being parsed is for "Range".
+    uint8_t _unused[6];
+};
+
+
+KHASH_MAP_INIT_INT(strm_cache, struct req *)
+
+
+struct obj {
+    struct obj * lru_prev; ///< Next less recently used object, or null.
+    struct obj * lru_next; ///< Next more recently used object, or null.
+    uint64_t mtime;        ///< File modification time when we read it.
+    uint64_t ino;          ///< File inode when we read it.
+    uint64_t len;          ///< Length of @p data.
+    char * path;           ///< Path relative to the server root (hash key).
+    uint8_t * data;        ///< File content, never modified after the read.
+    uint32_t refs;         ///< Responses still being sent from @p data.
+    bool cached;           ///< Not yet evicted or replaced.
+    uint8_t _unused[3];
 };
 
 
-KHASH_MAP_INIT_INT(strm_cache, struct w_iov_sq *)
+KHASH_MAP_INIT_STR(obj_cache, struct obj *)
+
+static khash_t(obj_cache) objs = {0};
+static struct obj * lru_first = 0; ///< Least recently used cached object.
+static struct obj * lru_last = 0;  ///< Most recently used cached object.
+static uint64_t obj_cap = 0;       ///< Max. total size of cached objects.
+static uint64_t obj_size = 0;      ///< Current total size of cached objects.
+static uint64_t obj_hits = 0;
+static uint64_t obj_misses = 0;
+
+
+static void __attribute__((nonnull)) lru_unlink(struct obj * const o)
+{
+    if (o->lru_prev)
+        o->lru_prev->lru_next = o->lru_next;
+    else
+        lru_first = o->lru_next;
+    if (o->lru_next)
+        o->lru_next->lru_prev = o->lru_prev;
+    else
+        lru_last = o->lru_prev;
+    o->lru_prev = o->lru_next = 0;
+}
+
+
+static void __attribute__((nonnull)) lru_append(struct obj * const o)
+{
+    o->lru_prev = lru_last;
+    if (lru_last)
+        lru_last->lru_next = o;
+    else
+        lru_first = o;
+    lru_last = o;
+}
+
+
+static void __attribute__((nonnull)) obj_free(struct obj * const o)
+{
+    free(o->path);
+    free(o->data);
+    free(o);
+}
+
+
+static void __attribute__((nonnull)) obj_unref(struct obj * const o)
+{
+    // evicted objects live on until the last response from them is ACK'ed
+    if (--o->refs == 0 && o->cached == false)
+        obj_free(o);
+}
+
+
+static void obj_release(void * const arg, const bool ok __attribute__((unused)))
+{
+    obj_unref(arg);
+}
+
+
+static void obj_del(const khiter_t k)
+{
+    struct obj * const o = kh_val(&objs, k);
+    obj_size -= o->len;
+    kh_del(obj_cache, &objs, k);
+    lru_unlink(o);
+    o->cached = false;
+    if (o->refs == 0)
+        obj_free(o);
+}
+
+
+static void obj_evict_lru(void)
+{
+    if (lru_first)
+        obj_del(kh_get(obj_cache, &objs, lru_first->path));
+}
+
+
+static struct obj * __attribute__((nonnull))
+obj_get(const int dir, const char * const path, const struct stat * const info)
+{
+    const uint64_t len = (uint64_t)info->st_size;
+    if (len > obj_cap)
+        return 0;
+
+    khiter_t k = kh_get(obj_cache, &objs, path);
+    if (k != kh_end(&objs)) {
+        struct obj * const o = kh_val(&objs, k);
+        if (o->mtime == (uint64_t)info->st_mtime &&
+            o->ino == (uint64_t)info->st_ino && o->len == len) {
+            lru_unlink(o);
+            lru_append(o);
+            obj_hits++;
+            return o;
+        }
+        // the file changed on disk
+        obj_del(k);
+    }
+    obj_misses++;
+
+    const int f = openat(dir, path, O_RDONLY | O_CLOEXEC);
+    if (f == -1)
+        return 0;
+    uint8_t * const data = malloc((size_t)MAX(1, len));
+    ensure(data, "malloc failed");
+    uint64_t got = 0;
+    while (got < len) {
+        const ssize_t ret = read(f, &data[got], (size_t)(len - got));
+        if (ret <= 0)
+            break;
+        got += (uint64_t)ret;
+    }
+    close(f);
+    if (got != len) {
+        warn(ERR, "could only read %" PRIu64 "/%" PRIu64 " bytes of %s",
+             got, len, path);
+        free(data);
+        return 0;
+    }
+
+    while (obj_size + len > obj_cap)
+        obj_evict_lru();
+
+    struct obj * const o = calloc(1, sizeof(*o));
+    ensure(o, "calloc failed");
+    *o = (struct obj){.mtime = (uint64_t)info->st_mtime,
+                      .ino = (uint64_t)info->st_ino,
+                      .len = len,
+                      .path = strdup(path),
+                      .data = data,
+                      .cached = true};
+    ensure(o->path, "strdup failed");
+    int err;
+    k = kh_put(obj_cache, &objs, o->path, &err);
+    ensure(err >= 1, "inserted returned %d", err);
+    kh_val(&objs, k) = o;
+    lru_append(o);
+    obj_size += len;
+    return o;
+}
+
+
+#define H3_HDRS_MAX 16384 ///< Largest HEADERS frame we buffer.
+
+
+KHASH_SET_INIT_INT(h3_conns)
+
+static khash_t(h3_conns) h3c = {0}; ///< Conns we opened a control stream on.
+
+
+static uint8_t * __attribute__((nonnull))
+enc_vint(uint8_t * pos, const uint64_t val)
+{
+    // QUIC variable-length integer
+    const unsigned int len =
+        val < 0x40 ? 1 : (val < 0x4000 ? 2 : (val < 0x40000000 ? 4 : 8));
+    for (unsigned int i = 0; i < len; i++)
+        pos[i] = (uint8_t)(val >> (8 * (len - 1 - i)));
+    pos[0] |= (uint8_t)((len == 1 ? 0 : (len == 2 ? 1 : (len == 4 ? 2 : 3)))
+                        << 6);
+    return pos + len;
+}
+
+
+static bool __attribute__((nonnull))
+dec_vint(const uint8_t ** const pos,
+         const uint8_t * const end,
+         uint64_t * const val)
+{
+    if (*pos >= end)
+        return false;
+    const size_t len = (size_t)1 << (**pos >> 6);
+    if ((size_t)(end - *pos) < len)
+        return false;
+    *val = **pos & 0x3f;
+    for (size_t i = 1; i < len; i++)
+        *val = (*val << 8) | (*pos)[i];
+    *pos += len;
+    return true;
+}
+
+
+static uint8_t * __attribute__((nonnull)) enc_qpack_int(uint8_t * pos,
+                                                        const uint8_t flags,
+                                                        const uint8_t prefix,
+                                                        uint64_t val)
+{
+    // QPACK/HPACK integer with an N-bit prefix
+    const uint8_t max = (uint8_t)((1 << prefix) - 1);
+    if (val < max) {
+        *pos++ = flags | (uint8_t)val;
+        return pos;
+    }
+    *pos++ = flags | max;
+    for (val -= max; val >= 0x80; val >>= 7)
+        *pos++ = (uint8_t)(val & 0x7f) | 0x80;
+    *pos++ = (uint8_t)val;
+    return pos;
+}
+
+
+static uint8_t __attribute__((const)) qpack_status_idx(const uint16_t code)
+{
+    // QPACK static table entries for the codes we send (RFC 9204, App. A)
+    switch (code) {
+    case 200:
+        return 25;
+    case 400:
+        return 67;
+    case 403:
+        return 68;
+    case 404:
+        return 27;
+    case 500:
+        return 71;
+    default:
+        return 0;
+    }
+}
+
+
+static void __attribute__((nonnull))
+h3_resp(struct cb_data * const d, const uint16_t code, const uint64_t len)
+{
+    if (d->h3 == false)
+        return;
+
+    // QPACK field section using only the static table, so the required insert
+    // count and base are both zero
+    uint8_t fs[32] = {0x00, 0x00};
+    uint8_t * pos = &fs[2];
+    const uint8_t idx = qpack_status_idx(code);
+    if (idx)
+        // indexed field line
+        pos = enc_qpack_int(pos, 0xc0, 6, idx);
+    else {
+        // literal field line with name reference to ":status"
+        pos = enc_qpack_int(pos, 0x50, 4, 24);
+        pos = enc_qpack_int(pos, 0x00, 7, 3);
+        *pos++ = (uint8_t)('0' + code / 100);
+        *pos++ = (uint8_t)('0' + code / 10 % 10);
+        *pos++ = (uint8_t)('0' + code % 10);
+    }
+    // literal field line with name reference to "content-length"
+    char cl[24];
+    const int cl_len = snprintf(cl, sizeof(cl), "%" PRIu64, len);
+    pos = enc_qpack_int(pos, 0x50, 4, 4);
+    pos = enc_qpack_int(pos, 0x00, 7, (uint64_t)cl_len);
+    memcpy(pos, cl, (size_t)cl_len);
+    pos += cl_len;
+
+    // HEADERS frame, then the header of the DATA frame carrying the body
+    uint8_t frm[64];
+    uint8_t * f = enc_vint(frm, h3zero_frame_header);
+    f = enc_vint(f, (uint64_t)(pos - fs));
+    memcpy(f, fs, (size_t)(pos - fs));
+    f += pos - fs;
+    f = enc_vint(f, h3zero_frame_data);
+    f = enc_vint(f, len);
+    q_write_str(d->w, d->s, (const char *)frm, (size_t)(f - frm), false);
+}
 
 
 static bool send_err(struct cb_data * const d, const uint16_t code)
@@ -130,6 +450,12 @@ static bool send_err(struct cb_data * const d, const uint16_t code)
     case 404:
         msg = "404 Not Found";
         break;
+    case 405:
+        msg = "405 Method Not Allowed";
+        break;
+    case 414:
+        msg = "414 URI Too Long";
+        break;
     case 505:
         msg = "505 HTTP Version Not Supported";
         close = true;
@@ -138,11 +464,13 @@ static bool send_err(struct cb_data * const d, const uint16_t code)
         msg = "500 Internal Server Error";
     }
 
-    if (close && d->c) {
+    if (close && d->c && d->h3 == false) {
         q_close(d->c, 0x0003, msg);
         d->c = 0;
-    } else
+    } else {
+        h3_resp(d, code, strlen(msg));
         q_write_str(d->w, d->s, msg, strlen(msg), true);
+    }
     return close;
 }
 
@@ -151,11 +479,31 @@ static bool send_err(struct cb_data * const d, const uint16_t code)
 static uint32_t bench_cnt = 0;
 #endif
 
+#define PAT_LEN 4096
+
+/// Read-only content of the synthetic "GET /n" objects, repeated as needed.
+/// Holds two periods, so a range can start at any offset into the first one.
+static uint8_t pattern[2 * PAT_LEN];
 
-static int serve_cb(http_parser * parser, const char * at, size_t len)
+
+static uint64_t __attribute__((nonnull))
+clip_rng(const struct cb_data * const d, const uint64_t size, uint64_t * off)
+{
+    if (d->rng == false) {
+        *off = 0;
+        return size;
+    }
+
+    // a range past the end gets an empty reply, so clients can probe sizes
+    *off = MIN(d->rng_first, size);
+    const uint64_t end = d->rng_last < size ? d->rng_last + 1 : size;
+    return end > *off ? end - *off : 0;
+}
+
+
+static int __attribute__((nonnull))
+serve(struct cb_data * const d, const char * const at, const size_t len)
 {
-    (void)parser;
-    struct cb_data * const d = parser->data;
     char cid_str[64];
     q_cid_str(d->c, cid_str, sizeof(cid_str));
     warn(INF, "conn %s strm %" PRId " serving URL %.*s", cid_str, q_sid(d->s),
@@ -168,9 +516,11 @@ static int serve_cb(http_parser * parser, const char * at, size_t len)
         return send_err(d, 400);
     }
 
-    char path[8192] = ".";
+    char path[MAXPATHLEN] = ".";
     if ((u.field_set & (1 << UF_PATH)) == 0)
         return send_err(d, 400);
+    if (u.field_data[UF_PATH].len >= sizeof(path) - sizeof("/index.html"))
+        return send_err(d, 414);
 
     strncpy(&path[at[u.field_data[UF_PATH].off] == '/' ? 1 : 0],
             &at[u.field_data[UF_PATH].off], u.field_data[UF_PATH].len);
@@ -190,25 +540,7 @@ static int serve_cb(http_parser * parser, const char * at, size_t len)
     // check if this is a "GET /n" request for random data
     const uint32_t n = (uint32_t)strtoul(&path[2], 0, 10);
     if (n) {
-        struct w_iov_sq out = w_iov_sq_initializer(out);
-        q_alloc(d->w, &out, d->c, d->af, n);
-        // check whether we managed to allow enough buffers
-        if (w_iov_sq_len(&out) != n) {
-            warn(ERR, "could only allocate %" PRIu "/%u bytes of buffer",
-                 w_iov_sq_len(&out), n);
-            q_free(&out);
-            return send_err(d, 500);
-        }
-
 #ifndef NDEBUG
-        // randomize data
-        struct w_iov * v;
-        uint8_t c = 'A' + (uint8_t)w_rand_uniform32(26);
-        sq_foreach (v, &out, next) {
-            memset(v->buf, c, v->len);
-            c = unlikely(c == 'Z') ? 'A' : c + 1;
-        }
-
         // for the two "benchmark objects", reduce logging
         if (is_bench_obj(n)) {
             warn(NTE, "reducing log level for benchmark object transfer");
@@ -217,8 +549,14 @@ static int serve_cb(http_parser * parser, const char * at, size_t len)
         }
 #endif
 
-        q_write(d->s, &out, true);
-
+        // generated at TX time from the pattern, so this costs no memory
+        uint64_t off;
+        const uint64_t len = clip_rng(d, n, &off);
+        h3_resp(d, 200, len);
+        if (q_write_gen(d->s, &pattern[off % PAT_LEN], PAT_LEN, (uint_t)len,
+                        true) == false)
+            return send_err(d, 500);
+        d->gen_len = n;
         return 0;
     }
 
@@ -228,7 +566,7 @@ static int serve_cb(http_parser * parser, const char * at, size_t len)
 
     // if this a directory, look up its index
     if (info.st_mode & S_IFDIR) {
-        strncat(path, "/index.html", sizeof(path) - len - 1);
+        strncat(path, "/index.html", sizeof(path) - strlen(path) - 1);
         if (fstatat(d->dir, path, &info, 0) == -1)
             return send_err(d, 404);
     }
@@ -239,15 +577,211 @@ static int serve_cb(http_parser * parser, const char * at, size_t len)
     if (info.st_size >= UINT32_MAX)
         return send_err(d, 500);
 
+    // serve hot objects from memory, skipping the open and read
+    struct obj * const o = obj_get(d->dir, path, &info);
+    uint64_t off;
+    const uint64_t len = clip_rng(d, (uint64_t)info.st_size, &off);
+    if (o) {
+        h3_resp(d, 200, len);
+        // send straight from the cached copy, which is kept until ACK'ed
+        const struct iovec iov = {.iov_base = &o->data[off],
+                                  .iov_len = (size_t)len};
+        o->refs++;
+        if (q_write_iov(d->s, &iov, 1, true, obj_release, o) == false) {
+            obj_unref(o);
+            return send_err(d, 500);
+        }
+        return 0;
+    }
+
     const int f = openat(d->dir, path, O_RDONLY | O_CLOEXEC);
     ensure(f != -1, "could not open %s", path);
+    if (off)
+        ensure(lseek(f, (off_t)off, SEEK_SET) != -1, "cannot seek %s", path);
+
+    h3_resp(d, 200, len);
+    q_write_file(d->w, d->s, f, (size_t)len, true);
+
+    return 0;
+}
+
+
+static void __attribute__((nonnull))
+stash(struct req * const r, const char * const at, const size_t len)
+{
+    r->url = realloc(r->url, r->url_len + len);
+    ensure(r->url, "realloc failed");
+    memcpy(&r->url[r->url_len], at, len);
+    r->url_len += len;
+}
+
+
+static int url_cb(http_parser * parser, const char * at, size_t len)
+{
+    struct req * const r = parser->data;
+    const char * const eol = at + len;
+    if (r->url_len == 0 && eol + 2 == r->end && *eol == '\r') {
+        // the common case: a bare request line in one w_iov, serve in place
+        r->done = true;
+        return serve(&r->d, at, len);
+    }
+
+    // the URL spans w_iovs, or headers may follow; collect it and serve once
+    // the headers are complete, or at FIN
+    stash(r, at, len);
+    return 0;
+}
+
+
+static int hdr_field_cb(http_parser * parser, const char * at, size_t len)
+{
+    struct req * const r = parser->data;
+    r->in_rng = len == 5 && strncasecmp(at, "Range", 5) == 0;
+    return 0;
+}
 
-    q_write_file(d->w, d->s, f, (uint32_t)info.st_size, true);
 
+static int hdr_value_cb(http_parser * parser, const char * at, size_t len)
+{
+    struct req * const r = parser->data;
+    char val[64];
+    if (r->in_rng == false || len >= sizeof(val))
+        return 0;
+
+    // only a single "bytes=first-[last]" range is supported
+    memcpy(val, at, len);
+    val[len] = 0;
+    unsigned long long first;
+    unsigned long long last;
+    const int n = sscanf(val, "bytes=%llu-%llu", &first, &last);
+    if (n < 1 || (n == 2 && last < first))
+        return 0;
+    r->d.rng = true;
+    r->d.rng_first = first;
+    r->d.rng_last = n == 2 ? last : UINT64_MAX;
     return 0;
 }
 
 
+static int hdrs_done_cb(http_parser * parser)
+{
+    struct req * const r = parser->data;
+    if (r->done || r->url_len == 0)
+        return 0;
+    r->done = true;
+    return serve(&r->d, r->url, r->url_len) ? -1 : 0;
+}
+
+
+static bool __attribute__((nonnull))
+h3_serve(struct req * const r, uint8_t * const fs, uint8_t * const end)
+{
+    h3zero_header_parts_t parts = {0};
+    bool ok = true;
+    if (h3zero_parse_qpack_header_frame(fs, end, &parts) == 0 ||
+        parts.path == 0) {
+        warn(ERR, "cannot parse H3 request header");
+        send_err(&r->d, 400);
+        ok = false;
+    } else if (parts.method != h3zero_method_get)
+        send_err(&r->d, 405);
+    else
+        serve(&r->d, (const char *)parts.path, parts.path_length);
+    h3zero_release_header_parts(&parts);
+    return ok;
+}
+
+
+static bool __attribute__((nonnull))
+h3_rx(struct req * const r, struct w_iov * const v)
+{
+    uint8_t * buf = v->buf;
+    size_t len = v->len;
+    if (r->url_len) {
+        // continue a frame that started in an earlier w_iov
+        stash(r, (const char *)v->buf, v->len);
+        buf = (uint8_t *)r->url;
+        len = r->url_len;
+    }
+
+    const uint8_t * pos = buf;
+    const uint8_t * const end = buf + len;
+    while (pos < end) {
+        const uint8_t * p = pos;
+        uint64_t type;
+        uint64_t frm_len;
+        if (dec_vint(&p, end, &type) == false ||
+            dec_vint(&p, end, &frm_len) == false)
+            break;
+
+        if (type == h3zero_frame_header) {
+            if (frm_len > H3_HDRS_MAX) {
+                r->done = true;
+                send_err(&r->d, 400);
+                return false;
+            }
+            if ((uint64_t)(end - p) < frm_len)
+                break;
+            // usually, the HEADERS frame is decoded in place in the w_iov
+            r->done = true;
+            uint8_t * const fs = buf + (p - buf);
+            return h3_serve(r, fs, fs + frm_len);
+        }
+
+        // skip anything else, e.g., reserved frame types used for greasing
+        if ((uint64_t)(end - p) < frm_len)
+            break;
+        pos = p + frm_len;
+    }
+
+    // keep the incomplete frame for the next w_iov
+    const size_t left = (size_t)(end - pos);
+    if (buf == (uint8_t *)r->url)
+        memmove(r->url, pos, left);
+    else if (left) {
+        r->url = realloc(r->url, left);
+        ensure(r->url, "realloc failed");
+        memcpy(r->url, pos, left);
+    }
+    r->url_len = left;
+    return true;
+}
+
+
+static uint32_t __attribute__((nonnull))
+conn_key(struct q_conn * const c)
+{
+    uint8_t buf[32];
+    size_t len = sizeof(buf);
+    q_cid(c, buf, &len);
+    return fnv1a_32(buf, len);
+}
+
+
+static void __attribute__((nonnull))
+h3_open_ctrl(struct w_engine * const w, struct q_conn * const c)
+{
+    int err;
+    kh_put(h3_conns, &h3c, conn_key(c), &err);
+    if (err == 0)
+        // already open
+        return;
+
+    struct q_stream * const cs = q_rsv_stream(c, false);
+    if (cs == 0) {
+        warn(ERR, "cannot open H3 control stream");
+        return;
+    }
+
+    // SETTINGS: no QPACK dynamic table, no blocked streams
+    static const uint8_t ctrl[] = {
+        0x00, // control stream type
+        h3zero_frame_settings, 0x04, 0x01, 0x00, 0x07, 0x00};
+    // the control stream must not be closed, so no FIN
+    q_write_str(w, cs, (const char *)ctrl, sizeof(ctrl), false);
+}
+
+
 static uint32_t __attribute__((nonnull))
 strm_key(struct q_conn * const c, const struct q_stream * const s)
 {
@@ -262,9 +796,41 @@ strm_key(struct q_conn * const c, const struct q_stream * const s)
 
 #define MAXPORTS 16
 
+static volatile sig_atomic_t drain_req = 0;
+
+
+static void on_sigterm(int sig __attribute__((unused)))
+{
+    drain_req = 1;
+}
+
+
+static volatile sig_atomic_t stats_req = 0;
+
+
+static void on_sigusr1(int sig __attribute__((unused)))
+{
+    stats_req = 1;
+}
+
+
+static void print_obj_stats(void)
+{
+    // not via warn(), so this also shows up in release builds
+    const uint64_t lookups = obj_hits + obj_misses;
+    fprintf(stderr,
+            "object cache: %" PRIu64 " hits, %" PRIu64
+            " misses (%.1f%% hits), %" PRIu64 " of %" PRIu64 " bytes used\n",
+            obj_hits, obj_misses,
+            lookups ? 100.0 * (double)obj_hits / (double)lookups : 0.0,
+            obj_size, obj_cap);
+}
+
+
 int main(int argc, char * argv[])
 {
     uint32_t timeout = 10;
+    uint32_t drain_timeout = 30;
 #ifndef NDEBUG
     short ini_dlevel = util_dlevel =
         DLEVEL; // default to maximum compiled-in verbosity
@@ -279,6 +845,7 @@ int main(int argc, char * argv[])
     char key[MAXPATHLEN] = "test/dummy.key";
     char tls_log[MAXPATHLEN] = "";
     char qlog_dir[MAXPATHLEN] = "";
+    char srt_key[MAXPATHLEN] = "";
     uint16_t port[MAXPORTS] = {4433, 4434};
     size_t num_ports = 0;
     uint32_t num_bufs = 100000;
@@ -288,6 +855,9 @@ int main(int argc, char * argv[])
     bool retry = false;
     bool disable_pmtud = false;
     bool enable_grease = false;
+    uint32_t max_conns = 0;
+    uint8_t free_bufs = 0;
+    uint32_t cache_mb = 64;
 
     // set default TLS log file from environment
     const char * const keylog = getenv("SSLKEYLOGFILE");
@@ -296,7 +866,8 @@ int main(int argc, char * argv[])
         tls_log[MAXPATHLEN - 1] = 0;
     }
 
-    while ((ch = getopt(argc, argv, "hi:p:d:v:c:k:t:b:q:rl:x:og")) != -1) {
+    while ((ch = getopt(argc, argv, "hi:p:d:v:c:k:t:b:q:rl:x:ogs:m:f:w:z:")) !=
+           -1) {
         switch (ch) {
         case 'q':
             strncpy(qlog_dir, optarg, sizeof(qlog_dir) - 1);
@@ -341,6 +912,21 @@ int main(int argc, char * argv[])
         case 'l':
             strncpy(tls_log, optarg, sizeof(tls_log) - 1);
             break;
+        case 's':
+            strncpy(srt_key, optarg, sizeof(srt_key) - 1);
+            break;
+        case 'm':
+            max_conns = (uint32_t)MIN(strtoul(optarg, 0, 10), UINT32_MAX);
+            break;
+        case 'f':
+            free_bufs = (uint8_t)MIN(100, strtoul(optarg, 0, 10));
+            break;
+        case 'w':
+            drain_timeout = (uint32_t)MIN(3600, strtoul(optarg, 0, 10));
+            break;
+        case 'z':
+            cache_mb = (uint32_t)MIN(UINT32_MAX, strtoul(optarg, 0, 10));
+            break;
         case 'v':
 #ifndef NDEBUG
             ini_dlevel = util_dlevel =
@@ -352,7 +938,8 @@ int main(int argc, char * argv[])
         default:
             usage(basename(argv[0]), ifname, qlog_dir, port[0], dir, cert, key,
                   tls_log, timeout, initial_rtt, retry, disable_pmtud,
-                  enable_grease, num_bufs);
+                  enable_grease, num_bufs, srt_key, max_conns, free_bufs,
+                  drain_timeout, cache_mb);
         }
     }
 
@@ -360,6 +947,9 @@ int main(int argc, char * argv[])
         // if no -p args were given, we listen on two ports by default
         num_ports = 2;
 
+    obj_cap = (uint64_t)cache_mb * 1024 * 1024;
+    for (size_t i = 0; i < sizeof(pattern); i++)
+        pattern[i] = (uint8_t)('A' + i % PAT_LEN % 26);
     const int dir_fd = open(dir, O_RDONLY | O_CLOEXEC);
     ensure(dir_fd != -1, "%s does not exist", dir);
 
@@ -378,7 +968,10 @@ int main(int argc, char * argv[])
                    .force_retry = retry,
                    .num_bufs = num_bufs,
                    .tls_cert = cert,
-                   .tls_key = key});
+                   .tls_key = key,
+                   .srt_key = *srt_key ? srt_key : 0,
+                   .evict_max_conns = max_conns,
+                   .evict_free_bufs = free_bufs});
     for (size_t i = 0; i < num_ports; i++) {
         for (uint16_t idx = 0; idx < w->addr_cnt; idx++) {
 #ifndef NDEBUG
@@ -393,23 +986,52 @@ int main(int argc, char * argv[])
         }
     }
 
+    // on SIGTERM, stop accepting conns and exit once existing ones are done
+    signal(SIGTERM, on_sigterm);
+    // on SIGUSR1, print the object cache stats
+    signal(SIGUSR1, on_sigusr1);
+
     khash_t(strm_cache) sc = {0};
     bool first_conn = true;
-    http_parser_settings settings = {.on_url = serve_cb};
+    bool draining = false;
+    uint64_t last_ready = 0;
+    http_parser_settings settings = {.on_url = url_cb,
+                                     .on_header_field = hdr_field_cb,
+                                     .on_header_value = hdr_value_cb,
+                                     .on_headers_complete = hdrs_done_cb};
 
     while (1) {
+        if (unlikely(drain_req) && draining == false) {
+            q_drain(w, drain_timeout * NS_PER_S);
+            draining = true;
+        }
+
+        if (unlikely(stats_req)) {
+            stats_req = 0;
+            print_obj_stats();
+        }
+
+        // wake up at least once a second, so a signal is acted on even when
+        // no pkts arrive and there is no idle timeout
         struct q_conn * c;
-        const bool have_active =
-            q_ready(w, first_conn ? 0 : timeout * NS_PER_S, &c);
+        const bool have_active = q_ready(w, NS_PER_S, &c);
         // warn(ERR, "%u %u", first_conn, have_active);
+        const uint64_t now = w_now(CLOCK_MONOTONIC_RAW);
         if (c == 0) {
-            if (have_active == false && timeout)
+            if (have_active == false &&
+                (draining ||
+                 (timeout && first_conn == false &&
+                  now - last_ready >= (uint64_t)timeout * NS_PER_S)))
                 break;
             continue;
         }
         first_conn = false;
+        last_ready = now;
 
         if (q_is_conn_closed(c)) {
+            const khiter_t h = kh_get(h3_conns, &h3c, conn_key(c));
+            if (h != kh_end(&h3c))
+                kh_del(h3_conns, &h3c, h);
             q_close(c, 0, 0);
             continue;
         }
@@ -421,9 +1043,18 @@ int main(int argc, char * argv[])
         if (s == 0)
             continue;
 
+        const char * const alpn = q_alpn(c);
+        const bool h3 = alpn && alpn[0] == 'h' && alpn[1] == '3';
+        if (h3)
+            h3_open_ctrl(w, c);
+
         if (q_is_uni_stream(s)) {
-            warn(NTE, "can't serve request on uni stream: %.*s",
-                 sq_first(&q)->len, sq_first(&q)->buf);
+            if (h3 == false && sq_empty(&q) == false)
+                warn(NTE, "can't serve request on uni stream: %.*s",
+                     sq_first(&q)->len, sq_first(&q)->buf);
+            // we don't need anything from the peer's H3 control stream, and
+            // QPACK encoder and decoder streams stay unused w/o dynamic table
+            q_free(&q);
             goto next;
         }
 
@@ -431,74 +1062,88 @@ int main(int argc, char * argv[])
             goto next;
 
         khiter_t k = kh_get(strm_cache, &sc, strm_key(c, s));
-        struct w_iov_sq * sq =
+        struct req * r =
             (kh_size(&sc) == 0 || k == kh_end(&sc) ? 0 : kh_val(&sc, k));
 
-        if (sq == 0) {
-            // this is a new stream, insert into stream cache
-            sq = calloc(1, sizeof(*sq));
-            ensure(sq, "calloc failed");
-            sq_init(sq);
+        if (r == 0) {
+            // this is a new stream, set up its parser
+            r = calloc(1, sizeof(*r));
+            ensure(r, "calloc failed");
+            r->d = (struct cb_data){
+                .c = c, .w = w, .dir = dir_fd, .s = s, .h3 = h3};
+            http_parser_init(&r->parser, HTTP_REQUEST);
+            r->parser.data = r;
             int err;
             k = kh_put(strm_cache, &sc, strm_key(c, s), &err);
             ensure(err >= 1, "inserted returned %d", err);
-            kh_val(&sc, k) = sq;
+            kh_val(&sc, k) = r;
         }
-        sq_concat(sq, &q);
-
-        if (q_peer_closed_stream(s) && !sq_empty(sq)) {
-            // do we need to handle a request?
-            char url[8192];
-            size_t url_len = 0;
-            struct w_iov * v;
-            sq_foreach (v, sq, next) {
-                memcpy(&url[url_len], v->buf, v->len);
-                url_len += v->len;
-            }
 
-            http_parser parser = {
-                .data = &(struct cb_data){.c = c,
-                                          .w = w,
-                                          .dir = dir_fd,
-                                          .s = s,
-                                          .af = sq_first(sq)->wv_af}};
-            http_parser_init(&parser, HTTP_REQUEST);
+        // feed the new data to the parser as it arrives, without copying it
+        bool parse_err = false;
+        struct w_iov * v;
+        sq_foreach (v, &q, next) {
+            if (r->done || v->len == 0)
+                // http_parser takes zero-length input as EOF
+                continue;
+            r->d.af = v->wv_af;
+            if (r->d.h3) {
+                if (h3_rx(r, v) == false) {
+                    parse_err = true;
+                    break;
+                }
+                continue;
+            }
 
+            const char * const buf = (const char *)v->buf;
+            r->end = buf + v->len;
             const size_t parsed =
-                http_parser_execute(&parser, &settings, url, url_len);
-            if (parsed != url_len) {
-                warn(ERR, "HTTP parser error: %.*s", (int)(url_len - parsed),
-                     &url[parsed]);
+                http_parser_execute(&r->parser, &settings, buf, v->len);
+            if (parsed != v->len) {
+                warn(ERR, "HTTP parser error: %.*s", (int)(v->len - parsed),
+                     &buf[parsed]);
                 // XXX the strnlen() test is super-hacky
-                if (strnlen(url, url_len) == url_len)
-                    send_err(parser.data, 400);
+                if (strnlen(buf, v->len) == v->len)
+                    send_err(&r->d, 400);
                 else
-                    send_err(parser.data, 505);
-                ret = 1;
-                continue;
+                    send_err(&r->d, 505);
+                r->done = parse_err = true;
+                break;
             }
         }
+        q_free(&q);
+        if (parse_err) {
+            ret = 1;
+            continue;
+        }
+
+        if (q_peer_closed_stream(s) && r->d.h3 == false && r->done == false &&
+            r->url_len) {
+            // the request ended without an empty line after the request line
+            // or headers
+            r->done = true;
+            serve(&r->d, r->url, r->url_len);
+        }
 
     next:
         if (q_is_stream_closed(s)) {
             // retrieve the TX'ed request
             q_stream_get_written(s, &q);
-#ifndef NDEBUG
-            // if we wrote a "benchmark objects", increase logging
-            const uint_t len = w_iov_sq_len(&q);
-            if (is_bench_obj(len) && --bench_cnt == 0) {
-                util_dlevel = ini_dlevel;
-                warn(NTE, "increasing log level after benchmark object "
-                          "transfer");
-            }
-#endif
             k = kh_get(strm_cache, &sc, strm_key(c, s));
             // warn(ERR, "kh_size %u %u", kh_size(&sc), k != kh_end(&sc));
             // ensure(kh_size(&sc) && k != kh_end(&sc), "found");
             if (kh_size(&sc) && k != kh_end(&sc)) {
-                sq = kh_val(&sc, k);
-                q_free(sq);
-                free(sq);
+                r = kh_val(&sc, k);
+#ifndef NDEBUG
+                // if we wrote a "benchmark objects", increase logging
+                if (is_bench_obj(r->d.gen_len) && --bench_cnt == 0) {
+                    util_dlevel = ini_dlevel;
+                    warn(NTE, "increasing log level after benchmark object "
+                              "transfer");
+                }
+#endif
+                free(r->url);
+                free(r);
                 kh_del(strm_cache, &sc, k);
             }
             q_free_stream(s);
@@ -508,9 +1153,19 @@ int main(int argc, char * argv[])
     }
 
     q_cleanup(w);
-    struct w_iov_sq * sq;
-    kh_foreach_value(&sc, sq, { free(sq); });
+    struct req * r;
+    kh_foreach_value(&sc, r, {
+        free(r->url);
+        free(r);
+    });
     kh_release(strm_cache, &sc);
+
+    print_obj_stats();
+    for (khiter_t k = kh_begin(&objs); k != kh_end(&objs); k++)
+        if (kh_exist(&objs, k))
+            obj_del(k);
+    kh_release(obj_cache, &objs);
+    kh_release(h3_conns, &h3c);
     warn(DBG, "%s exiting with %d", basename(argv[0]), ret);
     return ret;
 }
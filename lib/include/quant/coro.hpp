@@ -0,0 +1,341 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#if !defined(__cpp_impl_coroutine) || !__has_include(<coroutine>)
+#error "quant/coro.hpp needs C++20 coroutine support"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <unordered_map>
+
+#include <quant/quant.hpp> // IWYU pragma: export
+
+
+/// Optional C++20 coroutine layer on top of quant.hpp. A quant::co::loop
+/// drives the engine via q_ready() and resumes the coroutines waiting on a
+/// connection whenever q_ready() reports that connection, so any number of
+/// coroutines can share one engine on one thread without blocking it.
+///
+/// All coroutines sharing a connection must be done with it before one of
+/// them closes it.
+namespace quant::co
+{
+
+/// Coroutine type for detached request handlers. It starts running right
+/// away, and its frame is freed when it finishes.
+class task
+{
+  public:
+    struct promise_type {
+        task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        [[noreturn]] void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+
+class loop;
+
+
+/// Common part of the awaiters below. An awaiter is parked on its connection
+/// until its @p ready function returns true after q_ready() reported that
+/// connection. It lives in the coroutine frame, so parking allocates nothing
+/// besides the per-connection map entry.
+class waiter
+{
+  public:
+    waiter(const waiter &) = delete;
+    waiter & operator=(const waiter &) = delete;
+
+    void await_suspend(const std::coroutine_handle<> h) noexcept;
+
+  protected:
+    using ready_fn = bool (*)(waiter &) noexcept;
+
+    waiter(loop & l, struct q_conn * const c, const ready_fn ready) noexcept
+        : l_(l), c_(c), ready_(ready)
+    {
+    }
+
+    ~waiter() = default;
+
+    loop & l_;
+    struct q_conn * c_;
+
+  private:
+    friend class loop;
+
+    ready_fn ready_;
+    waiter * next_ = nullptr;
+    std::coroutine_handle<> h_;
+};
+
+
+/// co_await loop::connect() -> quant::conn, empty if the handshake failed.
+class connect_op : public waiter
+{
+  public:
+    connect_op(loop & l, struct q_conn * const c) noexcept
+        : waiter(l, c, [](waiter &) noexcept { return true; })
+    {
+    }
+
+    // q_ready() only reports a starting conn when it's connected or closed
+    bool await_ready() const noexcept { return c_ == nullptr; }
+
+    conn await_resume() const noexcept
+    {
+        if (c_ && q_is_conn_closed(c_)) {
+            q_close(c_, 0, nullptr);
+            return conn();
+        }
+        return conn(c_);
+    }
+};
+
+
+/// co_await loop::read(c, q) -> stream data was appended to @p q for, or
+/// null if the connection closed.
+class read_op : public waiter
+{
+  public:
+    read_op(loop & l, conn & c, chain & q) noexcept
+        : waiter(l, c.get(), poll), q_(q)
+    {
+    }
+
+    bool await_ready() noexcept { return poll(*this); }
+    struct q_stream * await_resume() const noexcept { return s_; }
+
+  private:
+    static bool poll(waiter & w) noexcept
+    {
+        auto & r = static_cast<read_op &>(w);
+        r.s_ = q_read(r.c_, r.q_.get(), false);
+        return r.s_ || q_is_conn_closed(r.c_);
+    }
+
+    chain & q_;
+    struct q_stream * s_ = nullptr;
+};
+
+
+/// co_await loop::read(c, s, q) -> true if data was appended to @p q, false
+/// once the stream (or connection) has been closed by the peer.
+class stream_read_op : public waiter
+{
+  public:
+    stream_read_op(loop & l, conn & c, stream & s, chain & q) noexcept
+        : waiter(l, c.get(), poll), s_(s.get()), q_(q)
+    {
+    }
+
+    bool await_ready() noexcept { return poll(*this); }
+    bool await_resume() const noexcept { return got_; }
+
+  private:
+    static bool poll(waiter & w) noexcept
+    {
+        auto & r = static_cast<stream_read_op &>(w);
+        r.got_ = q_read_stream(r.s_, r.q_.get(), false);
+        return r.got_ || q_peer_closed_stream(r.s_) || q_is_conn_closed(r.c_);
+    }
+
+    struct q_stream * s_;
+    chain & q_;
+    bool got_ = false;
+};
+
+
+/// co_await loop::writable(c, s) -> true once all data written to @p s so
+/// far has been acknowledged, false if the connection closed before that.
+/// q_write() never blocks, so this is how a writer applies backpressure.
+class writable_op : public waiter
+{
+  public:
+    writable_op(loop & l, conn & c, stream & s) noexcept
+        : waiter(l, c.get(), poll), s_(s.get())
+    {
+    }
+
+    bool await_ready() noexcept { return poll(*this); }
+    bool await_resume() const noexcept { return !q_is_conn_closed(c_); }
+
+  private:
+    static bool poll(waiter & w) noexcept
+    {
+        auto & r = static_cast<writable_op &>(w);
+        return q_notify_written(r.s_) || q_is_conn_closed(r.c_);
+    }
+
+    struct q_stream * s_;
+};
+
+
+/// co_await loop::close(c, ...) -> @p c has been closed and freed.
+class close_op : public waiter
+{
+  public:
+    close_op(loop & l,
+             conn & c,
+             const uint_t code,
+             const char * const reason) noexcept
+        : waiter(l, c.get(), poll), c_ref_(c), code_(code), reason_(reason)
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return c_ == nullptr || !q_close_start(c_, code_, reason_) ||
+               q_is_conn_closed(c_);
+    }
+
+    // the conn is closed (or never needed the closing dance), so this
+    // only frees it without blocking
+    void await_resume() const noexcept { c_ref_.close(code_, reason_); }
+
+  private:
+    static bool poll(waiter & w) noexcept
+    {
+        return q_is_conn_closed(static_cast<close_op &>(w).c_);
+    }
+
+    conn & c_ref_;
+    uint_t code_;
+    const char * reason_;
+};
+
+
+/// Drives the engine and resumes the coroutines waiting on it.
+class loop
+{
+  public:
+    explicit loop(struct w_engine * const w) noexcept : w_(w) {}
+
+    loop(const loop &) = delete;
+    loop & operator=(const loop &) = delete;
+
+    struct w_engine * engine() const noexcept { return w_; }
+
+    /// @return     Number of coroutines currently waiting.
+    size_t waiting() const noexcept { return n_; }
+
+    /// Resume coroutines as their connections become ready, until none is
+    /// waiting anymore, or until nothing happened for @p nsec (if non-zero).
+    void run(const uint64_t nsec = 0)
+    {
+        while (n_) {
+            struct q_conn * c = nullptr;
+            q_ready(w_, nsec, &c);
+            if (c)
+                wake(c);
+            else if (nsec)
+                return;
+        }
+    }
+
+    connect_op connect(const struct sockaddr * const peer,
+                       const char * const peer_name,
+                       const char * const alpn = nullptr,
+                       const struct q_conn_conf * const conf = nullptr) noexcept
+    {
+        return connect_op(*this,
+                          q_connect_start(w_, peer, peer_name, alpn, conf));
+    }
+
+    read_op read(conn & c, chain & q) noexcept { return read_op(*this, c, q); }
+
+    stream_read_op read(conn & c, stream & s, chain & q) noexcept
+    {
+        return stream_read_op(*this, c, s, q);
+    }
+
+    writable_op writable(conn & c, stream & s) noexcept
+    {
+        return writable_op(*this, c, s);
+    }
+
+    close_op close(conn & c,
+                   const uint_t code = 0,
+                   const char * const reason = nullptr) noexcept
+    {
+        return close_op(*this, c, code, reason);
+    }
+
+  private:
+    friend class waiter;
+
+    void park(waiter & w)
+    {
+        waiter *& head = parked_[w.c_];
+        w.next_ = head;
+        head = &w;
+        n_++;
+    }
+
+    void wake(struct q_conn * const c)
+    {
+        const auto it = parked_.find(c);
+        if (it == parked_.end())
+            return;
+
+        // detach the list, since resumed coroutines may park on c again
+        waiter * w = it->second;
+        parked_.erase(it);
+        while (w) {
+            // w is gone once its coroutine has been resumed
+            waiter * const next = w->next_;
+            n_--;
+            if (w->ready_(*w))
+                w->h_.resume();
+            else
+                park(*w);
+            w = next;
+        }
+    }
+
+    struct w_engine * w_;
+    size_t n_ = 0;
+    std::unordered_map<struct q_conn *, waiter *> parked_;
+};
+
+
+inline void waiter::await_suspend(const std::coroutine_handle<> h) noexcept
+{
+    h_ = h;
+    l_.park(*this);
+}
+
+} // namespace quant::co
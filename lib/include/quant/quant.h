@@ -41,6 +41,7 @@ extern "C" {
 
 struct w_iov_sq;
 struct q_stream;
+struct iovec;
 
 
 struct q_conn_conf {
@@ -56,6 +57,12 @@ struct q_conn_conf {
     uint8_t enable_grease : 1; // draft-thomson-quic-bit-grease
     uint8_t : 1;
     uint32_t version;
+    uint_t keepalive; // seconds without TX before sending a PING (0 = off)
+    uint_t max_datagram_frame_size; // RFC 9221 DATAGRAM support (0 = off)
+    uint_t datagram_rx_queue; // inbound DATAGRAMs buffered before dropping
+    bool enable_fec; // XOR-based FEC for STREAM data (quant peers only)
+    bool enable_l4s; // send ECT(1) and scale cwnd back by CE fraction
+    uint_t max_strm_mem; // bytes of stream state peers may keep open (approx.)
 };
 
 
@@ -73,6 +80,10 @@ struct q_conf {
     uint8_t : 6;
     uint8_t client_cid_len;
     uint8_t server_cid_len;
+    uint8_t evict_free_bufs; // server: evict idle conns below this % free bufs
+    const char * const srt_key; // secret for stateless reset tokens (optional)
+    uint_t evict_max_conns;     // server: evict idle conns beyond this number
+    bool enable_async; // allow the q_*_async() calls from other threads
 };
 
 
@@ -88,6 +99,7 @@ struct q_conn_info {
     uint_t strm_frms_in_ooo;
     uint_t strm_frms_in_dup;
     uint_t strm_frms_in_ign;
+    uint_t strm_frms_in_fec; ///< STREAM frames reconstructed from REPAIRs
 
     float rtt;
     float rttvar;
@@ -98,9 +110,11 @@ struct q_conn_info {
     uint_t max_cwnd;
     uint_t ssthresh;
     uint_t pto_cnt;
+    uint_t pers_cong_cnt; ///< Times persistent congestion collapsed cwnd.
 
-    // 0x1e = max. frame type
-    uint_t frm_cnt[2][0x1e + 1]; // 0 = out (tx), 1 = in (rx)
+    // 0x20 = max. frame type (DATAGRAM frames are counted at 0x1f, REPAIR
+    // frames at 0x20)
+    uint_t frm_cnt[2][0x20 + 1]; // 0 = out (tx), 1 = in (rx)
 };
 
 
@@ -119,28 +133,76 @@ q_connect(struct w_engine * const w,
           const char * const alpn,
           const struct q_conn_conf * const conf);
 
+extern struct q_conn * __attribute__((nonnull(1, 2, 3)))
+q_connect_start(struct w_engine * const w,
+                const struct sockaddr * const peer,
+                const char * const peer_name,
+                const char * const alpn,
+                const struct q_conn_conf * const conf);
+
 extern void __attribute__((nonnull(1)))
 q_close(struct q_conn * const c, const uint_t code, const char * const reason);
 
+extern bool __attribute__((nonnull(1)))
+q_close_start(struct q_conn * const c,
+              const uint_t code,
+              const char * const reason);
+
 extern struct q_conn * __attribute__((nonnull))
 q_bind(struct w_engine * const w, const uint16_t addr_idx, const uint16_t port);
 
+extern void __attribute__((nonnull))
+q_drain(struct w_engine * const w, const uint64_t nsec);
+
 extern bool __attribute__((nonnull))
 q_write(struct q_stream * const s, struct w_iov_sq * const q, const bool fin);
 
+extern bool __attribute__((nonnull)) q_write_gen(struct q_stream * const s,
+                                                 const uint8_t * const pat,
+                                                 const size_t pat_len,
+                                                 const uint_t len,
+                                                 const bool fin);
+
+/// Called once the application memory passed to q_write_iov() is no longer
+/// referenced; @p ok is false if the stream went away before all of it was
+/// acknowledged. Runs from inside quant, so it must not free the stream.
+typedef void (*q_release_cb)(void * const arg, const bool ok);
+
+/// Queue the application memory in @p iov for TX on @p s without copying it;
+/// @p cb is called once it is no longer referenced. Packets are encrypted
+/// straight from @p iov, and so are any retransmissions, which is why @p cb
+/// only runs once all of the data has been acknowledged, and not as soon as
+/// it has been sent once.
+extern bool __attribute__((nonnull(1, 2)))
+q_write_iov(struct q_stream * const s,
+            const struct iovec * const iov,
+            const size_t cnt,
+            const bool fin,
+            const q_release_cb cb,
+            void * const arg);
+
 extern struct q_stream * __attribute__((nonnull))
 q_read(struct q_conn * const c, struct w_iov_sq * const q, const bool all);
 
 extern struct q_stream * __attribute__((nonnull))
 q_rsv_stream(struct q_conn * const c, const bool bidi);
 
+extern uint_t __attribute__((nonnull))
+q_strms_avail(const struct q_conn * const c, const bool bidi);
+
 extern void __attribute__((nonnull)) q_close_stream(struct q_stream * const s);
 
 extern void __attribute__((nonnull)) q_free_stream(struct q_stream * const s);
 
+extern void __attribute__((nonnull))
+q_release_stream(struct q_stream * const s);
+
 extern void __attribute__((nonnull))
 q_stream_get_written(struct q_stream * const s, struct w_iov_sq * const q);
 
+extern bool __attribute__((nonnull))
+q_notify_written(struct q_stream * const s);
+
 extern void __attribute__((nonnull(1, 2)))
 q_alloc(struct w_engine * const w,
         struct w_iov_sq * const q,
@@ -156,8 +218,13 @@ q_cid(struct q_conn * const c, uint8_t * const buf, size_t * const buf_len);
 extern const char * __attribute__((nonnull))
 q_cid_str(struct q_conn * const c, char * const buf, const size_t buf_len);
 
+extern const char * __attribute__((nonnull)) q_alpn(struct q_conn * const c);
+
 extern uint_t __attribute__((nonnull)) q_sid(const struct q_stream * const s);
 
+extern struct q_stream * __attribute__((nonnull))
+q_sid_stream(struct q_conn * const c, const uint_t sid);
+
 extern void __attribute__((nonnull(1, 4, 6)))
 q_chunk_str(struct w_engine * const w,
             const struct q_conn * const c,
@@ -191,6 +258,13 @@ extern bool __attribute__((nonnull)) q_read_stream(struct q_stream * const s,
                                                    struct w_iov_sq * const q,
                                                    const bool all);
 
+extern bool __attribute__((nonnull))
+q_write_dgram(struct q_conn * const c, struct w_iov_sq * const q);
+
+extern bool __attribute__((nonnull)) q_read_dgram(struct q_conn * const c,
+                                                  struct w_iov_sq * const q,
+                                                  const bool block);
+
 extern bool q_ready(struct w_engine * const w,
                     const uint64_t nsec,
                     struct q_conn ** const ready);
@@ -203,6 +277,15 @@ extern bool __attribute__((nonnull(1)))
 q_migrate(struct q_conn * const c,
           const bool switch_ip,
           const struct sockaddr * const alt_peer);
+
+extern bool __attribute__((nonnull)) q_conn_export(struct q_conn * const c,
+                                                   uint8_t * const buf,
+                                                   size_t * const buf_len);
+
+extern struct q_conn * __attribute__((nonnull))
+q_conn_import(struct w_engine * const w,
+              const uint8_t * const buf,
+              const size_t buf_len);
 #endif
 
 extern void __attribute__((nonnull))
@@ -210,6 +293,38 @@ q_info(struct q_conn * const c, struct q_conn_info * const ci);
 
 extern int __attribute__((nonnull)) q_conn_af(const struct q_conn * const c);
 
+#ifndef NO_ASYNC
+/// Completion callback for the q_*_async() calls. Runs on the engine thread;
+/// @p ok is false if the command could not be carried out.
+///
+/// A queued command references its stream or connection until the callback
+/// has run, so that object must stay alive until then. q_free_stream(),
+/// q_release_stream() and q_close() run all queued commands before freeing
+/// anything, but the application must not submit new commands for an object
+/// from another thread while it is being freed.
+typedef void (*q_async_cb)(void * const arg, const bool ok);
+
+extern bool __attribute__((nonnull(1)))
+q_write_async(struct q_stream * const s,
+              const void * const buf,
+              const size_t len,
+              const bool fin,
+              const q_async_cb cb,
+              void * const arg);
+
+extern bool __attribute__((nonnull(1)))
+q_close_stream_async(struct q_stream * const s,
+                     const q_async_cb cb,
+                     void * const arg);
+
+extern bool __attribute__((nonnull(1)))
+q_close_async(struct q_conn * const c,
+              const uint_t code,
+              const char * const reason,
+              const q_async_cb cb,
+              void * const arg);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,333 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+
+#include <quant/quant.h> // IWYU pragma: export
+
+
+/// Header-only, move-only owning wrappers around the quant C API. They hold
+/// exactly the raw handle (or the raw w_iov_sq), never allocate, and release
+/// it on destruction, so they can be used instead of hand-written cleanup on
+/// every error path.
+///
+/// Destruction order matters the same way it does in C: a quant::stream must
+/// be destroyed before the quant::conn it belongs to, and everything before
+/// q_cleanup() is called on the engine.
+namespace quant
+{
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+using bytes = std::span<uint8_t>; ///< View of a buffer payload.
+#else
+/// Minimal stand-in for std::span<uint8_t> when building below C++20.
+class bytes
+{
+  public:
+    constexpr bytes() noexcept = default;
+    constexpr bytes(uint8_t * const d, const size_t n) noexcept
+        : d_(d), n_(n)
+    {
+    }
+
+    constexpr uint8_t * data() const noexcept { return d_; }
+    constexpr size_t size() const noexcept { return n_; }
+    constexpr bool empty() const noexcept { return n_ == 0; }
+    constexpr uint8_t * begin() const noexcept { return d_; }
+    constexpr uint8_t * end() const noexcept { return d_ + n_; }
+    constexpr uint8_t & operator[](const size_t i) const noexcept
+    {
+        return d_[i];
+    }
+
+  private:
+    uint8_t * d_ = nullptr;
+    size_t n_ = 0;
+};
+#endif
+
+
+/// @return     View of the payload of buffer @p v.
+inline bytes payload(const struct w_iov & v) noexcept
+{
+    return {v.buf, v.len};
+}
+
+
+/// Owning chain of w_iov buffers, returned to the engine with q_free() on
+/// destruction. Iterating over a chain yields the individual w_iovs.
+class chain
+{
+  public:
+    class iterator
+    {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = struct w_iov;
+        using difference_type = std::ptrdiff_t;
+        using pointer = struct w_iov *;
+        using reference = struct w_iov &;
+
+        constexpr iterator() noexcept = default;
+        constexpr explicit iterator(struct w_iov * const v) noexcept : v_(v) {}
+
+        reference operator*() const noexcept { return *v_; }
+        pointer operator->() const noexcept { return v_; }
+
+        iterator & operator++() noexcept
+        {
+            v_ = sq_next(v_, next);
+            return *this;
+        }
+
+        iterator operator++(int) noexcept
+        {
+            const iterator i = *this;
+            ++*this;
+            return i;
+        }
+
+        constexpr bool operator==(const iterator & o) const noexcept
+        {
+            return v_ == o.v_;
+        }
+        constexpr bool operator!=(const iterator & o) const noexcept
+        {
+            return v_ != o.v_;
+        }
+
+      private:
+        struct w_iov * v_ = nullptr;
+    };
+
+    chain() noexcept { sq_init(&q_); }
+
+    /// Allocate @p len bytes worth of buffers for use on connection @p c (or
+    /// any connection of address family @p af, if @p c is null).
+    chain(struct w_engine * const w,
+          const struct q_conn * const c,
+          const int af,
+          const size_t len) noexcept
+    {
+        sq_init(&q_);
+        q_alloc(w, &q_, c, af, len);
+    }
+
+    chain(const chain &) = delete;
+    chain & operator=(const chain &) = delete;
+
+    chain(chain && o) noexcept
+    {
+        sq_init(&q_);
+        sq_concat(&q_, &o.q_);
+    }
+
+    chain & operator=(chain && o) noexcept
+    {
+        if (this != &o) {
+            reset();
+            sq_concat(&q_, &o.q_);
+        }
+        return *this;
+    }
+
+    ~chain() { reset(); }
+
+    /// Return all buffers to the engine.
+    void reset() noexcept { q_free(&q_); }
+
+    /// Move all buffers of @p o to the end of this chain.
+    void append(chain & o) noexcept { sq_concat(&q_, &o.q_); }
+
+    /// @return     Underlying queue, for passing to the C API.
+    struct w_iov_sq * get() noexcept { return &q_; }
+    const struct w_iov_sq * get() const noexcept { return &q_; }
+
+    bool empty() const noexcept { return sq_empty(&q_); }
+    uint_t count() const noexcept { return w_iov_sq_cnt(&q_); }
+    uint_t len() const noexcept { return w_iov_sq_len(&q_); }
+
+    iterator begin() const noexcept { return iterator(sq_first(&q_)); }
+    iterator end() const noexcept { return iterator(); }
+
+  private:
+    struct w_iov_sq q_;
+};
+
+
+/// Owning handle of a stream, released with q_free_stream() on destruction.
+class stream
+{
+  public:
+    constexpr stream() noexcept = default;
+    constexpr explicit stream(struct q_stream * const s) noexcept : s_(s) {}
+
+    stream(const stream &) = delete;
+    stream & operator=(const stream &) = delete;
+
+    stream(stream && o) noexcept : s_(std::exchange(o.s_, nullptr)) {}
+
+    stream & operator=(stream && o) noexcept
+    {
+        if (this != &o)
+            reset(std::exchange(o.s_, nullptr));
+        return *this;
+    }
+
+    ~stream() { reset(); }
+
+    /// Free the current stream (if any) and take ownership of @p s.
+    void reset(struct q_stream * const s = nullptr) noexcept
+    {
+        if (s_)
+            q_free_stream(s_);
+        s_ = s;
+    }
+
+    /// Give up ownership without freeing the stream.
+    struct q_stream * release() noexcept { return std::exchange(s_, nullptr); }
+
+    struct q_stream * get() const noexcept { return s_; }
+    explicit operator bool() const noexcept { return s_ != nullptr; }
+
+    uint_t sid() const noexcept { return q_sid(s_); }
+    bool is_closed() const noexcept { return q_is_stream_closed(s_); }
+    bool peer_closed() const noexcept { return q_peer_closed_stream(s_); }
+    bool is_uni() const noexcept { return q_is_uni_stream(s_); }
+
+    /// Enqueue the buffers of @p q for transmission, leaving @p q empty.
+    bool write(chain & q, const bool fin = false) noexcept
+    {
+        return q_write(s_, q.get(), fin);
+    }
+
+    /// Append any received data to @p q.
+    bool read(chain & q, const bool all = false) noexcept
+    {
+        return q_read_stream(s_, q.get(), all);
+    }
+
+    /// @return     Chain holding the buffers that have been fully sent.
+    chain written() noexcept
+    {
+        chain q;
+        q_stream_get_written(s_, q.get());
+        return q;
+    }
+
+    void close() noexcept { q_close_stream(s_); }
+
+  private:
+    struct q_stream * s_ = nullptr;
+};
+
+
+/// Owning handle of a connection, closed with q_close() on destruction.
+class conn
+{
+  public:
+    constexpr conn() noexcept = default;
+    constexpr explicit conn(struct q_conn * const c) noexcept : c_(c) {}
+
+    conn(const conn &) = delete;
+    conn & operator=(const conn &) = delete;
+
+    conn(conn && o) noexcept : c_(std::exchange(o.c_, nullptr)) {}
+
+    conn & operator=(conn && o) noexcept
+    {
+        if (this != &o)
+            reset(std::exchange(o.c_, nullptr));
+        return *this;
+    }
+
+    ~conn() { reset(); }
+
+    /// Close the current connection (if any) and take ownership of @p c.
+    void reset(struct q_conn * const c = nullptr) noexcept
+    {
+        if (c_)
+            q_close(c_, 0, nullptr);
+        c_ = c;
+    }
+
+    /// Close the connection with error @p code and @p reason.
+    void close(const uint_t code, const char * const reason = nullptr) noexcept
+    {
+        if (c_)
+            q_close(std::exchange(c_, nullptr), code, reason);
+    }
+
+    struct q_conn * release() noexcept { return std::exchange(c_, nullptr); }
+
+    struct q_conn * get() const noexcept { return c_; }
+    explicit operator bool() const noexcept { return c_ != nullptr; }
+
+    int af() const noexcept { return q_conn_af(c_); }
+    bool is_closed() const noexcept { return q_is_conn_closed(c_); }
+
+    /// Reserve a new locally-initiated stream; empty if the peer's stream
+    /// limit has been reached. Unlike q_rsv_stream(), this never blocks
+    /// waiting for MAX_STREAMS credit.
+    stream reserve(const bool bidi = true) noexcept
+    {
+        if (q_strms_avail(c_, bidi) == 0)
+            return stream();
+        return stream(q_rsv_stream(c_, bidi));
+    }
+
+    /// Read data from any stream into @p q.
+    ///
+    /// @return     The stream the data belongs to (or null). The stream is
+    ///             not owned by the caller; wrap it in a quant::stream to
+    ///             take ownership.
+    struct q_stream * read(chain & q, const bool all = false) noexcept
+    {
+        return q_read(c_, q.get(), all);
+    }
+
+    /// Allocate buffers for @p len bytes suitable for this connection.
+    chain alloc(struct w_engine * const w, const size_t len) const noexcept
+    {
+        return chain(w, c_, q_conn_af(c_), len);
+    }
+
+  private:
+    struct q_conn * c_ = nullptr;
+};
+
+} // namespace quant
@@ -0,0 +1,341 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef NO_ASYNC
+
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <quant/quant.h>
+
+#include "async.h"
+#include "conn.h"
+#include "quic.h"
+#include "stream.h"
+
+
+// Any thread may submit commands, but only the engine thread touches
+// connections and streams. A command references the caller's data until its
+// callback has run on the engine thread.
+
+
+enum async_op { op_write, op_close_stream, op_close };
+
+
+struct async_cmd {
+    _Atomic(struct async_cmd *) next;
+    struct q_stream * s;
+    struct q_conn * c;
+    const void * buf;
+    const char * reason;
+    size_t len;
+    uint_t code;
+    q_async_cb cb;
+    void * arg;
+    enum async_op op;
+    bool fin;
+    uint8_t _unused[3];
+};
+
+
+static void __attribute__((nonnull))
+push(struct async_q * const a, struct async_cmd * const cmd)
+{
+    atomic_store_explicit(&cmd->next, 0, memory_order_relaxed);
+    struct async_cmd * const prev =
+        atomic_exchange_explicit(&a->head, cmd, memory_order_acq_rel);
+    // until this store, the consumer cannot see cmd (or anything after it)
+    atomic_store_explicit(&prev->next, cmd, memory_order_release);
+}
+
+
+static struct async_cmd * __attribute__((nonnull)) pop(struct async_q * const a)
+{
+    struct async_cmd * tail = a->tail;
+    struct async_cmd * next =
+        atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == a->stub) {
+        if (next == 0)
+            return 0;
+        a->tail = tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+
+    if (next) {
+        a->tail = next;
+        return tail;
+    }
+
+    if (tail != atomic_load_explicit(&a->head, memory_order_acquire))
+        // a producer is in the middle of push(), it will wake us up after
+        return 0;
+
+    // tail is the last command, put the stub behind it so we can take it
+    push(a, a->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        a->tail = next;
+        return tail;
+    }
+    return 0;
+}
+
+
+static bool __attribute__((nonnull))
+submit(struct w_engine * const w, struct async_cmd * const cmd)
+{
+    struct async_q * const a = &ped(w)->async;
+    if (unlikely(a->stub == 0)) {
+        // q_conf.enable_async was not set
+        free(cmd);
+        return false;
+    }
+
+    push(a, cmd);
+    if (atomic_exchange(&a->wake_pending, true) == false) {
+        static const uint8_t wake = 0;
+        sendto(a->wake_fd, &wake, sizeof(wake), 0,
+               (const struct sockaddr *)&a->wake_sa,
+               a->wake_sa.ss_family == AF_INET ? sizeof(struct sockaddr_in)
+                                               : sizeof(struct sockaddr_in6));
+    }
+    return true;
+}
+
+
+static struct async_cmd *
+new_cmd(const enum async_op op, const q_async_cb cb, void * const arg)
+{
+    struct async_cmd * const cmd = calloc(1, sizeof(*cmd));
+    if (cmd) {
+        cmd->op = op;
+        cmd->cb = cb;
+        cmd->arg = arg;
+    }
+    return cmd;
+}
+
+
+bool q_write_async(struct q_stream * const s,
+                   const void * const buf,
+                   const size_t len,
+                   const bool fin,
+                   const q_async_cb cb,
+                   void * const arg)
+{
+    struct async_cmd * const cmd = new_cmd(op_write, cb, arg);
+    if (unlikely(cmd == 0))
+        return false;
+    cmd->s = s;
+    cmd->buf = buf;
+    cmd->len = len;
+    cmd->fin = fin;
+    return submit(s->c->w, cmd);
+}
+
+
+bool q_close_stream_async(struct q_stream * const s,
+                          const q_async_cb cb,
+                          void * const arg)
+{
+    struct async_cmd * const cmd = new_cmd(op_close_stream, cb, arg);
+    if (unlikely(cmd == 0))
+        return false;
+    cmd->s = s;
+    return submit(s->c->w, cmd);
+}
+
+
+bool q_close_async(struct q_conn * const c,
+                   const uint_t code,
+                   const char * const reason,
+                   const q_async_cb cb,
+                   void * const arg)
+{
+    struct async_cmd * const cmd = new_cmd(op_close, cb, arg);
+    if (unlikely(cmd == 0))
+        return false;
+    cmd->c = c;
+    cmd->code = code;
+    cmd->reason = reason;
+    return submit(c->w, cmd);
+}
+
+
+static bool __attribute__((nonnull))
+exec_cmd(struct w_engine * const w, const struct async_cmd * const cmd)
+{
+    struct w_iov_sq q = w_iov_sq_initializer(q);
+    bool ok = false;
+    switch (cmd->op) {
+    case op_write:
+        if (cmd->len)
+            q_chunk_str(w, cmd->s->c, q_conn_af(cmd->s->c), cmd->buf,
+                        cmd->len, &q);
+        ok = q_write(cmd->s, &q, cmd->fin);
+        break;
+    case op_close_stream:
+        ok = q_write(cmd->s, &q, true);
+        break;
+    case op_close:
+        // only start closing, the application still calls q_close() on the
+        // engine thread to free the connection once q_is_conn_closed()
+        ok = begin_close(cmd->c, cmd->code, cmd->reason);
+        break;
+    }
+    q_free(&q);
+    return ok;
+}
+
+
+void async_run(struct w_engine * const w)
+{
+    struct async_q * const a = &ped(w)->async;
+    if (a->stub == 0)
+        return;
+
+    // clear the flag before draining, so a command pushed after we look at
+    // the queue triggers another wakeup
+    if (atomic_load_explicit(&a->wake_pending, memory_order_relaxed))
+        atomic_store(&a->wake_pending, false);
+
+    struct async_cmd * cmd;
+    while ((cmd = pop(a)) != 0) {
+        const bool ok = exec_cmd(w, cmd);
+        if (cmd->cb)
+            cmd->cb(cmd->arg, ok);
+        free(cmd);
+    }
+}
+
+
+void async_rx(struct w_engine * const w)
+{
+    // the wakeup datagrams carry no information, but anyone can send them
+    struct async_q * const a = &ped(w)->async;
+    struct w_iov_sq x = w_iov_sq_initializer(x);
+    w_rx(a->ws, &x);
+    bool wake = false;
+    struct w_iov * v;
+    sq_foreach (v, &x, next)
+        if (likely(w_sockaddr_cmp(&v->saddr, &a->wake_src)))
+            wake = true;
+        else
+            warn(WRN, "ignoring async wakeup from foreign port %u",
+                 bswap16(v->saddr.port));
+    w_free(&x);
+    if (wake)
+        async_run(w);
+}
+
+
+void async_init(struct w_engine * const w)
+{
+    struct async_q * const a = &ped(w)->async;
+    a->stub = calloc(1, sizeof(*a->stub));
+    ensure(a->stub, "could not calloc");
+    atomic_init(&a->stub->next, 0);
+    atomic_init(&a->head, a->stub);
+    a->tail = a->stub;
+    atomic_init(&a->wake_pending, false);
+
+    // prefer an IPv4 address for the wakeup socket
+    uint16_t idx = 0;
+    for (uint16_t i = 0; i < w->addr_cnt; i++)
+        if (w->ifaddr[i].addr.af == AF_INET) {
+            idx = i;
+            break;
+        }
+    struct w_sockopt opt = {0};
+    a->ws = w_bind(w, idx, 0, &opt);
+    ensure(a->ws, "cannot bind async wakeup socket");
+
+    const struct w_addr * const la = &a->ws->ws_laddr;
+    if (la->af == AF_INET) {
+        struct sockaddr_in * const sin = (struct sockaddr_in *)&a->wake_sa;
+        sin->sin_family = AF_INET;
+        sin->sin_port = a->ws->ws_lport;
+        memcpy(&sin->sin_addr, &la->ip4, sizeof(sin->sin_addr));
+    } else {
+        struct sockaddr_in6 * const sin6 = (struct sockaddr_in6 *)&a->wake_sa;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = a->ws->ws_lport;
+        memcpy(&sin6->sin6_addr, la->ip6, sizeof(sin6->sin6_addr));
+    }
+    a->wake_fd = socket(la->af, SOCK_DGRAM, 0);
+    ensure(a->wake_fd != -1, "cannot open async wakeup socket");
+
+    // bind wake_fd to the address of ws, so async_rx() can tell our wakeups
+    // from datagrams other hosts send to ws
+    struct sockaddr_storage src = a->wake_sa;
+    socklen_t src_len = la->af == AF_INET ? sizeof(struct sockaddr_in)
+                                          : sizeof(struct sockaddr_in6);
+    if (la->af == AF_INET)
+        ((struct sockaddr_in *)&src)->sin_port = 0;
+    else
+        ((struct sockaddr_in6 *)&src)->sin6_port = 0;
+    ensure(bind(a->wake_fd, (struct sockaddr *)&src, src_len) == 0,
+           "cannot bind async wakeup socket");
+    ensure(getsockname(a->wake_fd, (struct sockaddr *)&src, &src_len) == 0,
+           "cannot get async wakeup socket address");
+    w_to_waddr(&a->wake_src.addr, (struct sockaddr *)&src);
+    a->wake_src.port = la->af == AF_INET
+                           ? ((struct sockaddr_in *)&src)->sin_port
+                           : ((struct sockaddr_in6 *)&src)->sin6_port;
+
+    warn(INF, "async command queue ready, wakeups on port %u",
+         bswap16(a->ws->ws_lport));
+}
+
+
+void async_cleanup(struct w_engine * const w)
+{
+    struct async_q * const a = &ped(w)->async;
+    if (a->stub == 0)
+        return;
+
+    // fail anything still queued
+    struct async_cmd * cmd;
+    while ((cmd = pop(a)) != 0) {
+        if (cmd->cb)
+            cmd->cb(cmd->arg, false);
+        free(cmd);
+    }
+
+    close(a->wake_fd);
+    w_close(a->ws);
+    free(a->stub);
+    a->stub = 0;
+}
+
+#endif
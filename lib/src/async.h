@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#ifndef NO_ASYNC
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <quant/quant.h>
+
+struct async_cmd;
+struct w_engine;
+struct w_sock;
+
+
+/// Commands submitted by other threads via the q_*_async() calls. This is a
+/// lock-free multi-producer/single-consumer queue (after Vyukov); the engine
+/// thread drains it from loop_run().
+///
+/// warpcore owns the wait in loop_run() and cannot poll other descriptors,
+/// so producers wake the engine by sending an empty datagram to @p ws.
+struct async_q {
+    _Atomic(struct async_cmd *) head; ///< Producers push here.
+    struct async_cmd * tail;          ///< The engine thread pops here.
+    struct async_cmd * stub;          ///< Placeholder keeping the queue linked.
+    struct w_sock * ws;               ///< Engine socket receiving wakeups.
+    struct sockaddr_storage wake_sa;  ///< Address of @p ws.
+    struct w_sockaddr wake_src;       ///< Address of @p wake_fd.
+    int wake_fd;                      ///< Kernel socket to send wakeups from.
+    atomic_bool wake_pending;         ///< A wakeup is in flight.
+    uint8_t _unused[3];
+};
+
+
+extern void __attribute__((nonnull)) async_init(struct w_engine * const w);
+
+extern void __attribute__((nonnull)) async_cleanup(struct w_engine * const w);
+
+extern void __attribute__((nonnull)) async_run(struct w_engine * const w);
+
+extern void __attribute__((nonnull)) async_rx(struct w_engine * const w);
+
+#endif
@@ -194,7 +194,12 @@ cid2str(const struct cid * const id, char * const dst, const size_t len_dst)
 }
 
 
-void mk_rand_cid(struct cid * const id,
+void mk_rand_cid(const struct w_engine * const w
+#ifdef NO_SRT_MATCHING
+                 __attribute__((unused))
+#endif
+                 ,
+                 struct cid * const id,
                  const uint8_t len,
                  const bool srt
 #ifdef NO_SRT_MATCHING
@@ -214,7 +219,11 @@ void mk_rand_cid(struct cid * const id,
 
 #ifndef NO_SRT_MATCHING
     id->has_srt = srt;
-    if (srt)
-        rand_bytes(id->srt, sizeof(id->srt));
+    if (srt) {
+        if (likely(id->len))
+            mk_srt(w, id, id->srt);
+        else
+            rand_bytes(id->srt, sizeof(id->srt));
+    }
 #endif
 }
@@ -136,7 +136,10 @@ extern void __attribute__((nonnull))
 cid_retire(struct cids * const ids, struct cid * const id);
 
 extern void __attribute__((nonnull))
-mk_rand_cid(struct cid * const id, const uint8_t len, const bool srt);
+mk_rand_cid(const struct w_engine * const w,
+            struct cid * const id,
+            const uint8_t len,
+            const bool srt);
 
 extern const char * __attribute__((nonnull(2)))
 cid2str(const struct cid * const id, char * const dst, const size_t len_dst);
@@ -49,6 +49,7 @@
 
 #include "conn.h"
 #include "diet.h"
+#include "fec.h"
 #include "frame.h"
 #include "loop.h"
 #include "marshall.h"
@@ -76,6 +77,9 @@ struct q_conn_sl c_zcid = sl_head_initializer(c_zcid);
 
 #ifndef NO_SERVER
 struct q_conn_sl c_embr = sl_head_initializer(c_embr);
+struct conns_by_act conns_by_act = splay_initializer(&conns_by_act);
+
+SPLAY_GENERATE(conns_by_act, q_conn, node_act, conns_by_act_cmp)
 #endif
 
 
@@ -97,6 +101,10 @@ static inline __attribute__((const)) bool is_vneg_vers(const uint32_t vers)
 khash_t(conns_by_id) conns_by_id = {0};
 #endif
 
+#if !defined(NO_MIGRATION) && !defined(NO_SERVER)
+khash_t(stubs_by_id) stubs_by_id = {0};
+#endif
+
 
 static bool __attribute__((const)) vers_supported(const uint32_t v)
 {
@@ -185,7 +193,8 @@ static inline epoch_t __attribute__((nonnull))
 epoch_in(const struct q_conn * const c)
 {
     if (unlikely(c->tls.t == 0))
-        return ep_init;
+        // imported conns have 1-RTT keys but no TLS session
+        return c->tls.cs ? ep_data : ep_init;
 
     const size_t epoch = ptls_get_read_epoch(c->tls.t);
     assure(epoch <= ep_data, "unhandled epoch %lu", (unsigned long)epoch);
@@ -215,6 +224,18 @@ get_conn_by_cid(struct cid * const scid)
 }
 
 
+#ifndef NO_SERVER
+static struct conn_stub * __attribute__((nonnull))
+get_stub_by_cid(struct cid * const scid)
+{
+    const khiter_t k = kh_get(stubs_by_id, &stubs_by_id, scid);
+    if (likely(k == kh_end(&stubs_by_id)))
+        return 0;
+    return kh_val(&stubs_by_id, k);
+}
+#endif
+
+
 void use_next_dcid(struct q_conn * const c, const bool also_retire)
 {
     struct cid * const dcid = next_cid(&c->dcids, c->dcid->seq);
@@ -370,6 +391,185 @@ static void __attribute__((nonnull)) tx_vneg_resp(struct w_sock * const ws,
 }
 
 
+#if !defined(NO_SERVER) && !defined(NO_SRT_MATCHING)
+static void __attribute__((nonnull)) tx_srt(struct w_sock * const ws,
+                                            const struct w_iov * const v,
+                                            const struct pkt_meta * const m,
+                                            const uint16_t rx_len)
+{
+    // an SRT must be smaller than the pkt triggering it, to prevent loops
+    if (rx_len <= MIN_SRT_PKT_LEN || m->hdr.dcid.len == 0)
+        return;
+
+    struct per_engine_data * const pd = ped(ws->w);
+    if (m->t - pd->srt_tx_t >= NS_PER_S) {
+        pd->srt_tx_t = m->t;
+        pd->srt_tx_cnt = 0;
+    }
+    if (unlikely(pd->srt_tx_cnt >= MAX_SRT_PER_SEC)) {
+        warn(DBG, "SRT rate limit reached, not sending");
+        return;
+    }
+
+    struct pkt_meta * mx;
+    struct w_iov * const xv = alloc_iov(ws->w, ws->ws_af, 0, 0, &mx);
+    if (unlikely(xv == 0)) {
+        warn(WRN, "could not alloc iov");
+        return;
+    }
+
+    struct w_iov_sq q = w_iov_sq_initializer(q);
+    sq_insert_head(&q, xv, next);
+
+    // make the SRT look like a regular short-header pkt of random length
+    const uint16_t max = (uint16_t)MIN(rx_len - 1, MAX_SRT_PKT_LEN);
+    const uint16_t len =
+        MIN_SRT_PKT_LEN +
+        (uint16_t)w_rand_uniform32((uint32_t)(max - MIN_SRT_PKT_LEN + 1));
+    rand_bytes(xv->buf, len - SRT_LEN);
+    xv->buf[0] = (uint8_t)((xv->buf[0] & ~LH) | SH);
+    mk_srt(ws->w, &m->hdr.dcid, &xv->buf[len - SRT_LEN]);
+
+    mx->txed = true;
+    mx->udp_len = xv->len = len;
+    xv->saddr = v->saddr;
+    xv->flags = v->flags;
+    warn(INF, BLU BLD "STATELESS RESET" NRM " len=%u token=%s for cid %s", len,
+         srt_str(&xv->buf[len - SRT_LEN]), cid_str(&m->hdr.dcid));
+    do_w_tx(ws, &q);
+    q_free(&q);
+    pd->srt_tx_cnt++;
+}
+#endif
+
+
+static timeout_t __attribute__((nonnull))
+closing_dur(const struct q_conn * const c)
+{
+    // 3 * RTO
+    return 3 * (c->rec.cur.srtt == 0 ? c->rec.initial_rtt : c->rec.cur.srtt) *
+               NS_PER_US +
+           4 * c->rec.cur.rttvar * NS_PER_US;
+}
+
+
+#if !defined(NO_MIGRATION) && !defined(NO_SERVER)
+static void __attribute__((nonnull)) free_conn_stub(struct conn_stub * const cs)
+{
+#ifdef DEBUG_TIMERS
+    warn(DBG, "closing stub for cid %s expired", cid_str(&cs->cids[0]));
+#endif
+    for (uint8_t i = 0; i < cs->cid_cnt; i++) {
+        // the CID may have been re-inserted for someone else in the meantime
+        const khiter_t k = kh_get(stubs_by_id, &stubs_by_id, &cs->cids[i]);
+        if (likely(k != kh_end(&stubs_by_id)) && kh_val(&stubs_by_id, k) == cs)
+            kh_del(stubs_by_id, &stubs_by_id, k);
+    }
+    timeout_del(&cs->alarm);
+    free(cs);
+}
+
+
+void free_conn_stubs(const struct w_sock * const ws)
+{
+    // free_conn_stub() only marks khash buckets deleted, so this is safe
+    struct conn_stub * cs;
+    kh_foreach_value(&stubs_by_id, cs, {
+        if (ws == 0 || cs->sock == ws)
+            free_conn_stub(cs);
+    });
+}
+
+
+void mk_conn_stub(struct q_conn * const c, const struct w_iov * const v)
+{
+    // collect the CIDs the peer may still use to reach us
+    struct cid * ids[CIDS_MAX + 2];
+    uint8_t n = 0;
+    struct cid * id;
+    sl_foreach (id, &c->scids.act, next)
+        if (id->in_cbi)
+            ids[n++] = id;
+    if (c->odcid.in_cbi)
+        ids[n++] = &c->odcid;
+    if (c->tp_mine.pref_addr.cid.in_cbi)
+        ids[n++] = &c->tp_mine.pref_addr.cid;
+    if (unlikely(n == 0))
+        return;
+
+    const uint16_t close_len = v ? v->len : 0;
+    const size_t len =
+        sizeof(struct conn_stub) + n * sizeof(struct cid) + close_len;
+    struct conn_stub * const cs = calloc(1, len);
+    ensure(cs, "could not calloc");
+
+    for (uint8_t i = 0; i < n; i++) {
+        conns_by_id_del(ids[i]);
+        cid_cpy(&cs->cids[i], ids[i]);
+        int ret;
+        const khiter_t k =
+            kh_put(stubs_by_id, &stubs_by_id, &cs->cids[i], &ret);
+        if (unlikely(ret == 0)) {
+            warn(ERR, "cannot ins cid %s", cid_str(&cs->cids[i]));
+            continue;
+        }
+        kh_val(&stubs_by_id, k) = cs;
+    }
+    cs->cid_cnt = n;
+    cs->sock = c->sock;
+    cs->peer = c->peer;
+    cs->close_len = close_len;
+    if (v) {
+        cs->close = (uint8_t *)&cs->cids[n];
+        memcpy(cs->close, v->buf, v->len);
+        cs->close_flags = v->flags;
+    }
+
+    timeout_setcb(&cs->alarm, free_conn_stub, cs);
+    timeouts_add(ped(c->w)->wheel, &cs->alarm, closing_dur(c));
+    c->has_stub = true;
+    warn(DBG, "%s conn %s handed %u cids to %zu-byte %s stub", conn_type(c),
+         cid_str(c->scid), n, len, v ? "closing" : "draining");
+
+    // a closing stub handles the closing period, so we can close right away;
+    // with a draining stub, enc_pkt() closes once our CONNECTION_CLOSE is out
+    if (v)
+        timeouts_add(ped(c->w)->wheel, &c->closing_alarm, 0);
+}
+
+
+static void __attribute__((nonnull)) rx_conn_stub(struct conn_stub * const cs)
+{
+    // RTX the cached CONNECTION_CLOSE, but only for every 2^n-th RX'ed pkt
+    cs->rx_cnt++;
+    if (cs->close_len == 0 || (cs->rx_cnt & (cs->rx_cnt - 1)))
+        // draining stubs never TX
+        return;
+
+    struct pkt_meta * mx;
+    struct w_iov * const xv =
+        alloc_iov(cs->sock->w, cs->sock->ws_af, 0, 0, &mx);
+    if (unlikely(xv == 0)) {
+        warn(WRN, "could not alloc iov");
+        return;
+    }
+
+    struct w_iov_sq q = w_iov_sq_initializer(q);
+    sq_insert_head(&q, xv, next);
+
+    memcpy(xv->buf, cs->close, cs->close_len);
+    mx->txed = true;
+    mx->udp_len = xv->len = cs->close_len;
+    xv->saddr = cs->peer;
+    xv->flags = cs->close_flags;
+    warn(INF, "closing stub for cid %s re-sending %u-byte CONNECTION_CLOSE",
+         cid_str(&cs->cids[0]), cs->close_len);
+    do_w_tx(cs->sock, &q);
+    q_free(&q);
+}
+#endif
+
+
 #ifndef NO_SERVER
 static bool __attribute__((nonnull, warn_unused_result))
 update_act_scid(struct q_conn * const c)
@@ -379,7 +579,7 @@ update_act_scid(struct q_conn * const c)
 #endif
     // server picks a new random cid
     mk_cid_str(INF, c->scid, scid_str_prev);
-    mk_rand_cid(c->scid, ped(c->w)->conf.server_cid_len, true);
+    mk_rand_cid(c->w, c->scid, ped(c->w)->conf.server_cid_len, true);
     mk_cid_str(INF, c->scid, scid_str_new);
     warn(INF, "hshk switch to scid %s for %s %s conn (was %s)", scid_str_new,
          conn_state_str[c->state], conn_type(c), scid_str_prev);
@@ -433,7 +633,7 @@ tx_rtry(struct q_conn * const c)
     mx->udp_len = xv->len = (uint16_t)(pos - xv->buf);
     xv->saddr = c->peer;
 #ifndef NO_ECN
-    xv->flags = likely(c->sockopt.enable_ecn) ? ECN_ECT0 : ECN_NOT;
+    xv->flags = tx_ecn(c);
 #endif
     log_pkt("TX", xv, c->tok, c->tok_len, rit);
     // qlog_transport(pkt_tx, "default", xv, mx);
@@ -447,6 +647,30 @@ done:
 #endif
 
 
+#ifndef NDEBUG
+uint8_t tx_loss_pct = 0;
+
+
+static void __attribute__((nonnull))
+emulate_tx_loss(struct q_conn * const c, struct w_iov_sq * const q)
+{
+    // only drop 1-RTT pkts, so that the handshake isn't affected
+    struct w_iov * v = sq_first(q);
+    while (v) {
+        struct w_iov * const nxt = sq_next(v, next);
+        if (is_lh(*v->buf) == false &&
+            w_rand_uniform32(100) < tx_loss_pct) {
+            warn(NTE, "emulating loss of %u-byte pkt on %s conn %s", v->len,
+                 conn_type(c), cid_str(c->scid));
+            sq_remove(q, v, w_iov, next);
+            w_free_iov(v);
+        }
+        v = nxt;
+    }
+}
+#endif
+
+
 static void __attribute__((nonnull)) do_tx_txq(struct q_conn * const c,
                                                struct w_iov_sq * const q,
                                                struct w_sock * const ws)
@@ -472,8 +696,17 @@ static void __attribute__((nonnull)) do_tx_txq(struct q_conn * const c,
              MIN_INI_LEN - v->len);
         pad_with_rand(v, MIN_INI_LEN);
     }
+
+#ifndef NDEBUG
+    if (unlikely(tx_loss_pct))
+        emulate_tx_loss(c, q);
+#endif
     do_w_tx(ws, q);
 
+    // we just refreshed any NAT binding on the path, push out the keepalive
+    if (c->keepalive && likely(c->state == conn_estb))
+        timeouts_add(ped(c->w)->wheel, &c->keepalive_alarm, c->keepalive);
+
     // txq was allocated from warpcore, no metadata to be freed
     w_free(q);
 }
@@ -562,6 +795,11 @@ static bool __attribute__((nonnull)) tx_stream(struct q_stream * const s)
 {
     struct q_conn * const c = s->c;
 
+    // generate more data once everything queued so far has been sent
+    if (unlikely(s->gen_left) &&
+        (s->out_last ? sq_next(s->out_last, next) : s->out_una) == 0)
+        gen_out(s, (uint32_t)(BURST_LEN * c->rec.max_ups));
+
     const bool has_data =
         (sq_empty(&s->out) == false && out_fully_acked(s) == false);
 
@@ -595,6 +833,7 @@ static bool __attribute__((nonnull)) tx_stream(struct q_stream * const s)
     struct w_iov * v = (likely(s->id >= 0) && s->out_last)
                            ? sq_next(s->out_last, next)
                            : s->out_una;
+again:
     sq_foreach_from (v, &s->out, next) {
         struct pkt_meta * const m = &meta(v);
         if (unlikely(has_wnd(c,
@@ -663,6 +902,13 @@ static bool __attribute__((nonnull)) tx_stream(struct q_stream * const s)
             break;
     }
 
+    if (unlikely(v == 0 && s->gen_left)) {
+        // we ran out of queued data before any limit, generate some more
+        v = gen_out(s, (BURST_LEN - encoded) * c->rec.max_ups);
+        if (v)
+            goto again;
+    }
+
     return (c->tx_limit == 0 || encoded < c->tx_limit) && c->no_wnd == false;
 }
 
@@ -724,13 +970,40 @@ void tx(struct q_conn * const c)
             }
 
         struct q_stream * s;
-        kh_foreach_value(&c->strms_by_id, s, {
-            if (tx_stream(s) == false)
-                break;
+        strm_tbl_foreach(&c->strms, s, {
+            if (unlikely(strm_reclaimable(s)))
+                free_stream(s);
+            else if (tx_stream(s) == false)
+                goto done;
         });
     }
 
 done:;
+    // send the DATAGRAMs that didn't fit after stream data in their own pkts
+    while (unlikely(sq_empty(&c->dgrams_out) == false) &&
+           likely(c->state == conn_estb)) {
+        const uint_t cnt = w_iov_sq_cnt(&c->dgrams_out);
+        if (has_wnd(c, sq_first(&c->dgrams_out)->len) == false) {
+            c->no_wnd = true;
+            break;
+        }
+        if (unlikely(tx_ack(c, ep_data, false) == false) ||
+            w_iov_sq_cnt(&c->dgrams_out) == cnt)
+            break;
+    }
+
+    if (unlikely(c->fec) && likely(c->state == conn_estb)) {
+        if (c->no_wnd == false && c->in_tx_pause == false)
+            // we're app-limited, so also protect the tail of what we sent
+            fec_flush(c->fec);
+        if (c->fec->rpr.cnt && has_wnd(c, rpr_frame_len(&c->fec->rpr))) {
+            // send the REPAIR that didn't fit after stream data in its own pkt
+            tx_ack(c, ep_data, false);
+            // if it didn't fit there either, don't hang on to it
+            c->fec->rpr.cnt = 0;
+        }
+    }
+
     // make sure we sent enough packets when we have a TX limit
     uint_t sent = w_iov_sq_cnt(&c->txq)
 #ifndef NO_MIGRATION
@@ -833,8 +1106,15 @@ rx_crypto(struct q_conn * const c, const struct pkt_meta * const m_cur)
 
         if (c->state == conn_idle || c->state == conn_opng) {
             conn_to_state(c, conn_estb);
-            if (is_clnt(c))
-                maybe_api_return(q_connect, c, 0);
+            if (c->tp_mine.fec && c->tp_peer.fec)
+                fec_init(c);
+            if (is_clnt(c)) {
+                if (api_func == (func_ptr)q_connect && api_conn == c)
+                    maybe_api_return(q_connect, c, 0);
+                else if (c->did_0rtt == false)
+                    // started by q_connect_start(), report via q_ready()
+                    conn_ready(c);
+            }
         }
     }
     if (!is_clnt(c) && c->tx_hshk_done && hshk_done(c) == false)
@@ -855,7 +1135,8 @@ new_initial_cids(struct q_conn * const c,
     // init dcid
     if (is_clnt(c)) {
         c->odcid.seq = 0;
-        mk_rand_cid(&c->odcid, CID_LEN_MAX + 1, false); // random len
+        // random len
+        mk_rand_cid(c->w, &c->odcid, CID_LEN_MAX + 1, false);
         c->dcid = cid_ins(&c->dcids, &c->odcid);
     } else if (dcid)
         // dcid->seq is 0 due to calloc allocation
@@ -864,11 +1145,11 @@ new_initial_cids(struct q_conn * const c,
     // init scid and add connection to global data structures
     struct cid id = {.seq = 0};
     if (is_clnt(c))
-        mk_rand_cid(&id, ped(c->w)->conf.client_cid_len, false);
+        mk_rand_cid(c->w, &id, ped(c->w)->conf.client_cid_len, false);
     else if (scid) {
         cid_cpy(&id, scid);
         cid_cpy(&c->odcid, scid);
-        mk_rand_cid(&id, 0, true);
+        mk_rand_cid(c->w, &id, 0, true);
     }
 #ifndef NO_MIGRATION
     if (id.len) {
@@ -896,7 +1177,7 @@ vneg_or_rtry_resp(struct q_conn * const c, const bool is_vneg)
             reset_stream(c->cstrms[e], true);
 
     struct q_stream * s;
-    kh_foreach_value(&c->strms_by_id, s, reset_stream(s, false));
+    strm_tbl_foreach(&c->strms, s, reset_stream(s, false));
 
     // reset packet number spaces
     for (pn_t t = pn_init; t <= pn_data; t++)
@@ -1219,6 +1500,9 @@ done:
         m->pn->pkts_rxed_since_last_ack_tx++;
 #ifndef NO_ECN
         m->pn->ecn_rxed[v->flags & ECN_MASK]++;
+        // feed CE marks back quickly, a scalable sender reacts per RTT
+        if (unlikely((v->flags & ECN_MASK) == ECN_CE))
+            m->pn->imm_ack = true;
 #endif
     }
 
@@ -1306,6 +1590,19 @@ static void __attribute__((nonnull))
 
 #ifndef NO_MIGRATION
         c = get_conn_by_cid(&m->hdr.dcid);
+#ifndef NO_SERVER
+        if (c == 0 && is_clnt == false) {
+            struct conn_stub * const cs = get_stub_by_cid(&m->hdr.dcid);
+            if (unlikely(cs)) {
+                log_pkt("RX", v, tok, tok_len, rit);
+                warn(INF, "%u-byte %s pkt for closing stub of cid %s", v->len,
+                     pkt_type_str(m->hdr.flags, &m->hdr.vers),
+                     cid_str(&m->hdr.dcid));
+                rx_conn_stub(cs);
+                goto drop;
+            }
+        }
+#endif
         if (c == 0 && m->hdr.dcid.len == 0)
 #endif
             c = (struct q_conn *)ws->data;
@@ -1341,6 +1638,13 @@ static void __attribute__((nonnull))
                         goto drop;
                     }
                 } else if (m->hdr.type == LH_INIT && c == 0) {
+                    if (unlikely(ped(w_engine(ws))->draining)) {
+                        log_pkt("RX", v, tok, tok_len, rit);
+                        warn(NTE, "draining, ignoring new conn %s",
+                             cid_str(&m->hdr.dcid));
+                        goto drop;
+                    }
+
                     if (vers_supported(m->hdr.vers) == false ||
                         is_vneg_vers(m->hdr.vers)) {
                         log_pkt("RX", v, tok, tok_len, rit);
@@ -1417,6 +1721,11 @@ static void __attribute__((nonnull))
             warn(INF, "cannot find conn %s for %u-byte %s pkt, ignoring",
                  cid_str(&m->hdr.dcid), v->len,
                  pkt_type_str(m->hdr.flags, &m->hdr.vers));
+#if !defined(NO_SERVER) && !defined(NO_SRT_MATCHING)
+            // tell the peer that we lost state for this conn
+            if (is_clnt == false && is_lh(m->hdr.flags) == false)
+                tx_srt(ws, v, m, xv->len);
+#endif
             goto drop;
         }
 
@@ -1642,6 +1951,91 @@ void restart_idle_alarm(struct q_conn * const c)
 }
 
 
+#ifndef NO_SERVER
+static void __attribute__((nonnull)) unmark_active(struct q_conn * const c)
+{
+    if (c->last_act_t) {
+        splay_remove(conns_by_act, &conns_by_act, c);
+        c->last_act_t = 0;
+    }
+}
+
+
+static void __attribute__((nonnull))
+mark_active(struct q_conn * const c, const uint64_t now)
+{
+    if (is_clnt(c) || c->state != conn_estb)
+        return;
+    unmark_active(c);
+    c->last_act_t = now;
+    splay_insert(conns_by_act, &conns_by_act, c);
+}
+
+
+bool conn_is_idle(const struct q_conn * const c)
+{
+    if (c->state != conn_estb || c->in_c_ready || c->rec.cur.in_flight ||
+        sq_empty(&c->txq) == false)
+        return false;
+
+    const struct q_stream * s;
+    strm_tbl_foreach(&c->strms, s, {
+        if (s->state != strm_clsd)
+            return false;
+    });
+    return true;
+}
+
+
+void noerr_close(struct q_conn * const c,
+                 const char * const reason
+#ifdef NO_ERR_REASONS
+                 __attribute__((unused))
+#endif
+)
+{
+    unmark_active(c);
+#ifndef NO_ERR_REASONS
+    strncpy(c->err_reason, reason, MAX_ERR_REASON_LEN);
+    c->err_reason[MAX_ERR_REASON_LEN - 1] = 0;
+    c->err_reason_len = (uint8_t)strnlen(reason, MAX_ERR_REASON_LEN);
+#endif
+    conn_to_state(c, conn_qlse);
+    timeouts_add(ped(c->w)->wheel, &c->tx_w, 0);
+}
+
+
+static void __attribute__((nonnull)) evict_idle_conns(struct w_engine * const w)
+{
+    const struct q_conf * const conf = &ped(w)->conf;
+    const uint_t cnt = splay_count(&conns_by_act);
+    uint_t n = 0;
+    if (conf->evict_max_conns && cnt > conf->evict_max_conns)
+        n = cnt - conf->evict_max_conns;
+    else if (conf->evict_free_bufs &&
+             w_iov_sq_cnt(&w->iov) * 100 <
+                 (uint_t)conf->num_bufs * conf->evict_free_bufs)
+        // under buffer pressure, evict one conn per RX batch
+        n = 1;
+
+    // walk conns from least- to most-recently active, skip non-idle ones
+    struct q_conn * c = splay_min(conns_by_act, &conns_by_act);
+    while (n && c) {
+        struct q_conn * const next =
+            splay_next(conns_by_act, &conns_by_act, c);
+        if (c->rec.cur.in_flight == 0 && c->in_c_ready == false) {
+            warn(NTE, "evicting idle %s conn %s (%" PRIu " active, %" PRIu
+                      " bufs free)",
+                 conn_type(c), cid_str(c->scid), cnt, w_iov_sq_cnt(&w->iov));
+            noerr_close(c, "evicted while idle");
+            n--;
+        }
+        c = next;
+    }
+}
+#endif
+
+
 static void __attribute__((nonnull)) restart_ack_alarm(struct q_conn * const c)
 {
     const timeout_t t = c->tp_mine.max_ack_del * NS_PER_MS;
@@ -1654,13 +2048,96 @@ static void __attribute__((nonnull)) restart_ack_alarm(struct q_conn * const c)
 }
 
 
-void rx(struct w_sock * const ws)
+void conn_ready(struct q_conn * const c)
+{
+    if (!c->in_c_ready) {
+        sl_insert_head(&c_ready, c, node_rx_ext);
+        c->in_c_ready = true;
+    }
+    maybe_api_return(q_ready, 0, 0);
+}
+
+
+/// Cheaply determine which (existing) connection an undecoded packet is for,
+/// without modifying it.
+///
+/// @param      ws    Socket the packet was received on.
+/// @param      xv    Received packet.
+///
+/// @return     Connection, or zero if unknown.
+///
+static struct q_conn * __attribute__((nonnull))
+rx_conn_of(const struct w_sock * const ws, const struct w_iov * const xv)
+{
+    if (ws->data)
+        // a client socket belongs to a single connection
+        return ws->data;
+
+#ifndef NO_MIGRATION
+    struct cid id = {.len = ws->opt.user_1 ? ped(ws->w)->conf.client_cid_len
+                                           : ped(ws->w)->conf.server_cid_len};
+    uint16_t pos = 1;
+    if (unlikely(xv->len == 0))
+        return 0;
+    if (is_lh(xv->buf[0])) {
+        if (unlikely(xv->len < 6))
+            return 0;
+        id.len = xv->buf[5];
+        pos = 6;
+    }
+    if (unlikely(id.len == 0 || id.len > CID_LEN_MAX || xv->len < pos + id.len))
+        return 0;
+    memcpy(id.id, &xv->buf[pos], id.len);
+    return get_conn_by_cid(&id);
+#else
+    (void)xv;
+    return 0;
+#endif
+}
+
+
+void rx(struct rx_backlog * const b)
 {
+    struct w_sock * const ws = b->ws;
     struct w_iov_sq x = w_iov_sq_initializer(x);
+    struct w_iov_sq defer = w_iov_sq_initializer(defer);
     struct q_conn_sl crx = sl_head_initializer(crx);
-    w_rx(ws, &x);
+
+    // take this round's share of the backlog, leaving packets of connections
+    // that have already had theirs for later rounds
+    const uint32_t round = ped(ws->w)->rx_round;
+    for (uint_t n = 0; n < RX_BUDGET_SOCK && !sq_empty(&b->q); n++) {
+        struct w_iov * const xv = sq_first(&b->q);
+        sq_remove_head(&b->q, next);
+        sq_next(xv, next) = 0;
+
+        struct q_conn * const c = rx_conn_of(ws, xv);
+        if (likely(c)) {
+            if (c->rx_round != round) {
+                c->rx_round = round;
+                c->rx_cnt = 0;
+            }
+            if (unlikely(c->rx_cnt++ >= RX_BUDGET_CONN)) {
+                sq_insert_tail(&defer, xv, next);
+                continue;
+            }
+        }
+        sq_insert_tail(&x, xv, next);
+    }
+    // deferred packets arrived before the rest, so they go first next round
+    sq_concat(&defer, &b->q);
+    sq_concat(&b->q, &defer);
+
     rx_pkts(&x, &crx, ws);
 
+#ifndef NO_SERVER
+    // only track activity on server sockets when an eviction policy is set
+    const bool evict = ws->opt.user_1 == false &&
+                       (ped(ws->w)->conf.evict_max_conns ||
+                        ped(ws->w)->conf.evict_free_bufs);
+    const uint64_t now = evict ? w_now(CLOCK_MONOTONIC_RAW) : 0;
+#endif
+
     // for all connections that had RX events
     while (!sl_empty(&crx)) {
         struct q_conn * const c = sl_first(&crx);
@@ -1674,6 +2151,10 @@ void rx(struct w_sock * const ws)
 
         // reset idle timeout
         restart_idle_alarm(c);
+#ifndef NO_SERVER
+        if (evict)
+            mark_active(c, now);
+#endif
 
         // is a TX needed for this connection?
         if (c->needs_tx)
@@ -1698,12 +2179,25 @@ void rx(struct w_sock * const ws)
             }
         }
 
-        if (c->have_new_data && !c->in_c_ready) {
-            sl_insert_head(&c_ready, c, node_rx_ext);
-            c->in_c_ready = true;
-            maybe_api_return(q_ready, 0, 0);
-        }
+        if (c->have_new_data && !c->in_c_ready)
+            conn_ready(c);
+
+#ifndef NO_SERVER
+        // when draining, close conns as soon as they have gone quiet
+        if (unlikely(ped(c->w)->draining) && !is_clnt(c) && conn_is_idle(c))
+            noerr_close(c, "server draining");
+#endif
+
+#ifndef NO_MIGRATION
+        // let a pending export re-check whether this conn has gone quiet
+        maybe_api_return(q_conn_export, c, 0);
+#endif
     }
+
+#ifndef NO_SERVER
+    if (evict)
+        evict_idle_conns(ws->w);
+#endif
 }
 
 
@@ -1781,6 +2275,7 @@ static void __attribute__((nonnull)) stop_all_alarms(struct q_conn * const c)
     timeout_del(&c->key_flip_alarm);
     timeout_del(&c->ack_alarm);
     timeout_del(&c->closing_alarm);
+    timeout_del(&c->keepalive_alarm);
 }
 
 
@@ -1793,20 +2288,18 @@ static void __attribute__((nonnull)) enter_closed(struct q_conn * const c)
     conn_to_state(c, conn_clsd);
     stop_all_alarms(c);
 
-    if (!c->in_c_ready) {
-        sl_insert_head(&c_ready, c, node_rx_ext);
-        c->in_c_ready = true;
-    }
-
     // terminate whatever API call is currently active
     maybe_api_return(c, 0);
-    maybe_api_return(q_ready, 0, 0);
+    conn_ready(c);
 }
 
 
 void enter_closing(struct q_conn * const c)
 {
     stop_all_alarms(c);
+#ifndef NO_SERVER
+    unmark_active(c);
+#endif
 
 #ifndef FUZZING
     if ((c->state == conn_idle || c->state == conn_opng) && c->err_code == 0) {
@@ -1817,11 +2310,8 @@ void enter_closing(struct q_conn * const c)
         return;
     }
 
-    // start closing/draining alarm (3 * RTO)
-    const timeout_t dur =
-        3 * (c->rec.cur.srtt == 0 ? c->rec.initial_rtt : c->rec.cur.srtt) *
-            NS_PER_US +
-        4 * c->rec.cur.rttvar * NS_PER_US;
+    // start closing/draining alarm
+    const timeout_t dur = closing_dur(c);
     timeouts_add(ped(c->w)->wheel, &c->closing_alarm, dur);
 #ifdef DEBUG_TIMERS
     warn(DBG, "closing/draining alarm in %.3f sec on %s conn %s",
@@ -1846,6 +2336,18 @@ static void __attribute__((nonnull)) idle_alarm(struct q_conn * const c)
 }
 
 
+static void __attribute__((nonnull)) keepalive_alarm(struct q_conn * const c)
+{
+#ifdef DEBUG_TIMERS
+    warn(DBG, "keepalive timer fired on %s conn %s", conn_type(c),
+         cid_str(c->scid));
+#endif
+    // nothing was sent for a keepalive interval, so elicit a minimal ACK
+    if (likely(c->state == conn_estb) && tx_ack(c, ep_data, true))
+        do_tx(c);
+}
+
+
 static void __attribute__((nonnull)) ack_alarm(struct q_conn * const c)
 {
 #ifdef DEBUG_TIMERS
@@ -1864,11 +2366,28 @@ void update_conf(struct q_conn * const c, const struct q_conn_conf * const conf)
     c->do_qr_test = get_conf_uncond(c->w, conf, enable_quantum_readiness_test);
     c->disable_pmtud = get_conf(c->w, conf, disable_pmtud);
     c->tp_mine.grease_quic_bit = get_conf(c->w, conf, enable_grease);
+    c->tp_mine.max_dgram_frm =
+        get_conf_uncond(c->w, conf, max_datagram_frame_size);
+    c->max_dgrams_in = get_conf(c->w, conf, datagram_rx_queue);
+    c->strm_win_max = (uint_t)(get_conf(c->w, conf, max_strm_mem) /
+                               STRM_MEM_COST);
+    c->tp_mine.fec = get_conf_uncond(c->w, conf, enable_fec);
+#ifndef NO_ECN
+    c->rec.l4s =
+        c->sockopt.enable_ecn && get_conf_uncond(c->w, conf, enable_l4s);
+#endif
 
     // (re)set idle alarm
     c->tp_mine.max_idle_to = get_conf(c->w, conf, idle_timeout) * MS_PER_S;
     restart_idle_alarm(c);
 
+    // (re)set keepalive alarm
+    c->keepalive = get_conf(c->w, conf, keepalive) * NS_PER_S;
+    if (c->keepalive)
+        timeouts_add(ped(c->w)->wheel, &c->keepalive_alarm, c->keepalive);
+    else
+        timeout_del(&c->keepalive_alarm);
+
     c->tp_mine.disable_active_migration =
 #ifndef NO_MIGRATION
         get_conf_uncond(c->w, conf, disable_active_migration);
@@ -1968,6 +2487,8 @@ struct q_conn * new_conn(struct w_engine * const w,
 #ifndef NO_MIGRATION
     sq_init(&c->migr_txq);
 #endif
+    sq_init(&c->dgrams_in);
+    sq_init(&c->dgrams_out);
 
     if (unlikely(new_initial_cids(c, dcid, scid) == false))
         goto fail;
@@ -1989,6 +2510,9 @@ struct q_conn * new_conn(struct w_engine * const w,
     // initialize ACK timeout
     timeout_setcb(&c->ack_alarm, ack_alarm, c);
 
+    // initialize keepalive alarm
+    timeout_setcb(&c->keepalive_alarm, keepalive_alarm, c);
+
     // initialize recovery state
     init_rec(c);
     if (is_clnt(c))
@@ -2007,9 +2531,10 @@ struct q_conn * new_conn(struct w_engine * const w,
     c->tp_mine.max_ups = w_max_udp_payload(c->sock);
     c->tp_mine.ack_del_exp = c->tp_peer.ack_del_exp = DEF_ACK_DEL_EXP;
     c->tp_mine.max_ack_del = c->tp_peer.max_ack_del = DEF_MAX_ACK_DEL;
-    c->tp_mine.max_strm_data_uni = is_clnt(c) ? INIT_STRM_DATA_UNI : 0;
-    c->tp_mine.max_strms_uni = is_clnt(c) ? INIT_MAX_UNI_STREAMS : 0;
-    c->tp_mine.max_strms_bidi = INIT_MAX_BIDI_STREAMS;
+    c->tp_mine.max_strm_data_uni = INIT_STRM_DATA_UNI;
+    c->tp_mine.max_strms_uni = c->strm_win_uni =
+        is_clnt(c) ? INIT_MAX_UNI_STREAMS : INIT_MAX_UNI_STREAMS_SRV;
+    c->tp_mine.max_strms_bidi = c->strm_win_bidi = INIT_MAX_BIDI_STREAMS;
     c->tp_mine.max_strm_data_bidi_local = c->tp_mine.max_strm_data_bidi_remote =
         is_clnt(c) ? INIT_STRM_DATA_BIDI : INIT_STRM_DATA_BIDI / 2;
     c->tp_mine.max_data =
@@ -2064,7 +2589,7 @@ struct q_conn * new_conn(struct w_engine * const w,
 #ifdef DEBUG_EXTRA
             warn(ERR, "max_cid_seq_out 1");
 #endif
-            mk_rand_cid(&c->tp_mine.pref_addr.cid,
+            mk_rand_cid(c->w, &c->tp_mine.pref_addr.cid,
                         ped(c->w)->conf.server_cid_len, true);
             if (unlikely(conns_by_id_ins(
                              c, cid_ins(&c->scids,
@@ -2106,10 +2631,13 @@ void free_conn(struct q_conn * const c)
     maybe_api_return(c, 0);
 
     stop_all_alarms(c);
+#ifndef NO_SERVER
+    unmark_active(c);
+#endif
 
     struct q_stream * s;
-    kh_foreach_value(&c->strms_by_id, s, { free_stream(s); });
-    kh_release(strms_by_id, &c->strms_by_id);
+    strm_tbl_foreach(&c->strms, s, { free_stream(s); });
+    strm_tbl_free(&c->strms);
 
     // free crypto streams
     for (epoch_t e = ep_init; e <= ep_data; e++)
@@ -2124,6 +2652,10 @@ void free_conn(struct q_conn * const c)
 
     timeout_del(&c->tx_w);
 
+    q_free(&c->dgrams_in);
+    q_free(&c->dgrams_out);
+    fec_free(c);
+
     diet_free(&c->clsd_strms);
 
     // remove connection from global lists and free CIDs
@@ -2142,7 +2674,8 @@ void free_conn(struct q_conn * const c)
 #endif
 #ifndef NO_MIGRATION
     sl_foreach (id, &c->scids.act, next)
-        conns_by_id_del(id);
+        if (id->in_cbi)
+            conns_by_id_del(id);
     if (c->tp_mine.pref_addr.cid.in_cbi)
         conns_by_id_del(&c->tp_mine.pref_addr.cid);
     if (c->odcid.in_cbi)
@@ -2150,9 +2683,13 @@ void free_conn(struct q_conn * const c)
     if (c->migr_sock && c->holds_migr_sock)
         w_close(c->migr_sock);
 #endif
-    if (c->holds_sock)
+    if (c->holds_sock) {
+#if !defined(NO_MIGRATION) && !defined(NO_SERVER)
+        free_conn_stubs(c->sock);
+#endif
         // only close the socket for the final server connection
         w_close(c->sock);
+    }
     if (c->in_c_ready)
         sl_remove(&c_ready, c, q_conn, node_rx_ext);
 
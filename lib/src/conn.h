@@ -43,18 +43,17 @@
 #include "pn.h"
 #include "quic.h"
 #include "recovery.h"
+#include "strm_tbl.h"
 #include "tls.h"
 
 #ifndef NO_OOO_0RTT
 #include "tree.h"
 #endif
 
+struct fec;
 struct q_stream;
 
 
-KHASH_MAP_INIT_INT64(strms_by_id, struct q_stream *)
-
-
 #ifndef NO_MIGRATION
 static inline khint_t __attribute__((nonnull, no_instrument_function))
 hash_cid(const struct cid * const id)
@@ -76,6 +75,34 @@ extern khash_t(conns_by_id) conns_by_id;
 #endif
 
 
+#if !defined(NO_MIGRATION) && !defined(NO_SERVER)
+/// Compact stand-in for a server connection during its closing or draining
+/// period. It only holds what is needed to answer the peer with a
+/// CONNECTION_CLOSE, and a draining stub doesn't even hold that.
+struct conn_stub {
+    struct timeout alarm;   ///< Frees the stub after the closing period.
+    struct w_sock * sock;   ///< Socket to TX on.
+    uint8_t * close;        ///< Cached CONNECTION_CLOSE pkt, zero if draining.
+    struct w_sockaddr peer; ///< Address of our peer.
+    uint32_t rx_cnt;        ///< Number of pkts received for this stub.
+    uint16_t close_len;     ///< Length of the cached datagram.
+    uint8_t close_flags;    ///< ECN flags for the cached datagram.
+    uint8_t cid_cnt;        ///< Number of CIDs in @p cids.
+    struct cid cids[];      ///< Our CIDs, followed by the cached datagram.
+};
+
+
+KHASH_INIT(stubs_by_id,
+           struct cid *,
+           struct conn_stub *,
+           1,
+           hash_cid,
+           kh_cid_cmp)
+
+extern khash_t(stubs_by_id) stubs_by_id;
+#endif
+
+
 #ifndef NO_SRT_MATCHING
 static inline khint_t __attribute__((nonnull, no_instrument_function))
 hash_srt(const uint8_t * const srt)
@@ -117,12 +144,14 @@ struct transport_params {
     uint_t max_ups;
     uint_t act_cid_lim;
     uint_t ack_del_exp;
+    uint_t max_dgram_frm; ///< max_datagram_frame_size (0 = no DATAGRAMs)
     bool disable_active_migration;
     bool grease_quic_bit;
+    bool fec; ///< quant-private FEC extension, see fec.h
 #if HAVE_64BIT
-    uint8_t _unused[6];
+    uint8_t _unused[5];
 #else
-    uint8_t _unused[2];
+    uint8_t _unused[1];
 #endif
 };
 
@@ -157,6 +186,7 @@ struct q_conn {
     sl_entry(q_conn) node_zcid_int; ///< Zero-CID client connections.
 #ifndef NO_SERVER
     sl_entry(q_conn) node_embr; ///< For bound but unconnected connections.
+    splay_entry(q_conn) node_act; ///< For evicting least-recently-active.
 #endif
     struct cids dcids; ///< Destination CIDs.
 #ifndef NO_MIGRATION
@@ -210,7 +240,7 @@ struct q_conn {
     uint32_t tx_new_tok : 1; ///< Send NEW_TOKEN.
     uint32_t in_tx_pause : 1;
     uint32_t disable_pmtud : 1; ///< Do not perform PMTUD.
-    uint32_t : 1;
+    uint32_t has_stub : 1;      ///< Our CIDs were handed to a closing stub.
 
     conn_state_t state; ///< State of the connection.
 
@@ -221,23 +251,31 @@ struct q_conn {
     uint32_t vers;         ///< QUIC version in use for this connection.
     uint32_t vers_initial; ///< QUIC version first negotiated.
 
+    uint32_t rx_round; ///< RX round in which @p rx_cnt was last reset.
+    uint32_t rx_cnt;   ///< Packets taken for processing during @p rx_round.
+
     struct pn_space pns[pn_data + 1];
 
     struct timeout idle_alarm;
     struct timeout closing_alarm;
     struct timeout key_flip_alarm;
     struct timeout ack_alarm;
+    struct timeout keepalive_alarm;
 
     struct w_sockaddr peer; ///< Address of our peer.
 
     struct q_stream * cstrms[ep_data + 1]; ///< Crypto "streams".
-    khash_t(strms_by_id) strms_by_id;      ///< Regular streams.
+    struct strm_tbl strms;                 ///< Regular streams.
     struct diet clsd_strms;
     sl_head(q_stream_head, q_stream) need_ctrl;
 
     struct w_sock * sock; ///< File descriptor (socket) for the connection.
 
     timeout_t tls_key_update_frequency;
+    timeout_t keepalive; ///< Keepalive PING interval in ns (0 = disabled).
+#ifndef NO_SERVER
+    uint64_t last_act_t; ///< Time of last activity (0 = not evictable).
+#endif
 
     struct transport_params tp_mine; ///< Local transport parameters.
     struct transport_params tp_peer; ///< Remote transport parameters.
@@ -251,12 +289,19 @@ struct q_conn {
     uint_t cnt_bidi; ///< Number of unidir stream IDs in use.
     uint_t cnt_uni;  ///< Number of bidi stream IDs in use.
 
+    uint_t strm_win_bidi; ///< Peer bidi streams we let be open concurrently.
+    uint_t strm_win_uni;  ///< Peer unidir streams we let be open concurrently.
+    uint_t strm_win_max;  ///< Ceiling for the sum of both windows.
+    uint_t clsd_bidi;     ///< Number of peer bidi streams freed.
+    uint_t clsd_uni;      ///< Number of peer unidir streams freed.
+
     uint_t in_data_str;  ///< Current inbound aggregate stream data.
     uint_t out_data_str; ///< Current outbound aggregate stream data.
 
     uint_t path_val_win; ///< Window for path validation.
 
     uint_t rpt_max; ///< Largest received "Retire Prior To" field
+    uint_t max_dgrams_in; ///< Max. number of queued inbound DATAGRAMs.
 
     epoch_t min_rx_epoch;
 
@@ -271,13 +316,12 @@ struct q_conn {
     struct w_sockopt sockopt; ///< Socket options.
     uint_t max_cid_seq_out;
 
-#if !HAVE_64BIT
-    uint8_t _unused[4];
-#endif
-
     struct cid odcid; ///< Client-chosen destination CID of first Initial.
 
     struct w_iov_sq txq;
+    struct w_iov_sq dgrams_in;  ///< Inbound DATAGRAM payloads for the app.
+    struct w_iov_sq dgrams_out; ///< Outbound DATAGRAM payloads awaiting TX.
+    struct fec * fec;           ///< FEC state, if negotiated.
 
 #ifndef NO_QINFO
     struct q_conn_info i;
@@ -309,6 +353,21 @@ struct q_conn {
 #ifndef NO_SERVER
 #define is_clnt(c) (c)->is_clnt
 extern struct q_conn_sl c_embr;
+
+
+extern splay_head(conns_by_act, q_conn) conns_by_act;
+
+
+static inline int __attribute__((nonnull, no_instrument_function))
+conns_by_act_cmp(const struct q_conn * const a, const struct q_conn * const b)
+{
+    if (a->last_act_t != b->last_act_t)
+        return a->last_act_t < b->last_act_t ? -1 : 1;
+    return (a > b) - (a < b);
+}
+
+
+SPLAY_PROTOTYPE(conns_by_act, q_conn, node_act, conns_by_act_cmp)
 #else
 #define is_clnt(c) 1
 #endif
@@ -360,6 +419,16 @@ err_close_noreason
 
 extern void __attribute__((nonnull)) enter_closing(struct q_conn * const c);
 
+extern void __attribute__((nonnull)) conn_ready(struct q_conn * const c);
+
+#ifndef NO_SERVER
+extern bool __attribute__((nonnull))
+conn_is_idle(const struct q_conn * const c);
+
+extern void __attribute__((nonnull))
+noerr_close(struct q_conn * const c, const char * const reason);
+#endif
+
 extern struct q_conn * new_conn(struct w_engine * const w,
                                 const uint16_t addr_idx,
                                 const struct cid * const dcid,
@@ -388,7 +457,16 @@ conns_by_srt_ins(struct q_conn * const c, uint8_t * const srt);
 extern void __attribute__((nonnull)) conns_by_srt_del(uint8_t * const srt);
 #endif
 
-extern void __attribute__((nonnull)) rx(struct w_sock * const ws);
+#define RX_BUDGET_SOCK 64 ///< Packets taken from a socket per RX round.
+#define RX_BUDGET_CONN 16 ///< Packets taken for a connection per RX round.
+
+/// Packets received on a socket that still need processing, see rx().
+struct rx_backlog {
+    struct w_sock * ws;
+    struct w_iov_sq q;
+};
+
+extern void __attribute__((nonnull)) rx(struct rx_backlog * const b);
 
 extern void __attribute__((nonnull))
 conn_info_populate(struct q_conn * const c);
@@ -412,6 +490,13 @@ conns_by_id_ins(struct q_conn * const c, struct cid * const id);
 extern void __attribute__((nonnull)) conns_by_id_del(struct cid * const id);
 #endif
 
+#if !defined(NO_MIGRATION) && !defined(NO_SERVER)
+extern void __attribute__((nonnull(1)))
+mk_conn_stub(struct q_conn * const c, const struct w_iov * const v);
+
+extern void free_conn_stubs(const struct w_sock * const ws);
+#endif
+
 
 #ifndef NO_OOO_0RTT
 struct ooo_0rtt {
@@ -478,3 +563,15 @@ has_wnd(const struct q_conn * const c, const uint16_t len)
 
     return is_clnt(c) ? true : has_pval_wnd(c, len);
 }
+
+
+#ifndef NO_ECN
+static inline uint8_t __attribute__((nonnull, no_instrument_function))
+tx_ecn(const struct q_conn * const c)
+{
+    // L4S flows mark ECT(1), classic ones ECT(0)
+    if (unlikely(c->sockopt.enable_ecn == false))
+        return ECN_NOT;
+    return c->rec.l4s ? ECN_ECT1 : ECN_ECT0;
+}
+#endif
@@ -0,0 +1,646 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <quant/quant.h>
+
+#ifndef NO_MIGRATION
+
+#include <picotls.h>
+#include <timeout.h>
+
+#include "cid.h"
+#include "conn.h"
+#include "diet.h"
+#include "fec.h"
+#include "loop.h"
+#include "marshall.h"
+#include "pn.h"
+#include "quic.h"
+#include "recovery.h"
+#include "stream.h"
+#include "tls.h"
+
+
+// Exported connection state is only meaningful to the exact same quant build.
+// The blob is therefore versioned and tagged with sizeof(struct q_conn), and
+// uses fixed-width fields throughout so its size can be computed up front.
+
+#define EXP_MAGIC 0x71786305 // "qx" + 0x63 + format version
+
+#define EXP_CID_LOCAL 0x01
+#define EXP_CID_SRT 0x02
+
+#define EXP_CONN_BLOCKED 0x01
+#define EXP_CONN_SID_BLOCKED_BIDI 0x02
+#define EXP_CONN_SID_BLOCKED_UNI 0x04
+
+#define EXP_STRM_RELEASED 0x80
+
+#define EXP_CID_LEN (8 + 1 + CID_LEN_MAX + 1 + SRT_LEN)
+#define EXP_CIDS_LEN (1 + 8 + CIDS_MAX * EXP_CID_LEN)
+#define EXP_TP_LEN (12 * 8 + 3)
+#define EXP_STRM_LEN (8 + 1 + 5 * 8)
+
+#ifndef NO_ECN
+#define EXP_ECN_LEN (2 * (ECN_MASK + 1) * 8)
+#else
+#define EXP_ECN_LEN 0
+#endif
+
+
+static size_t __attribute__((nonnull)) exp_len(struct q_conn * const c)
+{
+    struct pn_space * const pn = &c->pns[pn_data];
+    const size_t ivals = diet_cnt(&pn->recv) + diet_cnt(&pn->recv_all) +
+                         diet_cnt(&c->clsd_strms);
+    return 4 + 4 + 1 + 4 + 4 + sizeof(c->peer) + 2 + // header
+           2 * EXP_CIDS_LEN + 1 + CID_LEN_MAX +       // CIDs
+           13 * 8 + 1 + 2 * EXP_TP_LEN +              // conn, TPs
+           2 + 1 + 4 * PTLS_MAX_DIGEST_SIZE + 1 +     // keys
+           2 * 8 + EXP_ECN_LEN + 3 * 8 + 16 * ivals + // PN space, diets
+           6 * 8 + 2 + 3 * 8 +                        // recovery, crypto strm
+           8 + strm_tbl_cnt(&c->strms) * EXP_STRM_LEN;
+}
+
+
+static void __attribute__((nonnull))
+enc_cids(uint8_t ** pos,
+         const uint8_t * const end,
+         struct cids * const ids,
+         const struct cid * const act)
+{
+    enc1(pos, end, (uint8_t)ids->act_cnt);
+    enc8(pos, end, act ? act->seq : 0);
+    struct cid * id;
+    sl_foreach (id, &ids->act, next) {
+        enc8(pos, end, id->seq);
+        enc1(pos, end, id->len);
+        encb(pos, end, id->id, CID_LEN_MAX);
+#ifndef NO_SRT_MATCHING
+        enc1(pos, end,
+             (uint8_t)((id->local_choice ? EXP_CID_LOCAL : 0) |
+                       (id->has_srt ? EXP_CID_SRT : 0)));
+        encb(pos, end, id->srt, SRT_LEN);
+#else
+        enc1(pos, end, id->local_choice ? EXP_CID_LOCAL : 0);
+        encb(pos, end, (uint8_t[SRT_LEN]){0}, SRT_LEN);
+#endif
+    }
+}
+
+
+static bool __attribute__((nonnull))
+dec_cids(struct q_conn * const c,
+         const bool src,
+         const uint8_t ** const pos,
+         const uint8_t * const end)
+{
+    struct cids * const ids = src ? &c->scids : &c->dcids;
+    uint8_t cnt;
+    uint64_t act;
+    if (dec1(&cnt, pos, end) == false || cnt > CIDS_MAX ||
+        dec8(&act, pos, end) == false)
+        return false;
+
+    while (cnt--) {
+        struct cid id = {.seq = 0};
+        uint64_t seq;
+        uint8_t flags;
+        uint8_t srt[SRT_LEN];
+        if (dec8(&seq, pos, end) == false || dec1(&id.len, pos, end) == false ||
+            id.len > CID_LEN_MAX ||
+            decb(id.id, pos, end, CID_LEN_MAX) == false ||
+            dec1(&flags, pos, end) == false ||
+            decb(srt, pos, end, SRT_LEN) == false)
+            return false;
+        id.seq = (uint_t)seq;
+        id.local_choice = is_set(EXP_CID_LOCAL, flags);
+#ifndef NO_SRT_MATCHING
+        id.has_srt = is_set(EXP_CID_SRT, flags);
+        memcpy(id.srt, srt, SRT_LEN);
+#endif
+
+        struct cid * const i = cid_ins(ids, &id);
+        if (i == 0)
+            return false;
+        if (src) {
+            if (conns_by_id_ins(c, i) == false)
+                return false;
+        }
+#ifndef NO_SRT_MATCHING
+        else if (i->has_srt && conns_by_srt_ins(c, i->srt) == false)
+            return false;
+#endif
+        if (i->seq == act) {
+            if (src)
+                c->scid = i;
+            else
+                c->dcid = i;
+        }
+    }
+    return true;
+}
+
+
+static void __attribute__((nonnull))
+enc_diet(uint8_t ** pos, const uint8_t * const end, struct diet * const d)
+{
+    enc8(pos, end, diet_cnt(d));
+    struct ival * i;
+    diet_foreach (i, diet, d) {
+        enc8(pos, end, i->lo);
+        enc8(pos, end, i->hi);
+    }
+}
+
+
+static bool __attribute__((nonnull)) dec_diet(struct diet * const d,
+                                              const uint8_t ** const pos,
+                                              const uint8_t * const end,
+                                              const uint64_t t)
+{
+    uint64_t cnt;
+    if (dec8(&cnt, pos, end) == false)
+        return false;
+
+    while (cnt--) {
+        uint64_t lo;
+        uint64_t hi;
+        if (dec8(&lo, pos, end) == false || dec8(&hi, pos, end) == false ||
+            lo > hi ||
+            (diet_empty(d) == false && lo <= (uint64_t)diet_max(d) + 1))
+            return false;
+        // ivals arrive ascending and non-adjacent, so widen the new one
+        diet_insert(d, (uint_t)lo, t)->hi = (uint_t)hi;
+    }
+    return true;
+}
+
+
+static void __attribute__((nonnull))
+enc_tp(uint8_t ** pos,
+       const uint8_t * const end,
+       const struct transport_params * const tp)
+{
+    enc8(pos, end, tp->max_strm_data_uni);
+    enc8(pos, end, tp->max_strm_data_bidi_local);
+    enc8(pos, end, tp->max_strm_data_bidi_remote);
+    enc8(pos, end, tp->max_data);
+    enc8(pos, end, tp->max_strms_uni);
+    enc8(pos, end, tp->max_strms_bidi);
+    enc8(pos, end, tp->max_idle_to);
+    enc8(pos, end, tp->max_ack_del);
+    enc8(pos, end, tp->max_ups);
+    enc8(pos, end, tp->act_cid_lim);
+    enc8(pos, end, tp->ack_del_exp);
+    enc8(pos, end, tp->max_dgram_frm);
+    enc1(pos, end, tp->disable_active_migration);
+    enc1(pos, end, tp->grease_quic_bit);
+    enc1(pos, end, tp->fec);
+}
+
+
+#define dec8_to(dst, pos, end)                                                 \
+    __extension__({                                                            \
+        uint64_t _v;                                                           \
+        const bool _ok = dec8(&_v, (pos), (end));                              \
+        (dst) = (__typeof__(dst))_v;                                           \
+        _ok;                                                                   \
+    })
+
+
+static bool __attribute__((nonnull))
+dec_tp(struct transport_params * const tp,
+       const uint8_t ** const pos,
+       const uint8_t * const end)
+{
+    uint8_t dam;
+    uint8_t gqb;
+    uint8_t fec;
+    memset(tp, 0, sizeof(*tp));
+    if (dec8_to(tp->max_strm_data_uni, pos, end) == false ||
+        dec8_to(tp->max_strm_data_bidi_local, pos, end) == false ||
+        dec8_to(tp->max_strm_data_bidi_remote, pos, end) == false ||
+        dec8_to(tp->max_data, pos, end) == false ||
+        dec8_to(tp->max_strms_uni, pos, end) == false ||
+        dec8_to(tp->max_strms_bidi, pos, end) == false ||
+        dec8_to(tp->max_idle_to, pos, end) == false ||
+        dec8_to(tp->max_ack_del, pos, end) == false ||
+        dec8_to(tp->max_ups, pos, end) == false ||
+        dec8_to(tp->act_cid_lim, pos, end) == false ||
+        dec8_to(tp->ack_del_exp, pos, end) == false ||
+        dec8_to(tp->max_dgram_frm, pos, end) == false ||
+        dec1(&dam, pos, end) == false || dec1(&gqb, pos, end) == false ||
+        dec1(&fec, pos, end) == false)
+        return false;
+    tp->disable_active_migration = dam;
+    tp->grease_quic_bit = gqb;
+    tp->fec = fec;
+    return true;
+}
+
+
+static void __attribute__((nonnull))
+enc_strm(uint8_t ** pos, const uint8_t * const end, struct q_stream * const s)
+{
+    enc8(pos, end, (uint64_t)s->id);
+    enc1(pos, end,
+         (uint8_t)((uint8_t)s->state | (s->released ? EXP_STRM_RELEASED : 0)));
+    enc8(pos, end, s->out_data);
+    enc8(pos, end, s->out_data_max);
+    enc8(pos, end, s->in_data);
+    enc8(pos, end, s->in_data_off);
+    enc8(pos, end, s->in_data_max);
+}
+
+
+static bool __attribute__((nonnull))
+dec_strm(struct q_stream * const s,
+         const uint8_t ** const pos,
+         const uint8_t * const end)
+{
+    uint8_t state;
+    if (dec1(&state, pos, end) == false ||
+        (state & ~EXP_STRM_RELEASED) > strm_clsd ||
+        dec8_to(s->out_data, pos, end) == false ||
+        dec8_to(s->out_data_max, pos, end) == false ||
+        dec8_to(s->in_data, pos, end) == false ||
+        dec8_to(s->in_data_off, pos, end) == false ||
+        dec8_to(s->in_data_max, pos, end) == false)
+        return false;
+    s->state = (strm_state_t)(state & ~EXP_STRM_RELEASED);
+    s->released = (state & EXP_STRM_RELEASED) != 0;
+    return true;
+}
+
+
+static bool __attribute__((nonnull))
+strm_is_quiescent(const struct q_stream * const s)
+{
+    return out_fully_acked(s) && s->gen_left == 0 && sq_empty(&s->in)
+#ifndef NO_OOO_DATA
+           && splay_empty(&s->in_ooo)
+#endif
+        ;
+}
+
+
+static bool __attribute__((nonnull))
+conn_is_quiescent(const struct q_conn * const c)
+{
+    if (c->state != conn_estb || hshk_done(c) == false ||
+        c->rec.cur.in_flight || sq_empty(&c->txq) == false ||
+        c->pns[pn_data].data.in_kyph != c->pns[pn_data].data.out_kyph ||
+        c->migr_sock || c->needs_tx || c->tx_max_data || c->tx_max_sid_bidi ||
+        c->tx_max_sid_uni || c->tx_path_resp || c->tx_path_chlg ||
+        c->tx_retire_cid || c->tx_ncid || sl_empty(&c->need_ctrl) == false ||
+        strm_is_quiescent(c->cstrms[ep_data]) == false)
+        return false;
+
+    const struct q_stream * s;
+    strm_tbl_foreach(&c->strms, s, {
+        if (strm_is_quiescent(s) == false)
+            return false;
+    });
+    return true;
+}
+
+
+bool q_conn_export(struct q_conn * const c,
+                   uint8_t * const buf,
+                   size_t * const buf_len)
+{
+    // all sent data must have been ACKed, so wait until that is the case
+    while (c->state == conn_estb && conn_is_quiescent(c) == false) {
+        struct q_stream * s;
+        strm_tbl_foreach(&c->strms, s, {
+            if (unlikely(sq_empty(&s->in) == false)) {
+                warn(ERR, "%s conn %s strm " FMT_SID " has unread data",
+                     conn_type(c), cid_str(c->scid), s->id);
+                return false;
+            }
+        });
+        loop_run(c->w, (func_ptr)q_conn_export, c, 0);
+    }
+
+    if (c->state != conn_estb) {
+        warn(ERR, "%s conn %s is in state %s, can't export", conn_type(c),
+             cid_str(c->scid), conn_state_str[c->state]);
+        return false;
+    }
+
+    const size_t len = exp_len(c);
+    if (*buf_len < len) {
+        warn(ERR, "buf too short (need at least %lu)", (unsigned long)len);
+        *buf_len = len;
+        return false;
+    }
+
+    uint8_t * pos = buf;
+    const uint8_t * const end = buf + *buf_len;
+    enc4(&pos, end, EXP_MAGIC);
+    enc4(&pos, end, (uint32_t)sizeof(*c));
+    enc1(&pos, end, is_clnt(c));
+    enc4(&pos, end, c->vers);
+    enc4(&pos, end, c->vers_initial);
+    encb(&pos, end, (const uint8_t *)&c->peer, sizeof(c->peer));
+    enc2(&pos, end, c->sock->ws_lport);
+
+    enc_cids(&pos, end, &c->scids, c->scid);
+    enc_cids(&pos, end, &c->dcids, c->dcid);
+    enc1(&pos, end, c->odcid.len);
+    encb(&pos, end, c->odcid.id, CID_LEN_MAX);
+
+    // streams (before the conn-level state that creating them modifies)
+    const struct q_stream * const cs_data = c->cstrms[ep_data];
+    enc8(&pos, end, cs_data->out_data);
+    enc8(&pos, end, cs_data->in_data);
+    enc8(&pos, end, cs_data->in_data_off);
+    enc8(&pos, end, strm_tbl_cnt(&c->strms));
+    struct q_stream * s;
+    strm_tbl_foreach(&c->strms, s, enc_strm(&pos, end, s));
+
+    enc8(&pos, end, c->max_cid_seq_out);
+    enc8(&pos, end, c->rpt_max);
+    enc8(&pos, end, (uint64_t)c->next_sid_bidi);
+    enc8(&pos, end, (uint64_t)c->next_sid_uni);
+    enc8(&pos, end, c->cnt_bidi);
+    enc8(&pos, end, c->cnt_uni);
+    enc8(&pos, end, c->strm_win_bidi);
+    enc8(&pos, end, c->strm_win_uni);
+    enc8(&pos, end, c->strm_win_max);
+    enc8(&pos, end, c->clsd_bidi);
+    enc8(&pos, end, c->clsd_uni);
+    enc8(&pos, end, c->in_data_str);
+    enc8(&pos, end, c->out_data_str);
+    enc1(&pos, end,
+         (uint8_t)((c->blocked ? EXP_CONN_BLOCKED : 0) |
+                   (c->sid_blocked_bidi ? EXP_CONN_SID_BLOCKED_BIDI : 0) |
+                   (c->sid_blocked_uni ? EXP_CONN_SID_BLOCKED_UNI : 0)));
+    enc_tp(&pos, end, &c->tp_mine);
+    enc_tp(&pos, end, &c->tp_peer);
+
+    // 1-RTT keys
+    const ptls_cipher_suite_t * const cs = c->tls.cs;
+    const uint8_t dlen = (uint8_t)cs->hash->digest_size;
+    enc2(&pos, end, cs->id);
+    enc1(&pos, end, dlen);
+    encb(&pos, end, c->tls.secret[0], PTLS_MAX_DIGEST_SIZE);
+    encb(&pos, end, c->tls.secret[1], PTLS_MAX_DIGEST_SIZE);
+    encb(&pos, end, c->tls.hp_secret[0], PTLS_MAX_DIGEST_SIZE);
+    encb(&pos, end, c->tls.hp_secret[1], PTLS_MAX_DIGEST_SIZE);
+    struct pn_space * const pn = &c->pns[pn_data];
+    enc1(&pos, end, (uint8_t)(pn->data.in_kyph | pn->data.out_kyph << 1));
+
+    // packet number space
+    enc8(&pos, end, pn->lg_sent);
+    enc8(&pos, end, pn->lg_acked);
+#ifndef NO_ECN
+    for (size_t e = 0; e <= ECN_MASK; e++) {
+        enc8(&pos, end, pn->ecn_ref[e]);
+        enc8(&pos, end, pn->ecn_rxed[e]);
+    }
+#endif
+    enc_diet(&pos, end, &pn->recv);
+    enc_diet(&pos, end, &pn->recv_all);
+    enc_diet(&pos, end, &c->clsd_strms);
+
+    // recovery
+    enc8(&pos, end, c->rec.cur.latest_rtt);
+    enc8(&pos, end, c->rec.cur.min_rtt);
+    enc8(&pos, end, c->rec.cur.rttvar);
+    enc8(&pos, end, c->rec.cur.srtt);
+    enc8(&pos, end, c->rec.cur.cwnd);
+    enc8(&pos, end, c->rec.cur.ssthresh);
+    enc2(&pos, end, c->rec.max_ups);
+
+    *buf_len = (size_t)(pos - buf);
+    warn(NTE, "exported %s conn %s (%lu bytes)", conn_type(c),
+         cid_str(c->scid), (unsigned long)*buf_len);
+
+    // the conn lives on elsewhere, so free it without telling the peer
+    free_conn(c);
+    return true;
+}
+
+
+static void __attribute__((nonnull)) drop_initial_cids(struct q_conn * const c)
+{
+    struct cid * id;
+    sl_foreach (id, &c->scids.act, next)
+        if (id->in_cbi)
+            conns_by_id_del(id);
+    if (c->tp_mine.pref_addr.cid.in_cbi)
+        conns_by_id_del(&c->tp_mine.pref_addr.cid);
+    memset(&c->tp_mine.pref_addr, 0, sizeof(c->tp_mine.pref_addr));
+    if (c->in_c_zcid) {
+        sl_remove(&c_zcid, c, q_conn, node_zcid_int);
+        c->in_c_zcid = false;
+    }
+    init_cids(&c->scids);
+    init_cids(&c->dcids);
+    c->scid = c->dcid = 0;
+}
+
+
+struct q_conn * q_conn_import(struct w_engine * const w,
+                              const uint8_t * const buf,
+                              const size_t buf_len)
+{
+    const uint8_t * pos = buf;
+    const uint8_t * const end = buf + buf_len;
+    uint32_t magic;
+    uint32_t conn_len;
+    uint8_t clnt;
+    uint32_t vers;
+    uint32_t vers_initial;
+    struct w_sockaddr peer;
+    uint16_t lport;
+    if (dec4(&magic, &pos, end) == false || magic != EXP_MAGIC ||
+        dec4(&conn_len, &pos, end) == false ||
+        conn_len != sizeof(struct q_conn) || dec1(&clnt, &pos, end) == false ||
+        dec4(&vers, &pos, end) == false ||
+        dec4(&vers_initial, &pos, end) == false ||
+        decb((uint8_t *)&peer, &pos, end, sizeof(peer)) == false ||
+        dec2(&lport, &pos, end) == false) {
+        warn(ERR, "not a conn exported by this build of %s", quant_name);
+        return 0;
+    }
+
+    struct w_sock * sock = 0;
+#ifndef NO_SERVER
+    if (clnt == false) {
+        // server conns share the socket of the q_bind() conn on their port
+        struct q_conn * e;
+        sl_foreach (e, &c_embr, node_embr)
+            if (e->sock->ws_lport == lport && e->sock->ws_af == peer.addr.af)
+                break;
+        if (e == 0) {
+            warn(ERR, "no server socket bound to port %u", bswap16(lport));
+            return 0;
+        }
+        sock = e->sock;
+    }
+#endif
+
+    // new_conn() needs some CIDs to create the conn, they are replaced below
+    struct cid tmp = {.seq = 0};
+    mk_rand_cid(w, &tmp, CID_LEN_MIN_INI_DCID, false);
+    struct q_conn * const c = new_conn(w, UINT16_MAX, &tmp, &tmp, &peer,
+                                       clnt ? "" : 0, lport, sock, 0);
+    if (c == 0)
+        return 0;
+    drop_initial_cids(c);
+    c->vers = vers;
+    c->vers_initial = vers_initial;
+
+    // the handshake is long over
+    abandon_pn(&c->pns[pn_init]);
+    abandon_pn(&c->pns[pn_hshk]);
+
+    uint64_t strm_cnt;
+    struct q_stream * const cs_data = c->cstrms[ep_data];
+    if (dec_cids(c, true, &pos, end) == false ||
+        dec_cids(c, false, &pos, end) == false || c->dcid == 0 ||
+        dec1(&c->odcid.len, &pos, end) == false ||
+        c->odcid.len > CID_LEN_MAX ||
+        decb(c->odcid.id, &pos, end, CID_LEN_MAX) == false ||
+        dec8_to(cs_data->out_data, &pos, end) == false ||
+        dec8_to(cs_data->in_data, &pos, end) == false ||
+        dec8_to(cs_data->in_data_off, &pos, end) == false ||
+        dec8(&strm_cnt, &pos, end) == false)
+        goto fail;
+
+    while (strm_cnt--) {
+        uint64_t id;
+        if (dec8(&id, &pos, end) == false || (dint_t)id < 0 ||
+            get_stream(c, (dint_t)id) ||
+            dec_strm(new_stream(c, (dint_t)id), &pos, end) == false)
+            goto fail;
+    }
+
+    // this overwrites what new_stream() did to the stream ID and FC state
+    uint8_t flags;
+    uint16_t cs_id;
+    uint8_t dlen;
+    uint8_t kyph;
+    if (dec8_to(c->max_cid_seq_out, &pos, end) == false ||
+        dec8_to(c->rpt_max, &pos, end) == false ||
+        dec8_to(c->next_sid_bidi, &pos, end) == false ||
+        dec8_to(c->next_sid_uni, &pos, end) == false ||
+        dec8_to(c->cnt_bidi, &pos, end) == false ||
+        dec8_to(c->cnt_uni, &pos, end) == false ||
+        dec8_to(c->strm_win_bidi, &pos, end) == false ||
+        dec8_to(c->strm_win_uni, &pos, end) == false ||
+        dec8_to(c->strm_win_max, &pos, end) == false ||
+        dec8_to(c->clsd_bidi, &pos, end) == false ||
+        dec8_to(c->clsd_uni, &pos, end) == false ||
+        dec8_to(c->in_data_str, &pos, end) == false ||
+        dec8_to(c->out_data_str, &pos, end) == false ||
+        dec1(&flags, &pos, end) == false ||
+        dec_tp(&c->tp_mine, &pos, end) == false ||
+        dec_tp(&c->tp_peer, &pos, end) == false ||
+        dec2(&cs_id, &pos, end) == false || dec1(&dlen, &pos, end) == false ||
+        dlen > PTLS_MAX_DIGEST_SIZE ||
+        decb(c->tls.secret[0], &pos, end, PTLS_MAX_DIGEST_SIZE) == false ||
+        decb(c->tls.secret[1], &pos, end, PTLS_MAX_DIGEST_SIZE) == false ||
+        decb(c->tls.hp_secret[0], &pos, end, PTLS_MAX_DIGEST_SIZE) == false ||
+        decb(c->tls.hp_secret[1], &pos, end, PTLS_MAX_DIGEST_SIZE) == false ||
+        dec1(&kyph, &pos, end) == false)
+        goto fail;
+
+    if (c->scid == 0) {
+        // zero-length CIDs: this conn is found by its socket
+        sl_insert_head(&c_zcid, c, node_zcid_int);
+        c->in_c_zcid = true;
+        if (c->holds_sock)
+            c->sock->data = c;
+    }
+    c->blocked = is_set(EXP_CONN_BLOCKED, flags);
+    c->sid_blocked_bidi = is_set(EXP_CONN_SID_BLOCKED_BIDI, flags);
+    c->sid_blocked_uni = is_set(EXP_CONN_SID_BLOCKED_UNI, flags);
+
+    struct pn_space * const pn = &c->pns[pn_data];
+    pn->data.in_kyph = is_set(0x01, kyph);
+    pn->data.out_kyph = is_set(0x02, kyph);
+    if (import_keys(c, cs_id) == false ||
+        dec8_to(pn->lg_sent, &pos, end) == false ||
+        dec8_to(pn->lg_acked, &pos, end) == false)
+        goto fail;
+#ifndef NO_ECN
+    for (size_t e = 0; e <= ECN_MASK; e++)
+        if (dec8_to(pn->ecn_ref[e], &pos, end) == false ||
+            dec8_to(pn->ecn_rxed[e], &pos, end) == false)
+            goto fail;
+#endif
+    const uint64_t now = w_now(CLOCK_MONOTONIC_RAW);
+    if (dec_diet(&pn->recv, &pos, end, now) == false ||
+        dec_diet(&pn->recv_all, &pos, end, 0) == false ||
+        dec_diet(&c->clsd_strms, &pos, end, 0) == false)
+        goto fail;
+    if (pn->lg_sent != UINT_T_MAX)
+        // everything we sent was ACKed or lost, peer ACKs may still cover it
+        diet_insert(&pn->acked_or_lost, 0, 0)->hi = pn->lg_sent;
+
+    if (dec8_to(c->rec.cur.latest_rtt, &pos, end) == false ||
+        dec8_to(c->rec.cur.min_rtt, &pos, end) == false ||
+        dec8_to(c->rec.cur.rttvar, &pos, end) == false ||
+        dec8_to(c->rec.cur.srtt, &pos, end) == false ||
+        dec8_to(c->rec.cur.cwnd, &pos, end) == false ||
+        dec8_to(c->rec.cur.ssthresh, &pos, end) == false ||
+        dec2(&c->rec.max_ups, &pos, end) == false)
+        goto fail;
+    c->rec.max_ups_af = c->sock->ws_af;
+    // the imported RTT estimate counts as our first sample
+    c->rec.first_rtt_t = now;
+    c->tx_max_sid_bidi = c->tx_max_sid_uni = false;
+
+    // the peer address was validated by the exporting side
+    c->path_val_win = UINT_T_MAX;
+    c->tx_new_tok = c->tx_hshk_done = c->do_migration = false;
+    c->min_rx_epoch = ep_data;
+    conn_to_state(c, conn_estb);
+    if (c->tp_mine.fec && c->tp_peer.fec)
+        // any FEC block in progress at export time is lost, start over
+        fec_init(c);
+    restart_idle_alarm(c);
+
+    warn(NTE, "imported %s conn %s", conn_type(c), cid_str(c->scid));
+    return c;
+
+fail:
+    warn(ERR, "malformed conn export");
+    free_conn(c);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <quant/quant.h>
+
+#include "conn.h"
+#include "fec.h"
+#include "quic.h"
+
+
+// A single-parity XOR code over the STREAM frames of consecutive 1-RTT
+// packets. Each block of up to k source symbols (one per packet) is protected
+// by one REPAIR frame, which lets the receiver rebuild any one lost STREAM
+// frame of the block. The sender picks k based on the loss rate it observes.
+
+
+static inline void __attribute__((nonnull))
+xor_data(uint8_t * const dst, const uint8_t * const src, const uint16_t len)
+{
+    for (uint16_t i = 0; i < len; i++)
+        dst[i] ^= src[i];
+}
+
+
+static inline void __attribute__((nonnull))
+xor_sym(struct fec_blk * const b,
+        const uint_t sid,
+        const uint_t off,
+        const uint16_t len,
+        const bool fin,
+        const uint8_t * const data)
+{
+    b->sid ^= sid;
+    b->off ^= off;
+    b->lf ^= (uint32_t)len | (uint32_t)fin << 16;
+    xor_data(b->data, data, len);
+}
+
+
+static void __attribute__((nonnull)) close_blk(struct fec * const f)
+{
+    if (unlikely(f->rpr.cnt))
+        warn(DBG, "REPAIR for FEC blk at %" PRIu " not sent, replacing",
+             f->rpr.lo);
+
+    // bytes past len are still zero in the accumulator, no need to copy them
+    const size_t len = offsetof(struct fec_blk, data) + f->tx.len;
+    memcpy(&f->rpr, &f->tx, len);
+    memset(&f->tx, 0, len);
+
+    if (f->sent < FEC_ADAPT)
+        return;
+
+    // one REPAIR recovers one loss per block, so aim for half a loss per block
+    uint_t k = f->lost ? f->sent / (2 * f->lost) : FEC_K_MAX;
+    k = k < FEC_K_MIN ? FEC_K_MIN : k;
+    f->k = (uint8_t)(k > FEC_K_MAX ? FEC_K_MAX : k);
+    warn(DBG, "FEC: %" PRIu "/%" PRIu " syms lost, k=%u", f->lost, f->sent,
+         f->k);
+    f->sent = f->lost = 0;
+}
+
+
+void fec_init(struct q_conn * const c)
+{
+    if (c->fec)
+        return;
+
+    c->fec = calloc(1, sizeof(*c->fec));
+    if (unlikely(c->fec == 0)) {
+        warn(ERR, "could not alloc FEC state, continuing without");
+        return;
+    }
+    c->fec->k = FEC_K_MAX;
+    for (uint8_t i = 0; i < FEC_RX_SYMS; i++)
+        c->fec->sym[i].nr = UINT_T_MAX;
+    warn(INF, "FEC enabled on %s conn %s", conn_type(c), cid_str(c->scid));
+}
+
+
+void fec_free(struct q_conn * const c)
+{
+    free(c->fec);
+    c->fec = 0;
+}
+
+
+void fec_tx_sym(struct fec * const f,
+                const uint_t nr,
+                const uint_t sid,
+                const uint_t off,
+                const uint16_t len,
+                const bool fin,
+                const uint8_t * const data)
+{
+    if (unlikely(len > FEC_SYM_MAX))
+        return;
+
+    struct fec_blk * const b = &f->tx;
+    if (b->cnt && nr - b->lo >= FEC_RX_SYMS)
+        // the receiver can't hold on to a block spanning more pkts
+        close_blk(f);
+
+    if (b->cnt == 0)
+        b->lo = nr;
+    b->mask |= UINT32_C(1) << (nr - b->lo);
+    xor_sym(b, sid, off, len, fin, data);
+    if (len > b->len)
+        b->len = len;
+    f->sent++;
+
+    if (++b->cnt >= f->k)
+        close_blk(f);
+}
+
+
+void fec_flush(struct fec * const f)
+{
+    if (f->tx.cnt)
+        close_blk(f);
+}
+
+
+void fec_rx_sym(struct fec * const f,
+                const uint_t nr,
+                const uint_t sid,
+                const uint_t off,
+                const uint16_t len,
+                const bool fin,
+                const uint8_t * const data)
+{
+    struct fec_sym * const s = &f->sym[nr % FEC_RX_SYMS];
+    if (unlikely(s->nr == nr)) {
+        // the sender XORs one STREAM frame per pkt, we can't tell which
+        warn(NTE, "FEC: multiple STREAM frames in pkt %" PRIu, nr);
+        s->bad = true;
+        return;
+    }
+    s->nr = nr;
+    s->bad = len > FEC_SYM_MAX;
+    if (unlikely(s->bad))
+        return;
+    s->sid = sid;
+    s->off = off;
+    s->len = len;
+    s->fin = fin;
+    memcpy(s->data, data, len);
+}
+
+
+bool fec_recover(struct fec * const f)
+{
+    struct fec_blk * const b = &f->rx;
+
+    // we can only reconstruct a block with exactly one missing symbol
+    uint_t miss = UINT_T_MAX;
+    for (uint8_t i = 0; i < FEC_RX_SYMS; i++) {
+        const uint_t nr = b->lo + i;
+        const struct fec_sym * const s = &f->sym[nr % FEC_RX_SYMS];
+        if ((b->mask & (UINT32_C(1) << i)) == 0)
+            continue;
+        if (s->nr == nr) {
+            if (unlikely(s->bad))
+                return false;
+            continue;
+        }
+        if (miss != UINT_T_MAX)
+            return false;
+        miss = nr;
+    }
+    if (miss == UINT_T_MAX)
+        return false;
+
+    for (uint8_t i = 0; i < FEC_RX_SYMS; i++) {
+        const uint_t nr = b->lo + i;
+        const struct fec_sym * const s = &f->sym[nr % FEC_RX_SYMS];
+        if ((b->mask & (UINT32_C(1) << i)) && s->nr == nr)
+            xor_sym(b, s->sid, s->off, s->len, s->fin, s->data);
+    }
+
+    if (unlikely((b->lf & UINT16_MAX) > b->len)) {
+        warn(ERR, "FEC: recovered len %u > REPAIR len %u",
+             b->lf & UINT16_MAX, b->len);
+        return false;
+    }
+    // tell the caller which pkt the reconstructed STREAM frame was lost in
+    b->lo = miss;
+    return true;
+}
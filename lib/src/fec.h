@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <quant/quant.h>
+
+#include "marshall.h"
+
+struct q_conn;
+
+
+#define FEC_SYM_MAX 1408 ///< Largest STREAM frame payload protected by FEC.
+#define FEC_RX_SYMS 32   ///< RX window (and max. block span) in packets.
+#define FEC_K_MIN 2      ///< Smallest number of source symbols per block.
+#define FEC_K_MAX 16     ///< Largest number of source symbols per block.
+#define FEC_ADAPT 64     ///< Source symbols between block size adaptations.
+
+
+/// The XOR over the STREAM frames in a block of 1-RTT packets. Used for the
+/// block being accumulated and the closed block awaiting TX on the sender, and
+/// for a REPAIR frame being decoded on the receiver.
+struct fec_blk {
+    uint_t lo;     ///< Packet number of the first source symbol.
+    uint_t sid;    ///< XOR of the stream IDs.
+    uint_t off;    ///< XOR of the stream offsets.
+    uint32_t mask; ///< Source symbols in the block, relative to @p lo.
+    uint32_t lf;   ///< XOR of the (length | FIN << 16) values.
+    uint16_t len;  ///< Length of the longest source symbol.
+    uint8_t cnt;   ///< Number of source symbols in the block.
+    uint8_t data[FEC_SYM_MAX]; ///< XOR of the stream data.
+#if HAVE_64BIT
+    uint8_t _unused[5];
+#else
+    uint8_t _unused[1];
+#endif
+};
+
+
+/// A STREAM frame received in a 1-RTT packet, kept for reconstruction.
+struct fec_sym {
+    uint_t nr;  ///< Packet number the frame arrived in.
+    uint_t sid; ///< Stream ID.
+    uint_t off; ///< Stream offset.
+    uint16_t len;
+    uint8_t fin;
+    uint8_t bad; ///< The pkt had more than one STREAM frame, don't use.
+    uint8_t data[FEC_SYM_MAX];
+#if HAVE_64BIT
+    uint8_t _unused[4];
+#endif
+};
+
+
+struct fec {
+    struct fec_blk tx;               ///< Block currently being accumulated.
+    struct fec_blk rpr;              ///< Closed block, REPAIR not yet sent.
+    struct fec_blk rx;               ///< REPAIR frame being decoded.
+    struct fec_sym sym[FEC_RX_SYMS]; ///< Recent symbols, indexed by nr.
+    uint_t sent;                     ///< Source symbols TX'ed since adapting.
+    uint_t lost;                     ///< Source symbols lost since adapting.
+    uint8_t k;                       ///< Source symbols per block.
+#if HAVE_64BIT
+    uint8_t _unused[7];
+#else
+    uint8_t _unused[3];
+#endif
+};
+
+
+extern void __attribute__((nonnull)) fec_init(struct q_conn * const c);
+
+extern void __attribute__((nonnull)) fec_free(struct q_conn * const c);
+
+extern void __attribute__((nonnull)) fec_tx_sym(struct fec * const f,
+                                                const uint_t nr,
+                                                const uint_t sid,
+                                                const uint_t off,
+                                                const uint16_t len,
+                                                const bool fin,
+                                                const uint8_t * const data);
+
+extern void __attribute__((nonnull)) fec_flush(struct fec * const f);
+
+extern void __attribute__((nonnull)) fec_rx_sym(struct fec * const f,
+                                                const uint_t nr,
+                                                const uint_t sid,
+                                                const uint_t off,
+                                                const uint16_t len,
+                                                const bool fin,
+                                                const uint8_t * const data);
+
+extern bool __attribute__((nonnull)) fec_recover(struct fec * const f);
+
+
+/// Length of the REPAIR frame for block @p b.
+///
+/// @param      b     A closed FEC block.
+///
+/// @return     Encoded length of the REPAIR frame.
+///
+static inline uint16_t __attribute__((nonnull))
+rpr_frame_len(const struct fec_blk * const b)
+{
+    return (uint16_t)(sizeof(uint8_t) + varint_size(b->lo) +
+                      varint_size(b->mask) + varint_size(b->sid) +
+                      varint_size(b->off) + varint_size(b->lf) +
+                      varint_size(b->len) + b->len);
+}
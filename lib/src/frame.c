@@ -46,6 +46,7 @@
 #include "cid.h"
 #include "conn.h"
 #include "diet.h"
+#include "fec.h"
 #include "frame.h"
 #include "loop.h"
 #include "marshall.h"
@@ -199,7 +200,7 @@ get_and_validate_strm(struct q_conn * const c,
     else {
         struct q_stream * s = get_stream(c, sid);
         if (unlikely(s == 0)) {
-            if (unlikely(diet_find(&c->clsd_strms, (uint_t)sid)))
+            if (unlikely(diet_find(&c->clsd_strms, strm_clsd_key(sid))))
                 warn(NTE,
                      "ignoring 0x%02x frame for closed strm " FMT_SID
                      " on %s conn %s",
@@ -283,6 +284,12 @@ dec_stream_or_crypto_frame(const uint8_t type,
         // stream data extends to end of packet
         l = (uint16_t)(end - *pos);
 
+    if (unlikely(c->fec) && type != FRM_CRY && m->hdr.type == SH &&
+        m->hdr.nr != UINT_T_MAX)
+        // keep a copy of the stream data, in case a REPAIR needs it
+        fec_rx_sym(c->fec, m->hdr.nr, (uint_t)sid, m->strm_off, (uint16_t)l,
+                   m->is_fin, *pos);
+
     const dint_t max = max_sid(sid, c);
     if (unlikely(sid > max)) {
         log_stream_or_crypto_frame(false, m, type, sid, true, 0);
@@ -309,7 +316,7 @@ dec_stream_or_crypto_frame(const uint8_t type,
     }
 
     if (unlikely(m->strm == 0)) {
-        if (unlikely(diet_find(&c->clsd_strms, (uint_t)sid))) {
+        if (unlikely(diet_find(&c->clsd_strms, strm_clsd_key(sid)))) {
 #ifdef DEBUG_STREAMS
             warn(NTE,
                  "ignoring STREAM frame for closed strm " FMT_SID
@@ -516,6 +523,7 @@ shorten_ack_nr(const uint_t ack, const uint_t diff)
 static void __attribute__((nonnull)) disable_ecn(struct q_conn * const c)
 {
     c->sockopt.enable_ecn = false;
+    c->rec.l4s = false;
     w_set_sockopt(c->sock, &c->sockopt);
 }
 
@@ -583,7 +591,7 @@ static bool __attribute__((nonnull)) dec_ack_frame(const uint8_t type,
     bool got_new_ack = false;
 #ifndef NO_ECN
     uint64_t lg_ack_in_frm_t = 0;
-    uint_t new_acked_ect0 = 0;
+    uint_t new_acked_ect[ECN_MASK + 1] = {0};
 #endif
     for (uint_t n = ack_rng_cnt + 1; n > 0; n--) {
         uint_t gap = 0;
@@ -667,7 +675,7 @@ static bool __attribute__((nonnull)) dec_ack_frame(const uint8_t type,
 #ifndef NO_ECN
             // if the ACK'ed pkt was sent with ECT, verify peer and path support
             if (likely(c->sockopt.enable_ecn &&
-                       is_set(ECN_ECT0, acked->flags))) {
+                       (acked->flags & ECN_MASK) != ECN_NOT)) {
                 if (unlikely(type != FRM_ACE)) {
                     warn(WRN,
                          "ECN verification failed for %s conn %s, no ECN "
@@ -675,7 +683,7 @@ static bool __attribute__((nonnull)) dec_ack_frame(const uint8_t type,
                          conn_type(c), cid_str(c->scid));
                     disable_ecn(c);
                 } else
-                    new_acked_ect0++;
+                    new_acked_ect[acked->flags & ECN_MASK]++;
             }
 #endif
 
@@ -722,28 +730,38 @@ static bool __attribute__((nonnull)) dec_ack_frame(const uint8_t type,
                 [ECN_CE] = ecn_cnt[ECN_CE] - pn->ecn_ref[ECN_CE]};
             // log_ecn("inc", ecn_inc);
 
+            // a path that bleaches ECN doesn't increase the counts at all
             if (unlikely(ecn_inc[ECN_ECT0] + ecn_inc[ECN_ECT1] +
                              ecn_inc[ECN_CE] <
-                         new_acked_ect0)) {
+                         new_acked_ect[ECN_ECT0] + new_acked_ect[ECN_ECT1])) {
                 warn(WRN,
                      "ECN verification failed for %s conn %s, "
                      "inc %" PRIu " + %" PRIu " + %" PRIu " < %" PRIu,
                      conn_type(c), cid_str(c->scid), ecn_inc[ECN_ECT0],
-                     ecn_inc[ECN_ECT1], ecn_inc[ECN_CE], new_acked_ect0);
+                     ecn_inc[ECN_ECT1], ecn_inc[ECN_CE],
+                     new_acked_ect[ECN_ECT0] + new_acked_ect[ECN_ECT1]);
                 disable_ecn(c);
-            } else if (unlikely(ecn_inc[ECN_ECT0] + ecn_cnt[ECN_CE] <
-                                new_acked_ect0)) {
+            } else if (unlikely(ecn_inc[ECN_ECT0] + ecn_inc[ECN_CE] <
+                                new_acked_ect[ECN_ECT0])) {
                 warn(WRN,
                      "ECN verification failed for %s conn %s, "
                      "ECT0 inc %" PRIu " + %" PRIu " < %" PRIu,
                      conn_type(c), cid_str(c->scid), ecn_inc[ECN_ECT0],
-                     ecn_inc[ECN_CE], new_acked_ect0);
+                     ecn_inc[ECN_CE], new_acked_ect[ECN_ECT0]);
+                disable_ecn(c);
+            } else if (unlikely(ecn_inc[ECN_ECT1] + ecn_inc[ECN_CE] <
+                                new_acked_ect[ECN_ECT1])) {
+                // ECT(1) re-marked as ECT(0) means no L4S treatment on path
+                warn(WRN,
+                     "ECN verification failed for %s conn %s, "
+                     "ECT1 inc %" PRIu " + %" PRIu " < %" PRIu,
+                     conn_type(c), cid_str(c->scid), ecn_inc[ECN_ECT1],
+                     ecn_inc[ECN_CE], new_acked_ect[ECN_ECT1]);
                 disable_ecn(c);
-                // NOTE: we don't verify ect1 since we never send it
             } else {
-                if (ecn_cnt[ECN_CE] > pn->ecn_ref[ECN_CE])
-                    // ProcessECN
-                    congestion_event(c, lg_ack_in_frm_t);
+                // ProcessECN
+                ecn_feedback(pn, ecn_inc[ECN_ECT0] + ecn_inc[ECN_ECT1],
+                             ecn_inc[ECN_CE], lg_ack_in_frm_t);
 
                 // remember ECN counts
                 memcpy(pn->ecn_ref, ecn_cnt, sizeof(pn->ecn_ref));
@@ -807,6 +825,12 @@ dec_close_frame(const uint8_t type,
         conn_to_state(c, conn_clsg);
         c->needs_tx = true;
         enter_closing(c);
+#if !defined(NO_MIGRATION) && !defined(NO_SERVER)
+        // the peer closed, so a draining stub takes over our CIDs; enc_pkt()
+        // closes the conn once it has sent our one CONNECTION_CLOSE
+        if (!is_clnt(c) && !c->has_stub && c->state == conn_clsg)
+            mk_conn_stub(c, 0);
+#endif
     }
 
     return true;
@@ -1270,6 +1294,168 @@ dec_new_token_frame(const uint8_t ** pos,
 }
 
 
+static bool __attribute__((nonnull))
+dec_datagram_frame(const uint8_t type,
+                   const uint8_t ** pos,
+                   const uint8_t * const end,
+                   const struct pkt_meta * const m)
+{
+    struct q_conn * const c = m->pn->c;
+    const uint8_t * const frm_start = *pos - 1;
+    uint_t len = (uint_t)(end - *pos);
+    if (type == FRM_DGM_31)
+        decv_chk(&len, pos, end, c, FRM_DGM);
+
+    warn(INF, FRAM_IN "DATAGRAM" NRM " 0x%02x len=%" PRIu, type, len);
+
+    if (unlikely(c->tp_mine.max_dgram_frm == 0))
+        err_close_return(c, ERR_PV, FRM_DGM, "DATAGRAM w/o tp");
+
+    const epoch_t e = epoch_for_pkt_type(m->hdr.type);
+    if (unlikely(e != ep_0rtt && e != ep_data))
+        err_close_return(c, ERR_PV, FRM_DGM, "DATAGRAM not OK in %s pkt",
+                         pkt_type_str(m->hdr.flags, &m->hdr.vers));
+
+    if (unlikely(len > (uint_t)(end - *pos)))
+        err_close_return(c, ERR_FRAM_ENC, FRM_DGM, "illegal DATAGRAM len");
+
+    if (unlikely((uint_t)(*pos - frm_start) + len > c->tp_mine.max_dgram_frm))
+        err_close_return(c, ERR_PV, FRM_DGM, "DATAGRAM > max %" PRIu,
+                         c->tp_mine.max_dgram_frm);
+
+    // DATAGRAM payloads are not retransmitted, so it's OK to drop them
+    struct pkt_meta * mdg;
+    struct w_iov * const vdg =
+        alloc_iov(c->w, q_conn_af(c), (uint16_t)len, 0, &mdg);
+    if (unlikely(vdg == 0)) {
+        warn(WRN, "could not alloc iov");
+        goto done;
+    }
+    memcpy(vdg->buf, *pos, len);
+    vdg->len = (uint16_t)len;
+
+    if (unlikely(w_iov_sq_cnt(&c->dgrams_in) >= c->max_dgrams_in)) {
+        // the app isn't keeping up, drop the oldest (= most stale) one
+        struct w_iov * const old = sq_first(&c->dgrams_in);
+        warn(NTE, "DATAGRAM rx queue full, dropping len=%u", old->len);
+        sq_remove_head(&c->dgrams_in, next);
+        free_iov(old, &meta(old));
+    }
+    sq_insert_tail(&c->dgrams_in, vdg, next);
+    c->have_new_data = true;
+    maybe_api_return(q_read_dgram, c, 0);
+
+done:
+    *pos += len;
+    return true;
+}
+
+
+static bool __attribute__((nonnull))
+dec_recovered_stream_frame(struct q_conn * const c,
+                           const struct fec_blk * const b)
+{
+    const uint16_t len = b->lf & UINT16_MAX;
+    const uint8_t type = (uint8_t)(FRM_STR | F_STREAM_OFF | F_STREAM_LEN |
+                                   (b->lf >> 16 ? F_STREAM_FIN : 0));
+    warn(NTE,
+         "FEC recovered sid " FMT_SID " off %" PRIu " len %u from pkt %" PRIu,
+         (dint_t)b->sid, b->off, len, b->lo);
+
+    // wrap the recovered data in a STREAM frame and deliver it like any other
+    struct pkt_meta * mr;
+    const uint16_t vr_len =
+        (uint16_t)(sizeof(uint8_t) + varint_size(b->sid) +
+                   varint_size(b->off) + varint_size(len) + len);
+    struct w_iov * const vr = alloc_iov(c->w, q_conn_af(c), vr_len, 0, &mr);
+    if (unlikely(vr == 0)) {
+        warn(WRN, "could not alloc iov");
+        return true;
+    }
+    uint8_t * p = vr->buf;
+    const uint8_t * const end = vr->buf + vr->len;
+    enc1(&p, end, type);
+    encv(&p, end, b->sid);
+    encv(&p, end, b->off);
+    encv(&p, end, len);
+    encb(&p, end, b->data, len);
+
+    mr->pn = &c->pns[pn_data];
+    mr->hdr.type = mr->hdr.flags = SH;
+    mr->hdr.nr = UINT_T_MAX; // not an actual pkt, don't record it for FEC
+#ifndef NO_QINFO
+    c->i.strm_frms_in_fec++;
+#endif
+
+    const uint8_t * pos = vr->buf + sizeof(uint8_t);
+    if (unlikely(dec_stream_or_crypto_frame(type, &pos, end, mr, vr) == false))
+        return false;
+
+    if (mr->strm == 0 || mr->strm_off == UINT_T_MAX)
+        // the data was not placed into a stream
+        free_iov(vr, mr);
+    else {
+        // adjust w_iov start and len to stream frame data
+        vr->buf += mr->strm_data_pos;
+        vr->len = mr->strm_data_len;
+    }
+    return true;
+}
+
+
+static bool __attribute__((nonnull))
+dec_repair_frame(const uint8_t ** pos,
+                 const uint8_t * const end,
+                 const struct pkt_meta * const m)
+{
+    struct q_conn * const c = m->pn->c;
+    uint_t lo = 0;
+    decv_chk(&lo, pos, end, c, FRM_RPR);
+    uint_t mask = 0;
+    decv_chk(&mask, pos, end, c, FRM_RPR);
+    uint_t sid = 0;
+    decv_chk(&sid, pos, end, c, FRM_RPR);
+    uint_t off = 0;
+    decv_chk(&off, pos, end, c, FRM_RPR);
+    uint_t lf = 0;
+    decv_chk(&lf, pos, end, c, FRM_RPR);
+    uint_t len = 0;
+    decv_chk(&len, pos, end, c, FRM_RPR);
+
+    warn(INF, FRAM_IN "REPAIR" NRM " 0x%02x lo=%" PRIu " mask=0x%" PRIx
+                      " len=%" PRIu,
+         FRM_RPR_3F, lo, mask, len);
+
+    if (unlikely(c->tp_mine.fec == false || c->tp_peer.fec == false))
+        err_close_return(c, ERR_PV, FRM_RPR, "REPAIR w/o tp");
+
+    if (unlikely(m->hdr.type != SH))
+        err_close_return(c, ERR_PV, FRM_RPR, "REPAIR not OK in %s pkt",
+                         pkt_type_str(m->hdr.flags, &m->hdr.vers));
+
+    if (unlikely(mask == 0 || (uint32_t)mask != mask || lf >> 17 ||
+                 len > FEC_SYM_MAX || len > (uint_t)(end - *pos)))
+        err_close_return(c, ERR_FRAM_ENC, FRM_RPR, "illegal REPAIR");
+
+    if (likely(c->fec)) {
+        struct fec_blk * const b = &c->fec->rx;
+        b->lo = lo;
+        b->mask = (uint32_t)mask;
+        b->sid = sid;
+        b->off = off;
+        b->lf = (uint32_t)lf;
+        b->len = (uint16_t)len;
+        memcpy(b->data, *pos, len);
+        if (fec_recover(c->fec) &&
+            unlikely(dec_recovered_stream_frame(c, b) == false))
+            return false;
+    }
+
+    *pos += len;
+    return true;
+}
+
+
 bool dec_frames(struct q_conn * const c,
                 struct w_iov ** vv,
                 struct pkt_meta ** mm)
@@ -1321,7 +1507,9 @@ bool dec_frames(struct q_conn * const c,
                 1 << FRM_CDB | 1 << FRM_SDB | 1 << FRM_SBB | 1 << FRM_SBU |
                 1 << FRM_CID | 1 << FRM_RTR | 1 << FRM_PCL | 1 << FRM_PRP |
                 1 << FRM_HSD)};
-        if (likely(type < FRM_MAX) &&
+        // types from FRM_DGM up only exist in the bitset, not on the wire, so
+        // leave them to the unknown-frame FRAME_ENCODING_ERROR below
+        if (likely(type < FRM_DGM) &&
             unlikely(bit_isset(FRM_MAX, type,
                                &frame_ok[epoch_for_pkt_type(m->hdr.type)]) ==
                      false))
@@ -1473,6 +1661,17 @@ bool dec_frames(struct q_conn * const c,
             ok = dec_retire_cid_frame(&pos, end, m);
             break;
 
+        case FRM_DGM_30:
+        case FRM_DGM_31:
+            ok = dec_datagram_frame(type, &pos, end, m);
+            type = FRM_DGM; // only enc FRM_DGM in bitstr_t
+            break;
+
+        case FRM_RPR_3F:
+            ok = dec_repair_frame(&pos, end, m);
+            type = FRM_RPR; // only enc FRM_RPR in bitstr_t
+            break;
+
         default:
             err_close_return(c, ERR_FRAM_ENC, type,
                              "unknown 0x%02x frame at pos %u", type,
@@ -1957,7 +2156,7 @@ void enc_new_cid_frame(struct q_conn_info * const ci,
         srt = enc_cid->srt;
 #endif
     } else {
-        mk_rand_cid(&ncid,
+        mk_rand_cid(c->w, &ncid,
                     is_clnt(c) ? ped(c->w)->conf.client_cid_len
                                : ped(c->w)->conf.server_cid_len,
                     true);
@@ -2058,3 +2257,45 @@ void enc_hshk_done_frame(struct q_conn_info * const ci,
     track_frame(m, ci, FRM_HSD, 1);
     m->pn->c->tx_hshk_done = false;
 }
+
+
+void enc_datagram_frame(struct q_conn_info * const ci,
+                        uint8_t ** pos,
+                        const uint8_t * const end,
+                        struct pkt_meta * const m,
+                        const struct w_iov * const v)
+{
+    // always include the length, so other frames can follow
+    enc1(pos, end, FRM_DGM_31);
+    encv(pos, end, v->len);
+    encb(pos, end, v->buf, v->len);
+
+    warn(INF, FRAM_OUT "DATAGRAM" NRM " 0x%02x len=%u", FRM_DGM_31, v->len);
+
+    track_frame(m, ci, FRM_DGM, 1);
+}
+
+
+void enc_repair_frame(struct q_conn_info * const ci,
+                      uint8_t ** pos,
+                      const uint8_t * const end,
+                      struct pkt_meta * const m,
+                      struct fec * const f)
+{
+    const struct fec_blk * const b = &f->rpr;
+    enc1(pos, end, FRM_RPR_3F);
+    encv(pos, end, b->lo);
+    encv(pos, end, b->mask);
+    encv(pos, end, b->sid);
+    encv(pos, end, b->off);
+    encv(pos, end, b->lf);
+    encv(pos, end, b->len);
+    encb(pos, end, b->data, b->len);
+
+    warn(INF, FRAM_OUT "REPAIR" NRM " 0x%02x lo=%" PRIu " mask=0x%x len=%u",
+         FRM_RPR_3F, b->lo, b->mask, b->len);
+
+    track_frame(m, ci, FRM_RPR, 1);
+    // REPAIRs are never RTX'ed, so we're done with this block
+    f->rpr.cnt = 0;
+}
@@ -37,6 +37,7 @@
 #include "cid.h"
 
 struct pkt_meta;
+struct fec;
 struct pn_space;
 struct q_conn;
 struct q_stream;
@@ -73,8 +74,14 @@ struct q_stream;
 #define FRM_CLQ 0x1c ///< CONNECTION_CLOSE (QUIC layer)
 #define FRM_CLA 0x1d ///< CONNECTION_CLOSE (application)
 #define FRM_HSD 0x1e ///< HANDSHAKE_DONE
+#define FRM_DGM 0x1f ///< DATAGRAM (only type encoded in the frames bitstr_t)
+#define FRM_RPR 0x20 ///< REPAIR (only type encoded in the frames bitstr_t)
 
-#define FRM_MAX (FRM_HSD + 1)
+#define FRM_MAX (FRM_RPR + 1)
+
+#define FRM_DGM_30 0x30 ///< DATAGRAM (RFC 9221), extends to end of packet
+#define FRM_DGM_31 0x31 ///< DATAGRAM (RFC 9221), with length field
+#define FRM_RPR_3F 0x3f ///< REPAIR (quant-private FEC extension)
 
 bitset_define(frames, FRM_MAX);
 
@@ -113,7 +120,9 @@ static const uint8_t max_frame_len[] = {
     [FRM_PRP] = sizeof(uint8_t) + sizeof(uint64_t),
     [FRM_CLQ] = UINT8_MAX, // special case
     [FRM_CLA] = UINT8_MAX, // special case
-    [FRM_HSD] = sizeof(uint8_t)};
+    [FRM_HSD] = sizeof(uint8_t),
+    [FRM_DGM] = UINT8_MAX,  // special case
+    [FRM_RPR] = UINT8_MAX}; // special case
 
 
 #define F_STREAM_FIN 0x01
@@ -323,6 +332,28 @@ enc_hshk_done_frame(struct q_conn_info * const ci,
                     const uint8_t * const end,
                     struct pkt_meta * const m);
 
+extern void __attribute__((nonnull
+#ifdef NO_QINFO
+                           (2, 3, 4, 5)
+#endif
+                               ))
+enc_datagram_frame(struct q_conn_info * const ci,
+                   uint8_t ** pos,
+                   const uint8_t * const end,
+                   struct pkt_meta * const m,
+                   const struct w_iov * const v);
+
+extern void __attribute__((nonnull
+#ifdef NO_QINFO
+                           (2, 3, 4, 5)
+#endif
+                               ))
+enc_repair_frame(struct q_conn_info * const ci,
+                 uint8_t ** pos,
+                 const uint8_t * const end,
+                 struct pkt_meta * const m,
+                 struct fec * const f);
+
 
 static inline bool __attribute__((nonnull))
 is_ack_eliciting(const struct frames * const f)
@@ -27,10 +27,12 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <time.h>
 
 #include <timeout.h>
 
+#include "async.h"
 #include "conn.h"
 #include "loop.h"
 #include "quic.h"
@@ -65,6 +67,16 @@ void loop_init(void)
 }
 
 
+static void __attribute__((nonnull)) run_timers(struct w_engine * const w)
+{
+    timeouts_update(ped(w)->wheel, w_now(CLOCK_MONOTONIC_RAW));
+
+    struct timeout * t;
+    while ((t = timeouts_get(ped(w)->wheel)) != 0)
+        (*t->callback.fn)(t->callback.arg);
+}
+
+
 void __attribute__((nonnull(1))) loop_run(struct w_engine * const w,
                                           const func_ptr f,
                                           struct q_conn * const c,
@@ -77,11 +89,10 @@ void __attribute__((nonnull(1))) loop_run(struct w_engine * const w,
     break_loop = false;
 
     while (likely(break_loop == false)) {
-        timeouts_update(ped(w)->wheel, w_now(CLOCK_MONOTONIC_RAW));
-
-        struct timeout * t;
-        while ((t = timeouts_get(ped(w)->wheel)) != 0)
-            (*t->callback.fn)(t->callback.arg);
+#ifndef NO_ASYNC
+        async_run(w);
+#endif
+        run_timers(w);
 
         if (unlikely(break_loop))
             break;
@@ -93,15 +104,54 @@ void __attribute__((nonnull(1))) loop_run(struct w_engine * const w,
             continue;
 
         struct w_sock_slist sl = w_sock_slist_initializer(sl);
-        if (w_rx_ready(w, &sl) == 0)
+        const uint32_t ready = w_rx_ready(w, &sl);
+        if (ready == 0)
             continue;
 
         // this actually matters
         timeouts_update(ped(w)->wheel, w_now(CLOCK_MONOTONIC_RAW));
 
+        if (unlikely(ready > ped(w)->rx_q_cap)) {
+            struct rx_backlog * const q =
+                realloc(ped(w)->rx_q, ready * sizeof(*q));
+            ensure(q, "could not realloc");
+            ped(w)->rx_q = q;
+            ped(w)->rx_q_cap = ready;
+        }
+
+        uint32_t cnt = 0;
         struct w_sock * ws;
         sl_foreach (ws, &sl, next)
-            rx(ws);
+#ifndef NO_ASYNC
+            if (unlikely(ws == ped(w)->async.ws))
+                async_rx(w);
+            else
+#endif
+            {
+                struct rx_backlog * const b = &ped(w)->rx_q[cnt++];
+                b->ws = ws;
+                sq_init(&b->q);
+                w_rx(ws, &b->q);
+            }
+
+        // process what we got in rounds, so that a flood on one socket or
+        // for one connection can't starve the others, and let the timers
+        // (ACKs, loss detection, etc.) run in between rounds
+        bool more = cnt > 0;
+        while (more) {
+            ped(w)->rx_round++;
+            more = false;
+            for (uint32_t i = 0; i < cnt; i++) {
+                struct rx_backlog * const b = &ped(w)->rx_q[i];
+                if (sq_empty(&b->q))
+                    continue;
+                rx(b);
+                if (!sq_empty(&b->q))
+                    more = true;
+            }
+            if (more)
+                run_timers(w);
+        }
     }
 
     api_func = 0;
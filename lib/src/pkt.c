@@ -43,6 +43,7 @@
 #include "cid.h"
 #include "conn.h"
 #include "diet.h"
+#include "fec.h"
 #include "frame.h"
 #include "marshall.h"
 #include "pkt.h"
@@ -440,6 +441,36 @@ enc_other_frames(
 }
 
 
+static void __attribute__((nonnull
+#ifdef NO_QINFO
+                           (2, 3, 4)
+#endif
+                               ))
+enc_datagram_frames(
+#ifndef NO_QINFO
+    struct q_conn_info
+#else
+    void
+#endif
+        * const ci,
+    uint8_t ** pos,
+    const uint8_t * const end,
+    struct pkt_meta * const m)
+{
+    struct q_conn * const c = m->pn->c;
+
+    while (sq_empty(&c->dgrams_out) == false) {
+        struct w_iov * const v = sq_first(&c->dgrams_out);
+        if (*pos + sizeof(uint8_t) + varint_size(v->len) + v->len > end)
+            break;
+        enc_datagram_frame(ci, pos, end, m, v);
+        // DATAGRAMs are never RTX'ed, so we're done with the payload
+        sq_remove_head(&c->dgrams_out, next);
+        free_iov(v, &meta(v));
+    }
+}
+
+
 bool enc_pkt(struct q_stream * const s,
              const bool rtx,
              const bool enc_data,
@@ -543,9 +574,9 @@ bool enc_pkt(struct q_stream * const s,
 
 #ifndef NO_ECN
     // track the flags manually, since warpcore sets them on the xv and it'd
-    // require another loop to copy them over
-    if (likely(c->sockopt.enable_ecn))
-        v->flags |= ECN_ECT0;
+    // require another loop to copy them over; the iov may be reused, so clear
+    // any old codepoint first, or ECT(0) | ECT(1) would give CE
+    v->flags = (uint8_t)((v->flags & ~ECN_MASK) | tx_ecn(c));
 #endif
 
 #ifndef NDEBUG
@@ -590,6 +621,13 @@ bool enc_pkt(struct q_stream * const s,
                                                              : sdt_seq);
         } else
             enc_stream_or_crypto_frame(&pos, v->buf + v->len, m, v, s);
+
+        if (unlikely(c->fec) && epoch == ep_data && s->id >= 0)
+            // add the stream data to the current FEC block
+            fec_tx_sym(c->fec, m->hdr.nr, (uint_t)s->id, m->strm_off,
+                       m->strm_data_len, m->is_fin,
+                       m->strm_data_ref ? m->strm_data_ref
+                                        : v->buf + m->strm_data_pos);
     }
 
     // TODO: include more frames when c->rec.max_ups < max_ups TP
@@ -599,6 +637,19 @@ bool enc_pkt(struct q_stream * const s,
         // we can try to stick some more frames in after the stream frame
         enc_other_frames(ci, &pos, v->buf + c->rec.max_ups - AEAD_LEN, m);
 
+    if (unlikely(sq_empty(&c->dgrams_out) == false) && epoch == ep_data &&
+        likely(c->state == conn_estb))
+        // fill any space left after the stream frame with DATAGRAMs
+        enc_datagram_frames(ci, &pos, v->buf + c->rec.max_ups - AEAD_LEN, m);
+
+    if (unlikely(c->fec && c->fec->rpr.cnt) && epoch == ep_data &&
+        likely(c->state == conn_estb) &&
+        pos + rpr_frame_len(&c->fec->rpr) <=
+            v->buf + c->rec.max_ups - AEAD_LEN)
+        // send the REPAIR for the last FEC block, if there is space
+        enc_repair_frame(ci, &pos, v->buf + c->rec.max_ups - AEAD_LEN, m,
+                         c->fec);
+
     if (is_clnt(c) && enc_data) {
         if (unlikely(c->try_0rtt == false && m->hdr.type == LH_INIT)) {
             const uint8_t * const min_len = v->buf + MIN_INI_LEN - AEAD_LEN;
@@ -670,6 +721,17 @@ tx:;
     xv->saddr = v->saddr;
     xv->flags = v->flags;
 
+#if !defined(NO_MIGRATION) && !defined(NO_SERVER)
+    if (unlikely(c->state == conn_clsg) && !is_clnt(c)) {
+        if (c->has_stub == false)
+            // this pkt carries our CONNECTION_CLOSE, hand off to a closing stub
+            mk_conn_stub(c, xv);
+        else
+            // a draining stub waited for this pkt, so we can close right away
+            timeouts_add(ped(c->w)->wheel, &c->closing_alarm, 0);
+    }
+#endif
+
     // encode the pn space id and pkt nr to identify PMTUD pkts;
     // this only works for packets numbered below 0x3fff, but that is plenty
     xv->user_data = (uint16_t)((m->pn->type << 14) | MIN(0x3fff, m->hdr.nr));
@@ -1021,7 +1083,7 @@ struct q_conn * is_srt(const struct w_iov * const xv
     uint8_t * const srt = &xv->buf[xv->len - SRT_LEN];
     struct q_conn * const c = get_conn_by_srt(srt);
 
-    if (c && c->state != conn_drng) {
+    if (c && c->state != conn_drng && c->state != conn_clsd) {
         m->is_reset = true;
         warn(DBG, "stateless reset for %s conn %s", conn_type(c),
              cid_str(c->scid));
@@ -1059,7 +1121,7 @@ bool dec_pkt_hdr_remainder(struct w_iov * const xv,
         unlikely(is_set(SH_KYPH, m->hdr.flags) != pnd->in_kyph)) {
         if (pnd->out_kyph == pnd->in_kyph) {
             // this is a peer-initiated key phase flip
-            cs = ptls_get_cipher(c->tls.t);
+            cs = c->tls.cs;
             if (unlikely(cs == 0)) {
                 warn(ERR, "cannot obtain cipher suite");
                 return false;
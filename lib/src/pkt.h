@@ -43,7 +43,9 @@ struct q_stream;
 
 #define MIN_INI_LEN 1200
 #define MAX_UPS 65527
-#define MIN_SRT_PKT_LEN 5 + SRT_LEN ///< min SRT length, incl. the fixed bits
+#define MIN_SRT_PKT_LEN (5 + SRT_LEN) ///< min SRT length, incl. the fixed bits
+#define MAX_SRT_PKT_LEN 64 ///< max length of SRTs we send
+#define MAX_SRT_PER_SEC 100 ///< max number of SRTs we send per second
 
 #define HEAD_FORM 0x80 ///< header form (1 = long, 0 = short)
 #define HEAD_FIXD 0x40 ///< fixed bit (= 1)
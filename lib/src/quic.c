@@ -33,6 +33,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 
 #include <picotls.h>
@@ -52,6 +53,7 @@
 
 #include "conn.h"
 #include "loop.h"
+#include "marshall.h"
 #include "pkt.h"
 #include "pn.h"
 #include "quic.h"
@@ -218,14 +220,15 @@ static void __attribute__((nonnull)) mark_fin(struct w_iov_sq * const q)
 }
 
 
-struct q_conn * q_connect(struct w_engine * const w,
-                          const struct sockaddr * const peer,
-                          const char * const peer_name,
-                          struct w_iov_sq * const early_data,
-                          struct q_stream ** const early_data_stream,
-                          const bool fin,
-                          const char * const alpn,
-                          const struct q_conn_conf * const conf)
+static struct q_conn * __attribute__((nonnull(1, 2, 3)))
+start_connect(struct w_engine * const w,
+              const struct sockaddr * const peer,
+              const char * const peer_name,
+              struct w_iov_sq * const early_data,
+              struct q_stream ** const early_data_stream,
+              const bool fin,
+              const char * const alpn,
+              const struct q_conn_conf * const conf)
 {
     // make new connection
     struct w_sockaddr p;
@@ -255,6 +258,8 @@ struct q_conn * q_connect(struct w_engine * const w,
     }
 
     struct q_conn * const c = new_conn(w, idx, 0, 0, &p, peer_name, 0, 0, conf);
+    if (unlikely(c == 0))
+        return 0;
 
     // init TLS
     init_tls(c, peer_name, alpn);
@@ -293,6 +298,24 @@ struct q_conn * q_connect(struct w_engine * const w,
          w_ntop(&p.addr, ip_tmp), p.addr.af == AF_INET6 ? "]" : "",
          bswap16(p.port));
     conn_to_state(c, conn_opng);
+    return c;
+}
+
+
+struct q_conn * q_connect(struct w_engine * const w,
+                          const struct sockaddr * const peer,
+                          const char * const peer_name,
+                          struct w_iov_sq * const early_data,
+                          struct q_stream ** const early_data_stream,
+                          const bool fin,
+                          const char * const alpn,
+                          const struct q_conn_conf * const conf)
+{
+    struct q_conn * const c = start_connect(w, peer, peer_name, early_data,
+                                            early_data_stream, fin, alpn, conf);
+    if (unlikely(c == 0))
+        return 0;
+
     loop_run(w, (func_ptr)q_connect, c, 0);
 
     if (fin && early_data_stream && *early_data_stream &&
@@ -319,11 +342,21 @@ struct q_conn * q_connect(struct w_engine * const w,
 }
 
 
-bool q_write(struct q_stream * const s,
-             struct w_iov_sq * const q,
-             const bool fin)
+struct q_conn * q_connect_start(struct w_engine * const w,
+                                const struct sockaddr * const peer,
+                                const char * const peer_name,
+                                const char * const alpn,
+                                const struct q_conn_conf * const conf)
 {
-    struct q_conn * const c = s->c;
+    // q_ready() reports the conn once the handshake has completed or failed
+    return start_connect(w, peer, peer_name, 0, 0, false, alpn, conf);
+}
+
+
+static bool __attribute__((nonnull))
+strm_writable(const struct q_stream * const s)
+{
+    const struct q_conn * const c = s->c;
     if (unlikely(c->state == conn_qlse || c->state == conn_drng ||
                  c->state == conn_clsd)) {
         warn(ERR, "%s conn %s is in state %s, can't write", conn_type(c),
@@ -337,6 +370,27 @@ bool q_write(struct q_stream * const s,
         return false;
     }
 
+    if (unlikely(s->gen)) {
+        // later buffers would otherwise be freed on ACK like generated ones
+        warn(ERR,
+             "%s conn %s strm " FMT_SID " still has %" PRIu
+             " generated bytes to send or un-ACK'ed, can't write",
+             conn_type(c), cid_str(c->scid), s->id, s->gen_left);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool q_write(struct q_stream * const s,
+             struct w_iov_sq * const q,
+             const bool fin)
+{
+    struct q_conn * const c = s->c;
+    if (unlikely(strm_writable(s) == false))
+        return false;
+
     // add to stream
     if (fin) {
         if (sq_empty(q)) {
@@ -364,28 +418,120 @@ bool q_write(struct q_stream * const s,
 }
 
 
+bool q_write_gen(struct q_stream * const s,
+                 const uint8_t * const pat,
+                 const size_t pat_len,
+                 const uint_t len,
+                 const bool fin)
+{
+    if (len == 0) {
+        struct w_iov_sq q = w_iov_sq_initializer(q);
+        return q_write(s, &q, fin);
+    }
+
+    struct q_conn * const c = s->c;
+    if (unlikely(pat_len == 0 || strm_writable(s) == false))
+        return false;
+
+    // the data is generated from pat in tx_stream() as cwnd opens up, and
+    // freed once ACK'ed, so q_stream_get_written() won't return it; until all
+    // of it is ACK'ed, further writes to s are refused
+    s->gen = true;
+    s->gen_pat = pat;
+    s->gen_pat_len = (uint_t)pat_len;
+    s->gen_pos = 0;
+    s->gen_left = len;
+    s->gen_fin = fin;
+
+    warn(WRN,
+         "writing %" PRIu " generated byte%s %son %s conn %s strm " FMT_SID,
+         len, plural(len), fin ? "(and FIN) " : "", conn_type(c),
+         cid_str(c->scid), s->id);
+
+    // kick TX watcher
+    timeouts_add(ped(c->w)->wheel, &c->tx_w, 0);
+    return true;
+}
+
+
+bool q_write_iov(struct q_stream * const s,
+                 const struct iovec * const iov,
+                 const size_t cnt,
+                 const bool fin,
+                 const q_release_cb cb,
+                 void * const arg)
+{
+    struct q_conn * const c = s->c;
+    if (unlikely(s->gen_iov)) {
+        warn(ERR,
+             "%s conn %s strm " FMT_SID
+             " still references application memory, can't write",
+             conn_type(c), cid_str(c->scid), s->id);
+        return false;
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < cnt; i++)
+        len += iov[i].iov_len;
+    if (len == 0) {
+        struct w_iov_sq q = w_iov_sq_initializer(q);
+        const bool ok = q_write(s, &q, fin);
+        if (ok && cb)
+            // nothing is referenced
+            cb(arg, true);
+        return ok;
+    }
+
+    if (unlikely(strm_writable(s) == false))
+        return false;
+
+    // like q_write_gen(), but the pkts built in tx_stream() reference the
+    // (copied, minus empty entries) vector; since RTXs are re-encrypted from
+    // it, the application memory is only released once all is ACK'ed
+    s->gen_iov = calloc(cnt, sizeof(*iov));
+    ensure(s->gen_iov, "could not calloc");
+    s->gen_iov_cnt = 0;
+    for (size_t i = 0; i < cnt; i++)
+        if (iov[i].iov_len)
+            s->gen_iov[s->gen_iov_cnt++] = iov[i];
+    s->gen_iov_idx = 0;
+    s->gen_rel_cb = cb;
+    s->gen_rel_arg = arg;
+    s->gen = true;
+    s->gen_pos = 0;
+    s->gen_left = len;
+    s->gen_fin = fin;
+
+    warn(WRN,
+         "writing %zu byte%s %sfrom %zu app buf%s on %s conn %s strm " FMT_SID,
+         len, plural(len), fin ? "(and FIN) " : "", cnt, plural(cnt),
+         conn_type(c), cid_str(c->scid), s->id);
+
+    // kick TX watcher
+    timeouts_add(ped(c->w)->wheel, &c->tx_w, 0);
+    return true;
+}
+
+
 static struct q_stream * __attribute__((nonnull))
-find_ready_strm(khash_t(strms_by_id) * const sbi, const bool all)
+find_ready_strm(const struct strm_tbl * const t, const bool all)
 {
-    struct q_stream * s = 0;
-    bool found = false;
-    kh_foreach_value(sbi, s, {
-        if (s->state == strm_clsd ||
-            (!sq_empty(&s->in) && (!all || s->state == strm_hcrm))) {
-            found = true;
-            break;
-        }
+    struct q_stream * s;
+    strm_tbl_foreach(t, s, {
+        // stream is closed, or has data (and a a FIN, if we're reading all)
+        if (s->released == false &&
+            (s->state == strm_clsd ||
+             (!sq_empty(&s->in) && (!all || s->state == strm_hcrm))))
+            return s;
     });
-
-    // stream is closed, or has data (and a a FIN, if we're reading all)
-    return found ? s : 0;
+    return 0;
 }
 
 
 struct q_stream *
 q_read(struct q_conn * const c, struct w_iov_sq * const q, const bool all)
 {
-    struct q_stream * const s = find_ready_strm(&c->strms_by_id, all);
+    struct q_stream * const s = find_ready_strm(&c->strms, all);
     if (s)
         q_read_stream(s, q, all);
     return s;
@@ -421,7 +567,7 @@ bool q_read_stream(struct q_stream * const s,
 
     sq_concat(q, &s->in);
 
-    const struct q_stream * const sr = find_ready_strm(&c->strms_by_id, all);
+    const struct q_stream * const sr = find_ready_strm(&c->strms, all);
     c->have_new_data = sr != 0;
 
     if (all && m_last->is_fin == false)
@@ -431,6 +577,68 @@ bool q_read_stream(struct q_stream * const s,
 }
 
 
+bool q_write_dgram(struct q_conn * const c, struct w_iov_sq * const q)
+{
+    if (unlikely(c->state != conn_estb || c->tp_peer.max_dgram_frm == 0)) {
+        warn(ERR, "%s conn %s in state %s w/max_dgram %" PRIu ", can't write",
+             conn_type(c), cid_str(c->scid), conn_state_str[c->state],
+             c->tp_peer.max_dgram_frm);
+        return false;
+    }
+
+    // each DATAGRAM frame must fit the peer's limit and into a single pkt
+    const uint_t max_frm_len =
+        MIN(c->tp_peer.max_dgram_frm,
+            (uint_t)(c->rec.max_ups - AEAD_LEN - DATA_OFFSET));
+    const struct w_iov * v;
+    sq_foreach (v, q, next) {
+        const uint_t frm_len =
+            (uint_t)(sizeof(uint8_t) + varint_size(v->len) + v->len);
+        if (unlikely(frm_len > max_frm_len)) {
+            warn(ERR, "DATAGRAM frame len %" PRIu " > max %" PRIu,
+                 frm_len, max_frm_len);
+            return false;
+        }
+    }
+
+    warn(WRN, "writing %" PRIu " DATAGRAM%s w/%" PRIu " byte%s on %s conn %s",
+         w_iov_sq_cnt(q), plural(w_iov_sq_cnt(q)), w_iov_sq_len(q),
+         plural(w_iov_sq_len(q)), conn_type(c), cid_str(c->scid));
+
+    sq_concat(&c->dgrams_out, q);
+
+    // kick TX watcher
+    timeouts_add(ped(c->w)->wheel, &c->tx_w, 0);
+    return true;
+}
+
+
+bool q_read_dgram(struct q_conn * const c,
+                  struct w_iov_sq * const q,
+                  const bool block)
+{
+    if (sq_empty(&c->dgrams_in) && block && q_is_conn_closed(c) == false) {
+        warn(WRN, "waiting for DATAGRAM on %s conn %s", conn_type(c),
+             cid_str(c->scid));
+        loop_run(c->w, (func_ptr)q_read_dgram, c, 0);
+    }
+
+    if (sq_empty(&c->dgrams_in))
+        return false;
+
+    warn(WRN, "read %" PRIu " DATAGRAM%s w/%" PRIu " byte%s on %s conn %s",
+         w_iov_sq_cnt(&c->dgrams_in), plural(w_iov_sq_cnt(&c->dgrams_in)),
+         w_iov_sq_len(&c->dgrams_in), plural(w_iov_sq_len(&c->dgrams_in)),
+         conn_type(c), cid_str(c->scid));
+
+    sq_concat(q, &c->dgrams_in);
+
+    const struct q_stream * const sr = find_ready_strm(&c->strms, false);
+    c->have_new_data = sr != 0;
+    return true;
+}
+
+
 struct q_conn * q_bind(struct w_engine * const w
 #ifdef NO_SERVER
                        __attribute__((unused))
@@ -448,6 +656,11 @@ struct q_conn * q_bind(struct w_engine * const w
 )
 {
 #ifndef NO_SERVER
+    if (unlikely(ped(w)->draining)) {
+        warn(WRN, "draining, not binding to port %u", port);
+        return 0;
+    }
+
     // bind socket and create new embryonic server connection
     struct q_conn * const c =
         new_conn(w, addr_idx, 0, 0, 0, 0, bswap16(port), 0, 0);
@@ -465,6 +678,50 @@ struct q_conn * q_bind(struct w_engine * const w
 }
 
 
+#ifndef NO_SERVER
+static void __attribute__((nonnull)) drain_alarm(struct w_engine * const w)
+{
+    warn(NTE, "drain deadline reached, closing remaining conns");
+#ifndef NO_MIGRATION
+    struct q_conn * c;
+    kh_foreach_value(&conns_by_id, c, {
+        if (!is_clnt(c) && c->state >= conn_idle && c->state <= conn_estb)
+            noerr_close(c, "server draining");
+    });
+#endif
+}
+#endif
+
+
+void q_drain(struct w_engine * const w,
+             const uint64_t nsec
+#ifdef NO_SERVER
+             __attribute__((unused))
+#endif
+)
+{
+#ifndef NO_SERVER
+    if (ped(w)->draining)
+        return;
+
+    warn(NTE, "draining, closing conns when idle or in %.3f sec",
+         (double)nsec / NS_PER_S);
+    ped(w)->draining = true;
+
+#ifndef NO_MIGRATION
+    // close what is already idle right away
+    struct q_conn * c;
+    kh_foreach_value(&conns_by_id, c, {
+        if (!is_clnt(c) && conn_is_idle(c))
+            noerr_close(c, "server draining");
+    });
+#endif
+
+    timeouts_add(ped(w)->wheel, &ped(w)->drain_alarm, nsec);
+#endif
+}
+
+
 static void cancel_api_call(struct timeout * const api_alarm)
 {
 #ifdef DEBUG_EXTRA
@@ -515,6 +772,16 @@ struct q_stream * q_rsv_stream(struct q_conn * const c, const bool bidi)
 }
 
 
+uint_t q_strms_avail(const struct q_conn * const c, const bool bidi)
+{
+    const uint_t max =
+        bidi ? c->tp_peer.max_strms_bidi : c->tp_peer.max_strms_uni;
+    const uint_t next =
+        (uint_t)((bidi ? c->next_sid_bidi : c->next_sid_uni) >> 2);
+    return next < max ? max - next : 0;
+}
+
+
 #if !defined(NDEBUG) && !defined(FUZZING) && defined(FUZZER_CORPUS_COLLECTION)
 static int __attribute__((nonnull))
 mk_or_open_dir(const char * const path, mode_t mode)
@@ -574,6 +841,8 @@ struct w_engine * q_init(const char * const ifname,
                              .enable_quantum_readiness_test = false,
                              .disable_pmtud = false,
                              .enable_grease = false,
+                             .datagram_rx_queue = 64,
+                             .max_strm_mem = DEF_MAX_STRM_MEM,
                              .enable_spinbit =
 #ifndef NDEBUG
                                  true
@@ -606,6 +875,18 @@ struct w_engine * q_init(const char * const ifname,
             get_conf_uncond(w, conf->conn_conf, disable_pmtud);
         ped(w)->default_conn_conf.enable_grease =
             get_conf_uncond(w, conf->conn_conf, enable_grease);
+        ped(w)->default_conn_conf.keepalive =
+            get_conf_uncond(w, conf->conn_conf, keepalive);
+        ped(w)->default_conn_conf.max_datagram_frame_size =
+            get_conf_uncond(w, conf->conn_conf, max_datagram_frame_size);
+        ped(w)->default_conn_conf.datagram_rx_queue =
+            get_conf(w, conf->conn_conf, datagram_rx_queue);
+        ped(w)->default_conn_conf.enable_fec =
+            get_conf_uncond(w, conf->conn_conf, enable_fec);
+        ped(w)->default_conn_conf.enable_l4s =
+            get_conf_uncond(w, conf->conn_conf, enable_l4s);
+        ped(w)->default_conn_conf.max_strm_mem =
+            get_conf(w, conf->conn_conf, max_strm_mem);
     }
 
     // initialize some globals
@@ -615,6 +896,12 @@ struct w_engine * q_init(const char * const ifname,
 #ifndef NO_SRT_MATCHING
     memset(&conns_by_srt, 0, sizeof(conns_by_srt));
 #endif
+#if !defined(NO_MIGRATION) && !defined(NO_SERVER)
+    memset(&stubs_by_id, 0, sizeof(stubs_by_id));
+#endif
+#ifndef NO_SERVER
+    splay_init(&conns_by_act);
+#endif
 
     // initialize the event loop
     timeout_init(&ped(w)->api_alarm, 0);
@@ -623,6 +910,9 @@ struct w_engine * q_init(const char * const ifname,
     ped(w)->wheel = timeouts_open(TIMEOUT_nHZ, &err);
     timeouts_update(ped(w)->wheel, w_now(CLOCK_MONOTONIC_RAW));
     timeout_setcb(&ped(w)->api_alarm, cancel_api_call, &ped(w)->api_alarm);
+#ifndef NO_SERVER
+    timeout_setcb(&ped(w)->drain_alarm, drain_alarm, w);
+#endif
 
     warn(INF, "%s/%s (%s) %s/%s ready", quant_name, w->backend_name,
          w->backend_variant, quant_version, QUANT_COMMIT_HASH_ABBREV_STR);
@@ -631,6 +921,11 @@ struct w_engine * q_init(const char * const ifname,
     // initialize TLS context
     init_tls_ctx(conf, ped(w));
 
+#ifndef NO_ASYNC
+    if (ped(w)->conf.enable_async)
+        async_init(w);
+#endif
+
 #if !defined(NDEBUG) && defined(FUZZER_CORPUS_COLLECTION)
 #ifdef FUZZING
     warn(CRT, "%s compiled for fuzzing - will not communicate", quant_name);
@@ -657,10 +952,34 @@ void q_close_stream(struct q_stream * const s)
 
 void q_free_stream(struct q_stream * const s)
 {
+#ifndef NO_ASYNC
+    // run any q_*_async() commands still queued for the stream first
+    async_run(s->c->w);
+#endif
     free_stream(s);
 }
 
 
+void q_release_stream(struct q_stream * const s)
+{
+#ifndef NO_ASYNC
+    async_run(s->c->w);
+#endif
+    // the app won't touch the stream again, so free it once it is done
+    s->released = true;
+    if (strm_reclaimable(s))
+        free_stream(s);
+}
+
+
+bool q_notify_written(struct q_stream * const s)
+{
+    // have q_ready() report the conn once all data written so far is ACK'ed
+    s->notify_written = !out_fully_acked(s) || s->gen_left;
+    return s->notify_written == false;
+}
+
+
 void q_stream_get_written(struct q_stream * const s, struct w_iov_sq * const q)
 {
     if (s->out_una == 0) {
@@ -678,11 +997,11 @@ void q_stream_get_written(struct q_stream * const s, struct w_iov_sq * const q)
 }
 
 
-void q_close(struct q_conn * const c,
-             const uint_t code,
-             const char * const reason
+bool begin_close(struct q_conn * const c,
+                 const uint_t code,
+                 const char * const reason
 #if defined(NO_ERR_REASONS) && defined(NDEBUG)
-             __attribute__((unused))
+                 __attribute__((unused))
 #endif
 )
 {
@@ -706,16 +1025,37 @@ void q_close(struct q_conn * const c,
     if (c->state == conn_idle || c->state == conn_clsd ||
         (!is_clnt(c) && c->holds_sock))
         // we don't need to do the closing dance in these cases
-        goto done;
+        return false;
 
     if (c->state != conn_clsg && c->state != conn_drng) {
         conn_to_state(c, conn_qlse);
         timeouts_add(ped(c->w)->wheel, &c->tx_w, 0);
     }
+    return true;
+}
 
-    loop_run(c->w, (func_ptr)q_close, c, 0);
 
-done:
+bool q_close_start(struct q_conn * const c,
+                   const uint_t code,
+                   const char * const reason)
+{
+    // if this returns true, q_ready() reports the conn once it has closed,
+    // otherwise q_close() can be called right away; neither blocks
+    return begin_close(c, code, reason);
+}
+
+
+void q_close(struct q_conn * const c,
+             const uint_t code,
+             const char * const reason)
+{
+#ifndef NO_ASYNC
+    // run any q_*_async() commands still queued for the conn first
+    async_run(c->w);
+#endif
+    if (begin_close(c, code, reason))
+        loop_run(c->w, (func_ptr)q_close, c, 0);
+
 #if !defined(NO_QINFO) && !defined(PARTICLE)
     if (c->scid && c->i.pkts_in_valid > 0) {
         static const char * const frm_typ_str[] = {
@@ -750,6 +1090,8 @@ done:
             [0x1c] = "CONNECTION_CLOSE_QUIC",
             [0x1d] = "CONNECTION_CLOSE_APP",
             [0x1e] = "HANDSHAKE_DONE",
+            [0x1f] = "DATAGRAM",
+            [0x20] = "REPAIR",
         };
 
         conn_info_populate(c);
@@ -780,6 +1122,7 @@ done:
         qinfo_log("ssthresh = %" PRIu,
                   c->i.ssthresh == UINT_T_MAX ? 0 : c->i.ssthresh);
         qinfo_log("pto_cnt = %" PRIu, c->i.pto_cnt);
+        qinfo_log("pers_cong_cnt = %" PRIu, c->i.pers_cong_cnt);
         qinfo_log("%-22s %s %10s %10s", "frame", "code", "out", "in");
         for (size_t i = 0;
              i < sizeof(c->i.frm_cnt[0]) / sizeof(c->i.frm_cnt[0][0]); i++) {
@@ -792,6 +1135,7 @@ done:
         qinfo_log("strm_frms_in_ooo = %" PRIu, c->i.strm_frms_in_ooo);
         qinfo_log("strm_frms_in_dup = %" PRIu, c->i.strm_frms_in_dup);
         qinfo_log("strm_frms_in_ign = %" PRIu, c->i.strm_frms_in_ign);
+        qinfo_log("strm_frms_in_fec = %" PRIu, c->i.strm_frms_in_fec);
     }
 #endif
 
@@ -825,6 +1169,18 @@ void q_cleanup(struct w_engine * const w)
         q_close(c, 0, 0);
 #endif
 
+    // closed conns that handed their CIDs to a closing stub are only here
+    sl_foreach_safe (c, &c_ready, node_rx_ext, tmp)
+        q_close(c, 0, 0);
+
+#if !defined(NO_MIGRATION) && !defined(NO_SERVER)
+    free_conn_stubs(0);
+#endif
+
+#ifndef NO_ASYNC
+    async_cleanup(w);
+#endif
+
     // stop the event loop
     timeouts_close(ped(w)->wheel);
 
@@ -856,9 +1212,13 @@ void q_cleanup(struct w_engine * const w)
 #ifndef NO_SRT_MATCHING
     kh_release(conns_by_srt, &conns_by_srt);
 #endif
+#if !defined(NO_MIGRATION) && !defined(NO_SERVER)
+    kh_release(stubs_by_id, &stubs_by_id);
+#endif
 
     free_tls_ctx(ped(w));
     free(ped(w)->pkt_meta);
+    free(ped(w)->rx_q);
     free(w->data);
     w_cleanup(w);
 
@@ -892,12 +1252,24 @@ q_cid_str(struct q_conn * const c, char * const buf, const size_t buf_len)
 }
 
 
+const char * q_alpn(struct q_conn * const c)
+{
+    return c->tls.t ? ptls_get_negotiated_protocol(c->tls.t) : 0;
+}
+
+
 uint_t q_sid(const struct q_stream * const s)
 {
     return (uint_t)s->id;
 }
 
 
+struct q_stream * q_sid_stream(struct q_conn * const c, const uint_t sid)
+{
+    return get_stream(c, (dint_t)sid);
+}
+
+
 bool q_is_stream_closed(const struct q_stream * const s)
 {
     return s->state == strm_clsd;
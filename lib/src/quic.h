@@ -50,6 +50,7 @@
 #define ASAN_UNPOISON_MEMORY_REGION(x, y)
 #endif
 
+#include "async.h"
 #include "cid.h"
 #include "frame.h"
 #include "tree.h"
@@ -128,12 +129,13 @@ struct pkt_meta {
     sl_head(pm_sl, pkt_meta) rtx; ///< List of pkt_meta structs of previous TXs.
 
     // pm_cpy(true) starts copying from here:
-    struct frames frms;     ///< Frames present in pkt.
-    struct q_stream * strm; ///< Stream this data was written on.
-    uint_t strm_off;        ///< Stream data offset.
-    uint16_t strm_frm_pos;  ///< Offset of stream frame header.
-    uint16_t strm_data_pos; ///< Offset of first byte of stream frame data.
-    uint16_t strm_data_len; ///< Length of stream frame data.
+    struct frames frms;            ///< Frames present in pkt.
+    struct q_stream * strm;        ///< Stream this data was written on.
+    const uint8_t * strm_data_ref; ///< App memory holding the data, or null.
+    uint_t strm_off;               ///< Stream data offset.
+    uint16_t strm_frm_pos;         ///< Offset of stream frame header.
+    uint16_t strm_data_pos;        ///< Offset of first stream frame data byte.
+    uint16_t strm_data_len;        ///< Length of stream frame data.
 
     uint16_t ack_frm_pos; ///< Offset of (first, on RX) ACK frame.
 
@@ -170,12 +172,22 @@ struct pkt_meta {
 struct per_engine_data {
     struct timeouts * wheel;
     struct pkt_meta * pkt_meta;
+    struct rx_backlog * rx_q; ///< Per-socket RX backlogs, see loop_run().
+    uint32_t rx_q_cap;        ///< Number of entries allocated in @p rx_q.
+    uint32_t rx_round;        ///< Current RX round, see rx().
     struct q_conn_conf default_conn_conf;
     struct q_conf conf;
     struct timeout api_alarm;
 
     ptls_context_t tls_ctx;
     ptls_aead_context_t * rid_ctx;
+    uint8_t srt_key[PTLS_SHA256_DIGEST_SIZE]; ///< for deterministic SRTs
+
+#if !defined(NO_SERVER) && !defined(NO_SRT_MATCHING)
+    uint64_t srt_tx_t;   ///< start of the current SRT rate-limit interval
+    uint32_t srt_tx_cnt; ///< number of SRTs sent during the interval
+    uint8_t _unused_srt[4];
+#endif
 
 #ifdef WITH_OPENSSL
     ptls_openssl_sign_certificate_t sign_cert;
@@ -186,12 +198,19 @@ struct per_engine_data {
 #ifndef NO_SERVER
     struct cipher_ctx dec_tick_tok;
     struct cipher_ctx enc_tick_tok;
+    struct timeout drain_alarm; ///< Closes remaining conns when draining.
+    bool draining;              ///< Not accepting new connections.
+    uint8_t _unused_drain[7];
 #endif
 
 #ifdef NO_MIGRATION
     sl_head(conn_head, q_conn) conns;
 #endif
 
+#ifndef NO_ASYNC
+    struct async_q async; ///< Commands from other threads.
+#endif
+
 #ifndef NO_TLS_LOG
     int tls_log;
 #else
@@ -236,6 +255,16 @@ dup_iov(const struct w_iov * const v,
         struct pkt_meta ** const mdup,
         const uint16_t off);
 
+extern bool __attribute__((nonnull(1)))
+begin_close(struct q_conn * const c,
+            const uint_t code,
+            const char * const reason);
+
+
+#ifndef NDEBUG
+extern uint8_t tx_loss_pct; ///< Testing: drop this % of outgoing 1-RTT pkts.
+#endif
+
 
 #if !defined(NDEBUG) && !defined(FUZZING) && defined(FUZZER_CORPUS_COLLECTION)
 extern int corpus_pkt_dir, corpus_frm_dir;
@@ -41,6 +41,7 @@
 #include "cid.h"
 #include "conn.h"
 #include "diet.h"
+#include "fec.h"
 #include "frame.h"
 #include "loop.h"
 #include "marshall.h"
@@ -153,6 +154,17 @@ static bool peer_completed_addr_val(struct q_conn * const c)
 }
 
 
+static uint64_t __attribute__((nonnull)) pto_period(struct q_conn * const c)
+{
+    // PTO without backoff, in ns
+    return unlikely(c->rec.cur.srtt == 0)
+               ? (2 * c->rec.initial_rtt) * NS_PER_US
+               : ((c->rec.cur.srtt + MAX(4 * c->rec.cur.rttvar, kGranularity)) *
+                      NS_PER_US +
+                  c->tp_peer.max_ack_del * NS_PER_MS);
+}
+
+
 void set_ld_timer(struct q_conn * const c)
 {
     if (c->state == conn_idle || c->state == conn_clsg || c->state == conn_drng)
@@ -188,17 +200,10 @@ void set_ld_timer(struct q_conn * const c)
         return;
     }
 
-    timeout_t to =
-        unlikely(c->rec.cur.srtt == 0)
-            ? (2 * c->rec.initial_rtt) * NS_PER_US
-            : ((c->rec.cur.srtt + MAX(4 * c->rec.cur.rttvar, kGranularity)) *
-                   NS_PER_US +
-               c->tp_peer.max_ack_del * NS_PER_MS);
-    to *= 1 << c->rec.pto_cnt;
+    // the idle timeout ends a blackout long before the shift can overflow
+    const timeout_t to = pto_period(c) << MIN(c->rec.pto_cnt, 16);
     const uint64_t last_ae_tx_t = earliest_pn(c, false)->last_ae_tx_t;
     c->rec.ld_alarm_val = (last_ae_tx_t ? last_ae_tx_t : now) + to;
-    // XXX do an RTX at least every 8 seconds (spec violation)
-    c->rec.ld_alarm_val = MIN(c->rec.ld_alarm_val, now + 8 * NS_PER_S);
 
 set_to:;
     if (unlikely(c->rec.ld_alarm_val < now)) {
@@ -233,24 +238,66 @@ void congestion_event(struct q_conn * const c, const uint64_t sent_t)
 }
 
 
+#ifndef NO_ECN
+void ecn_feedback(struct pn_space * const pn,
+                  const uint_t ect,
+                  const uint_t ce,
+                  const uint64_t sent_t)
+{
+    struct q_conn * const c = pn->c;
+
+    if (c->rec.l4s == false) {
+        // classic ECN: treat CE like loss
+        if (ce)
+            congestion_event(c, sent_t);
+        return;
+    }
+
+    c->rec.l4s_ect += ect;
+    c->rec.l4s_ce += ce;
+    if (pn->lg_acked < c->rec.l4s_win)
+        // we've not yet seen a full RTT worth of feedback
+        return;
+
+    // alpha = (1 - g) * alpha + g * F, F being the CE fraction of the last RTT
+    const uint_t total = c->rec.l4s_ect + c->rec.l4s_ce;
+    const uint32_t frac =
+        total ? (uint32_t)((c->rec.l4s_ce << L4S_SHIFT) / total) : 0;
+    c->rec.l4s_alpha +=
+        (frac >> L4S_G_SHIFT) - (c->rec.l4s_alpha >> L4S_G_SHIFT);
+
+    if (c->rec.l4s_ce && in_cong_recovery(c, sent_t) == false) {
+        // reduce cwnd in proportion to the congestion extent, by alpha / 2
+        c->rec.rec_start_t = w_now(CLOCK_MONOTONIC_RAW);
+        c->rec.cur.cwnd -= (c->rec.cur.cwnd * c->rec.l4s_alpha) >>
+                           (L4S_SHIFT + 1);
+        c->rec.cur.ssthresh = c->rec.cur.cwnd =
+            MAX(c->rec.cur.cwnd, kMinimumWindow(c->rec.max_ups));
+    }
+
+    warn(DBG, "L4S: %" PRIu "/%" PRIu " CE, alpha %.3f, cwnd %" PRIu,
+         c->rec.l4s_ce, total, (double)c->rec.l4s_alpha / (1 << L4S_SHIFT),
+         c->rec.cur.cwnd);
+    c->rec.l4s_ect = c->rec.l4s_ce = 0;
+    c->rec.l4s_win = pn->lg_sent + 1;
+}
+#endif
+
+
 static bool __attribute__((nonnull))
-in_persistent_cong(struct pn_space * const pn __attribute__((unused)),
-                   const uint_t lg_lost __attribute__((unused)))
+in_persistent_cong(struct q_conn * const c, const uint64_t lost_span)
 {
-    // struct q_conn * const c = pn->c;
-
-    // // see InPersistentCongestion() pseudo code
-    // const uint64_t cong_period =
-    //     kPersistentCongestionThreshold *
-    //     (c->rec.cur.srtt + MAX(4 * c->rec.cur.rttvar, kGranularity) +
-    //      c->tp_mine.max_ack_del * NS_PER_MS);
-
-    // const struct ival * const i = diet_find(&pn->lost, lg_lost);
-    // warn(DBG,
-    //      "lg_lost_ival %" PRIu "-%" PRIu ", lg_lost %" PRIu ", period
-    //      %.3f", i->lo, i->hi, lg_lost, cong_period);
-    // return i->lo + cong_period < lg_lost;
-    return false;
+    // see InPersistentCongestion() pseudo code; lost_span is the longest time
+    // between two ACK-eliciting pkts that were lost with nothing in between
+    // them ACK'ed, counting only pkts sent after the first RTT sample
+    if (c->rec.first_rtt_t == 0 || lost_span == 0)
+        return false;
+
+    const uint64_t cong_period = kPersistentCongestionThreshold * pto_period(c);
+    warn(DBG, "lost span %.3f, cong period %.3f on %s conn %s",
+         (double)lost_span / NS_PER_S, (double)cong_period / NS_PER_S,
+         conn_type(c), cid_str(c->scid));
+    return lost_span > cong_period;
 }
 
 
@@ -304,6 +351,11 @@ void on_pkt_lost(struct pkt_meta * const m, const bool is_lost)
     if (is_lost == false)
         return;
 
+    if (unlikely(c->fec) && m->strm && m->strm->id >= 0 &&
+        pn->type == pn_data)
+        // feed the FEC block size adaptation
+        c->fec->lost++;
+
     // if we lost connection or stream control frames, possibly RTX them
     qlog_recovery(rec_pl, "unknown", c, m);
 
@@ -417,6 +469,9 @@ detect_lost_pkts(struct pn_space * const pn, const bool do_cc)
     uint_t lg_lost = UINT_T_MAX;
     uint64_t lg_lost_tx_t = 0;
     bool in_flight_lost = false;
+    uint_t prev_lost = UINT_T_MAX;
+    uint64_t span_start_t = 0;
+    uint64_t lost_span = 0;
 
     struct ival * i = 0;
     diet_foreach (i, diet, &pn->sent_pkt_nrs) {
@@ -448,6 +503,17 @@ detect_lost_pkts(struct pn_space * const pn, const bool do_cc)
                     lg_lost_tx_t = m->t;
                 }
                 diet_insert(&lost, m->hdr.nr, 0);
+
+                // a gap in the lost pkt nrs means something was ACK'ed
+                if (prev_lost == UINT_T_MAX || m->hdr.nr != prev_lost + 1)
+                    span_start_t = 0;
+                prev_lost = m->hdr.nr;
+                if (m->ack_eliciting && c->rec.first_rtt_t &&
+                    m->t > c->rec.first_rtt_t) {
+                    if (span_start_t == 0)
+                        span_start_t = m->t;
+                    lost_span = MAX(lost_span, m->t - span_start_t);
+                }
             } else {
                 if (unlikely(!pn->loss_t))
                     pn->loss_t = m->t + loss_del;
@@ -500,8 +566,17 @@ detect_lost_pkts(struct pn_space * const pn, const bool do_cc)
     // OnPacketsLost
     if (do_cc && in_flight_lost) {
         congestion_event(c, lg_lost_tx_t);
-        if (in_persistent_cong(pn, lg_lost))
+        if (in_persistent_cong(c, lost_span)) {
+            warn(NTE, "persistent congestion on %s conn %s", conn_type(c),
+                 cid_str(c->scid));
             c->rec.cur.cwnd = kMinimumWindow(c->rec.max_ups);
+            c->rec.rec_start_t = 0;
+            // the path may have changed, forget the old min_rtt
+            c->rec.cur.min_rtt = c->rec.cur.latest_rtt;
+#ifndef NO_QINFO
+            c->i.pers_cong_cnt++;
+#endif
+        }
     }
 
     log_cc(c);
@@ -623,6 +698,7 @@ update_rtt(struct q_conn * const c, uint_t ack_del)
 {
     // see UpdateRtt() pseudo code
     if (unlikely(c->rec.cur.srtt == 0)) {
+        c->rec.first_rtt_t = w_now(CLOCK_MONOTONIC_RAW);
         c->rec.cur.min_rtt = c->rec.cur.srtt = c->rec.cur.latest_rtt;
         c->rec.cur.rttvar = c->rec.cur.latest_rtt / 2;
         return;
@@ -789,8 +865,10 @@ void on_pkt_acked(struct w_iov * const v, struct pkt_meta * m)
                 break;
             if (mou->is_fin)
                 fin_acked = true;
-            // if this ACKs a crypto packet, we can free it
-            if (unlikely(s->id < 0 && mou->lost == false)) {
+            // if this ACKs a crypto or generated packet, we can free it
+            if (unlikely((s->id < 0 || s->gen) && mou->lost == false)) {
+                if (s->out_last == s->out_una)
+                    s->out_last = 0;
                 sq_remove(&s->out, s->out_una, w_iov, next);
                 sq_next(s->out_una, next) = 0;
                 free_iov(s->out_una, mou);
@@ -802,9 +880,24 @@ void on_pkt_acked(struct w_iov * const v, struct pkt_meta * m)
                 // this ACKs a FIN
                 c->have_new_data = true;
                 strm_to_state(s, s->state == strm_hcrm ? strm_clsd : strm_hclo);
+                if (unlikely(s->released))
+                    // have tx() reclaim the stream
+                    timeouts_add(ped(c->w)->wheel, &c->tx_w, 0);
             }
             if (c->did_0rtt)
                 maybe_api_return(q_connect, c, 0);
+            if (unlikely(s->gen) && s->gen_left == 0) {
+                // all generated data is ACK'ed, so s can be written to again
+                s->gen = false;
+                if (s->gen_iov)
+                    // let the app have its q_write_iov() memory back
+                    release_gen_iov(s, true);
+            }
+            if (unlikely(s->notify_written) && s->gen_left == 0) {
+                // see q_notify_written()
+                s->notify_written = false;
+                conn_ready(c);
+            }
         }
 
     } else
@@ -816,12 +909,18 @@ void init_rec(struct q_conn * const c)
 {
     timeout_del(&c->rec.ld_alarm);
     c->rec.pto_cnt = 0;
+    c->rec.first_rtt_t = 0;
     c->rec.max_ups = MIN_INI_LEN;
     c->rec.cur = (struct cc_state){.cwnd = kInitialWindow(c->rec.max_ups),
                                    .ssthresh = UINT_T_MAX,
                                    .min_rtt = UINT_T_MAX};
 #if !defined(NDEBUG) || !defined(NO_QLOG)
     c->rec.prev = c->rec.cur;
+#endif
+#ifndef NO_ECN
+    // like DCTCP, start out assuming the worst
+    c->rec.l4s_alpha = 1 << L4S_SHIFT;
+    c->rec.l4s_ect = c->rec.l4s_ce = c->rec.l4s_win = 0;
 #endif
     timeout_setcb(&c->rec.ld_alarm, on_ld_timeout, c);
 }
@@ -38,6 +38,12 @@ struct pn_space;
 struct q_conn;
 
 
+#ifndef NO_ECN
+#define L4S_SHIFT 10  ///< Fixed-point precision of the CE fraction and alpha.
+#define L4S_G_SHIFT 4 ///< EWMA gain g = 1/16, as for DCTCP (RFC 8257).
+#endif
+
+
 struct cc_state {
     // these are kept in usec:
     uint_t latest_rtt; // latest_rtt
@@ -59,6 +65,7 @@ struct recovery {
     timeout_t ld_alarm_val;
 
     uint64_t rec_start_t; // recovery_start_time
+    uint64_t first_rtt_t; // when we took the first RTT sample
     uint_t ae_in_flight;  // nr of ACK-eliciting pkts inflight
 
     // largest_sent_packet -> pn->lg_sent
@@ -75,6 +82,16 @@ struct recovery {
     uint16_t pto_cnt; // pto_count
     uint16_t max_ups; // max_datagram_size
     int max_ups_af;   // address family we checked max_ups under
+
+#ifndef NO_ECN
+    // L4S (DCTCP/Prague-style) CE response, see ecn_feedback()
+    uint_t l4s_win;     // pkt nr that ends the current CE observation window
+    uint_t l4s_ect;     // ECT pkts ACK'ed during the current window
+    uint_t l4s_ce;      // CE pkts ACK'ed during the current window
+    uint32_t l4s_alpha; // EWMA of the CE fraction, scaled by 2^L4S_SHIFT
+    uint8_t l4s;        // send ECT(1) and respond to CE proportionally
+    uint8_t _unused[3];
+#endif
 };
 
 
@@ -100,6 +117,13 @@ on_pkt_acked(struct w_iov * const v, struct pkt_meta * m);
 extern void __attribute__((nonnull))
 congestion_event(struct q_conn * const c, const uint64_t sent_t);
 
+#ifndef NO_ECN
+extern void __attribute__((nonnull)) ecn_feedback(struct pn_space * const pn,
+                                                  const uint_t ect,
+                                                  const uint_t ce,
+                                                  const uint64_t sent_t);
+#endif
+
 extern void __attribute__((nonnull)) set_ld_timer(struct q_conn * const c);
 
 extern void __attribute__((nonnull))
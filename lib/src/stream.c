@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
+#include <sys/uio.h>
 
 #include <quant/quant.h>
 
@@ -52,10 +53,7 @@ const char * const strm_state_str[] = {STRM_STATES};
 
 struct q_stream * get_stream(struct q_conn * const c, const dint_t id)
 {
-    const khiter_t k = kh_get(strms_by_id, &c->strms_by_id, (khint64_t)id);
-    if (unlikely(k == kh_end(&c->strms_by_id)))
-        return 0;
-    return kh_val(&c->strms_by_id, k);
+    return strm_tbl_get(&c->strms, id);
 }
 
 
@@ -108,11 +106,7 @@ struct q_stream * new_stream(struct q_conn * const c, const dint_t id)
         return s;
     }
 
-    int ret;
-    const khiter_t k =
-        kh_put(strms_by_id, &c->strms_by_id, (khint64_t)id, &ret);
-    assure(ret >= 1, "inserted");
-    kh_val(&c->strms_by_id, k) = s;
+    strm_tbl_put(&c->strms, s);
 
     apply_stream_limits(s);
     const bool is_local = (is_srv_ini(id) != is_clnt(c));
@@ -132,17 +126,46 @@ struct q_stream * new_stream(struct q_conn * const c, const dint_t id)
 }
 
 
+static void __attribute__((nonnull))
+grant_stream_ids(struct q_conn * const c, const bool bidi, const bool now)
+{
+    uint_t * const max =
+        bidi ? &c->tp_mine.max_strms_bidi : &c->tp_mine.max_strms_uni;
+    const uint_t win = bidi ? c->strm_win_bidi : c->strm_win_uni;
+    const uint_t lim = (bidi ? c->clsd_bidi : c->clsd_uni) + win;
+
+    // unless the peer is blocked, only send an update once half of the window
+    // can be reopened, to not send MAX_STREAMS for every freed stream
+    if (lim <= *max || (now == false && lim - *max < win / 2))
+        return;
+
+    warn(DBG, "%s conn %s: %s MAX_STREAMS %" PRIu " -> %" PRIu, conn_type(c),
+         cid_str(c->scid), bidi ? "bidi" : "uni", *max, lim);
+    *max = lim;
+    if (bidi)
+        c->tx_max_sid_bidi = true;
+    else
+        c->tx_max_sid_uni = true;
+}
+
+
 void free_stream(struct q_stream * const s)
 {
     struct q_conn * const c = s->c;
     if (likely(s->id >= 0)) {
         warn(DBG, "freeing strm " FMT_SID " on %s conn %s", s->id, conn_type(c),
              cid_str(c->scid));
-        diet_insert(&c->clsd_strms, (uint_t)s->id, 0);
-        const khiter_t k =
-            kh_get(strms_by_id, &c->strms_by_id, (khint64_t)s->id);
-        assure(k != kh_end(&c->strms_by_id), "found");
-        kh_del(strms_by_id, &c->strms_by_id, k);
+        diet_insert(&c->clsd_strms, strm_clsd_key(s->id), 0);
+        strm_tbl_del(&c->strms, s->id);
+
+        if (is_srv_ini(s->id) == is_clnt(c)) {
+            // a peer stream was retired, so it can open another one
+            if (is_uni(s->id))
+                c->clsd_uni++;
+            else
+                c->clsd_bidi++;
+            grant_stream_ids(c, !is_uni(s->id), false);
+        }
     }
 #ifndef FUZZING
     else
@@ -160,6 +183,9 @@ void free_stream(struct q_stream * const s)
     if (s->in_ctrl)
         sl_remove(&c->need_ctrl, s, q_stream, node_ctrl);
 
+    if (unlikely(s->gen_iov))
+        release_gen_iov(s, false);
+
     q_free(&s->out);
     q_free(&s->in);
 #ifndef FUZZING
@@ -217,11 +243,13 @@ void reset_stream(struct q_stream * const s, const bool forget)
         const uint16_t shp = m->strm_frm_pos;
         const uint16_t sds = m->strm_data_pos;
         const uint16_t sdl = m->strm_data_len;
+        const uint8_t * const sdr = m->strm_data_ref;
         memset(m, 0, sizeof(*m));
         m->is_fin = fin;
         m->strm_frm_pos = shp;
         m->strm_data_pos = sds;
         m->strm_data_len = sdl;
+        m->strm_data_ref = sdr;
     }
 }
 
@@ -268,18 +296,15 @@ void do_stream_id_fc(struct q_conn * const c,
         return;
     }
 
-    // this is a remote stream
-    if (bidi) {
-        if (cnt == c->tp_mine.max_strms_bidi) {
-            c->tx_max_sid_bidi = true;
-            c->tp_mine.max_strms_bidi *= 2;
-        }
-    } else {
-        if (cnt == c->tp_mine.max_strms_uni) {
-            c->tx_max_sid_uni = true;
-            c->tp_mine.max_strms_uni *= 2;
-        }
-    }
+    // this is a remote stream; if the peer has used up its credit, grow the
+    // window, as long as that stays within the memory budget
+    uint_t * const win = bidi ? &c->strm_win_bidi : &c->strm_win_uni;
+    if (cnt != (bidi ? c->tp_mine.max_strms_bidi : c->tp_mine.max_strms_uni) ||
+        *win == 0)
+        return;
+    if (c->strm_win_bidi + c->strm_win_uni + *win <= c->strm_win_max)
+        *win *= 2;
+    grant_stream_ids(c, bidi, true);
 }
 
 
@@ -292,6 +317,65 @@ void concat_out(struct q_stream * const s, struct w_iov_sq * const q)
 }
 
 
+struct w_iov * gen_out(struct q_stream * const s, const uint32_t max_len)
+{
+    struct q_conn * const c = s->c;
+    struct w_iov_sq q = w_iov_sq_initializer(q);
+    alloc_off(c->w, &q, c, q_conn_af(c), (uint32_t)MIN(s->gen_left, max_len),
+              DATA_OFFSET);
+    if (unlikely(sq_empty(&q)))
+        return 0;
+
+    struct w_iov * v;
+    sq_foreach (v, &q, next) {
+        if (s->gen_iov) {
+            // reference the q_write_iov() vector instead of copying from it,
+            // which limits each pkt to (the rest of) a single vector entry
+            assure(s->gen_iov_idx < s->gen_iov_cnt, "iov idx in range");
+            const struct iovec * const i = &s->gen_iov[s->gen_iov_idx];
+            v->len = (uint16_t)MIN((size_t)v->len, i->iov_len - s->gen_pos);
+            meta(v).strm_data_ref = (const uint8_t *)i->iov_base + s->gen_pos;
+            s->gen_pos += v->len;
+            if (s->gen_pos == i->iov_len) {
+                s->gen_iov_idx++;
+                s->gen_pos = 0;
+            }
+            continue;
+        }
+
+        // fill from the pattern, continuing where the last chunk left off
+        for (uint16_t pos = 0; pos < v->len;) {
+            const uint16_t n = (uint16_t)MIN((uint_t)(v->len - pos),
+                                             s->gen_pat_len - s->gen_pos);
+            memcpy(&v->buf[pos], &s->gen_pat[s->gen_pos], n);
+            pos += n;
+            s->gen_pos = (s->gen_pos + n) % s->gen_pat_len;
+        }
+    }
+
+    s->gen_left -= w_iov_sq_len(&q);
+    if (s->gen_left == 0 && s->gen_fin)
+        // cppcheck-suppress nullPointer
+        meta(sq_last(&q, w_iov, next)).is_fin = true;
+
+    v = sq_first(&q);
+    concat_out(s, &q);
+    return v;
+}
+
+
+void release_gen_iov(struct q_stream * const s, const bool ok)
+{
+    const q_release_cb cb = s->gen_rel_cb;
+    void * const arg = s->gen_rel_arg;
+    free(s->gen_iov);
+    s->gen_iov = 0;
+    s->gen_rel_cb = 0;
+    if (cb)
+        cb(arg, ok);
+}
+
+
 bool q_is_uni_stream(const struct q_stream * const s)
 {
     return is_uni(s->id);
@@ -51,7 +51,9 @@
 #define INIT_STRM_DATA_BIDI 0xffff
 #define INIT_STRM_DATA_UNI 0x7ff
 #define INIT_MAX_UNI_STREAMS 128
+#define INIT_MAX_UNI_STREAMS_SRV 3 ///< H3 control and QPACK enc/dec streams.
 #define INIT_MAX_BIDI_STREAMS 128
+#define DEF_MAX_STRM_MEM (2 * 1024 * 1024) ///< Default for max_strm_mem.
 
 #define STRM_STATE(k, v) k = v
 #define STRM_STATES                                                            \
@@ -103,13 +105,28 @@ struct q_stream {
     uint_t in_data;     ///< In-order stream data received (total).
     uint_t in_data_off; ///< Next in-order stream data offset expected.
 
+    const uint8_t * gen_pat; ///< Pattern for generated data, see q_write_gen().
+    uint_t gen_pat_len;      ///< Length of @p gen_pat.
+    uint_t gen_pos;          ///< Position in @p gen_pat of next generated byte.
+    uint_t gen_left;         ///< Bytes still to be generated.
+
+    struct iovec * gen_iov;  ///< Copied q_write_iov() vector, or null.
+    uint_t gen_iov_cnt;      ///< Number of entries in @p gen_iov.
+    uint_t gen_iov_idx;      ///< Entry in @p gen_iov of next generated byte.
+    q_release_cb gen_rel_cb; ///< Called once @p gen_iov data is ACK'ed.
+    void * gen_rel_arg;      ///< Argument for @p gen_rel_cb.
+
     uint_t lost_cnt;    ///< Number of pkts in out that are marked lost.
     strm_state_t state; ///< Stream state.
 
     uint8_t in_ctrl : 1; ///< Stream is in connections "needs ctrl" list.
     uint8_t tx_max_strm_data : 1; ///< We need to open the receive window.
     uint8_t blocked : 1;          ///< We are receive-window-blocked.
-    uint8_t : 5;
+    uint8_t gen : 1;              ///< Data is generated, free once ACK'ed.
+    uint8_t gen_fin : 1;          ///< Send a FIN after the generated data.
+    uint8_t notify_written : 1;   ///< Make conn ready once out is ACK'ed.
+    uint8_t released : 1;         ///< App is done, free once closed.
+    uint8_t : 1;
 
 #if HAVE_64BIT
     uint8_t _unused[3];
@@ -119,6 +136,11 @@ struct q_stream {
 };
 
 
+/// Approximate memory a peer-initiated stream pins until it is freed, used to
+/// turn q_conn_conf.max_strm_mem into a limit on the MAX_STREAMS window.
+#define STRM_MEM_COST (sizeof(struct q_stream) + sizeof(struct q_stream *))
+
+
 #if !defined(NDEBUG) && defined(DEBUG_STREAMS) && !defined(FUZZING)
 #define strm_to_state(s, new_state)                                            \
     do {                                                                       \
@@ -157,6 +179,26 @@ out_fully_acked(const struct q_stream * const s)
 }
 
 
+/// Whether @p s was released by the app (see q_release_stream()) and is now
+/// closed in both directions, with all its data ACK'ed.
+///
+static inline bool __attribute__((nonnull))
+strm_reclaimable(const struct q_stream * const s)
+{
+    return s->released && s->state == strm_clsd && out_fully_acked(s);
+}
+
+
+/// Key for stream ID @p id in the clsd_strms diet. The stream type goes into
+/// the top bits, so that consecutive streams of one type coalesce into a
+/// single interval.
+///
+static inline uint_t strm_clsd_key(const dint_t id)
+{
+    return (uint_t)(id & 3) << (sizeof(uint_t) * 8 - 2) | (uint_t)id >> 2;
+}
+
+
 static const dint_t crpt_strm_id[] =
     {[ep_init] = -4, [ep_hshk] = -2, [ep_data] = -1};
 
@@ -227,5 +269,11 @@ extern void __attribute__((nonnull)) do_stream_id_fc(struct q_conn * const c,
 extern void __attribute__((nonnull))
 concat_out(struct q_stream * const s, struct w_iov_sq * const q);
 
+extern struct w_iov * __attribute__((nonnull))
+gen_out(struct q_stream * const s, const uint32_t max_len);
+
+extern void __attribute__((nonnull))
+release_gen_iov(struct q_stream * const s, const bool ok);
+
 extern dint_t __attribute__((nonnull))
 max_sid(const dint_t sid, const struct q_conn * const c);
@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <quant/quant.h>
+
+#include "quic.h"
+#include "stream.h"
+#include "strm_tbl.h"
+
+
+#define STRM_TBL_MIN_CAP 16
+
+
+/// Make @p a cover stream number @p n, either by growing it at the end or, for
+/// numbers below @p base (possible for peer streams that were skipped over
+/// when the leading tombstones were dropped), at the front.
+///
+/// @param      a     Stream array.
+/// @param[in]  n     Stream number.
+///
+static void __attribute__((nonnull))
+strm_arr_cover(struct strm_arr * const a, const uint_t n)
+{
+    if (unlikely(a->len == 0))
+        // empty array, just rebase
+        a->base = n;
+
+    const uint_t lo = n < a->base ? n : a->base;
+    const uint_t hi = n >= a->base + a->len ? n + 1 : a->base + a->len;
+    const uint_t len = hi - lo;
+
+    if (len > a->cap) {
+        uint_t cap = a->cap ? a->cap : STRM_TBL_MIN_CAP;
+        while (cap < len)
+            cap <<= 1;
+        struct q_stream ** const s = realloc(a->s, cap * sizeof(*s));
+        ensure(s, "could not realloc");
+        a->s = s;
+        a->cap = cap;
+    }
+
+    if (lo < a->base) {
+        const uint_t shift = a->base - lo;
+        memmove(&a->s[shift], a->s, a->len * sizeof(*a->s));
+        memset(a->s, 0, shift * sizeof(*a->s));
+        a->base = lo;
+        a->len += shift;
+    }
+
+    if (len > a->len) {
+        memset(&a->s[a->len], 0, (len - a->len) * sizeof(*a->s));
+        a->len = len;
+    }
+}
+
+
+/// Find the position of stream number @p n in @p a->low, or where it would go.
+///
+/// @param[in]  a     Stream array.
+/// @param[in]  n     Stream number.
+///
+/// @return     Index of the first entry in @p a->low not below @p n.
+///
+static uint_t __attribute__((nonnull))
+strm_low_pos(const struct strm_arr * const a, const uint_t n)
+{
+    // tombstones keep their number, so they don't get in the way
+    uint_t lo = 0;
+    uint_t hi = a->low_len;
+    while (lo < hi) {
+        const uint_t mid = lo + (hi - lo) / 2;
+        if (a->low[mid].n < n)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+struct strm_low * strm_low_find(const struct strm_arr * const a, const uint_t n)
+{
+    const uint_t i = strm_low_pos(a, n);
+    return i < a->low_len && a->low[i].n == n ? &a->low[i] : 0;
+}
+
+
+/// Insert stream @p s with number @p n into @p a->low at position @p i.
+///
+/// @param      a     Stream array.
+/// @param[in]  i     Position in @p a->low.
+/// @param[in]  n     Stream number.
+/// @param      s     Stream.
+///
+static void __attribute__((nonnull))
+strm_low_ins(struct strm_arr * const a,
+             const uint_t i,
+             const uint_t n,
+             struct q_stream * const s)
+{
+    if (a->low_len == a->low_cap) {
+        const uint_t cap = a->low_cap ? a->low_cap << 1 : STRM_TBL_MIN_CAP;
+        struct strm_low * const low = realloc(a->low, cap * sizeof(*low));
+        ensure(low, "could not realloc");
+        a->low = low;
+        a->low_cap = cap;
+    }
+    memmove(&a->low[i + 1], &a->low[i], (a->low_len - i) * sizeof(*a->low));
+    a->low[i] = (struct strm_low){.n = n, .s = s};
+    a->low_len++;
+    a->low_cnt++;
+}
+
+
+/// Once the tombstones in @p a outnumber its live streams by far, move the
+/// live streams at the front of the window to @p a->low, until the remaining
+/// window is at least half full.
+///
+/// @param      a     Stream array.
+///
+static void __attribute__((nonnull)) strm_arr_compact(struct strm_arr * const a)
+{
+    const uint_t live = a->cnt - a->low_cnt;
+    if (likely(a->len <= STRM_TBL_MIN_CAP || a->len - live <= 2 * live))
+        return;
+
+    uint_t j = 0;
+    uint_t moved = 0;
+    while (a->len - j > 2 * (live - moved)) {
+        if (a->s[j]) {
+            // all of low is below base, so appending keeps it sorted
+            strm_low_ins(a, a->low_len, a->base + j, a->s[j]);
+            moved++;
+        }
+        j++;
+    }
+
+    a->len -= j;
+    memmove(a->s, &a->s[j], a->len * sizeof(*a->s));
+    a->base += j;
+}
+
+
+void strm_tbl_put(struct strm_tbl * const t, struct q_stream * const s)
+{
+    struct strm_arr * const a = &t->a[s->id & 3];
+    const uint_t n = (uint_t)s->id >> 2;
+
+    // like the tombstones below, drop those in low here rather than in
+    // strm_tbl_del(), so that strm_tbl_foreach() can free streams
+    if (unlikely(a->low_len > a->low_cnt)) {
+        uint_t k = 0;
+        for (uint_t i = 0; i < a->low_len; i++)
+            if (a->low[i].s)
+                a->low[k++] = a->low[i];
+        a->low_len = k;
+    }
+
+    // drop leading tombstones here rather than in strm_tbl_del(), so that
+    // freeing streams during strm_tbl_foreach() never moves the slots
+    uint_t dead = 0;
+    while (dead < a->len && a->s[dead] == 0)
+        dead++;
+    if (dead && n >= a->base + dead) {
+        a->len -= dead;
+        memmove(a->s, &a->s[dead], a->len * sizeof(*a->s));
+        a->base += dead;
+    }
+    strm_arr_compact(a);
+
+    if (unlikely(n < a->base &&
+                 (a->low_len || (a->len && a->base - n > a->len)))) {
+        // the window must not grow over low, or more than double at the front
+        assure(strm_low_find(a, n) == 0, "strm " FMT_SID " already in table",
+               s->id);
+        strm_low_ins(a, strm_low_pos(a, n), n, s);
+        a->cnt++;
+        return;
+    }
+
+    strm_arr_cover(a, n);
+    assure(a->s[n - a->base] == 0, "strm " FMT_SID " already in table", s->id);
+    a->s[n - a->base] = s;
+    a->cnt++;
+}
+
+
+void strm_tbl_del(struct strm_tbl * const t, const dint_t id)
+{
+    struct strm_arr * const a = &t->a[id & 3];
+    const uint_t n = (uint_t)id >> 2;
+    const uint_t i = n - a->base;
+    if (likely(i < a->len)) {
+        assure(a->s[i], "strm " FMT_SID " not in table", id);
+        a->s[i] = 0;
+    } else {
+        struct strm_low * const l = strm_low_find(a, n);
+        assure(l && l->s, "strm " FMT_SID " not in table", id);
+        l->s = 0;
+        a->low_cnt--;
+    }
+    a->cnt--;
+}
+
+
+void strm_tbl_free(struct strm_tbl * const t)
+{
+    for (uint_t typ = 0; typ < 4; typ++) {
+        free(t->a[typ].s);
+        free(t->a[typ].low);
+        t->a[typ] = (struct strm_arr){0};
+    }
+}
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <quant/quant.h>
+
+
+struct q_stream;
+
+
+/// Entry of strm_arr::low.
+struct strm_low {
+    uint_t n;            ///< Stream number.
+    struct q_stream * s; ///< Stream, or null once freed.
+};
+
+
+/// Stream IDs are handed out sequentially per type (the low two ID bits), so
+/// instead of hashing them, each type gets a growable array indexed by stream
+/// number (the ID without the type bits). The array only covers the window
+/// [base..base+len) of numbers that may still be in use; when a stream is
+/// freed, its slot becomes a null tombstone, and leading tombstones are
+/// dropped by sliding @p base forward. Which IDs were ever used is recorded
+/// separately in the clsd_strms diet.
+///
+/// A long-lived stream would pin @p base and let the window grow without
+/// bound, so once tombstones dominate, the live streams at the front of the
+/// window move to the sorted @p low list and @p base jumps past them.
+struct strm_arr {
+    struct q_stream ** s; ///< Slots; s[i] is stream number base + i, or null.
+    uint_t base;          ///< Stream number of s[0].
+    uint_t len;           ///< Number of slots in use, including tombstones.
+    uint_t cap;           ///< Number of slots allocated.
+    uint_t cnt;           ///< Number of live streams, including @p low ones.
+
+    struct strm_low * low; ///< Streams below @p base, sorted by number.
+    uint_t low_len;        ///< Entries in @p low, including tombstones.
+    uint_t low_cap;        ///< Number of entries allocated in @p low.
+    uint_t low_cnt;        ///< Number of live streams in @p low.
+};
+
+
+struct strm_tbl {
+    struct strm_arr a[4]; ///< One array per stream type.
+};
+
+
+extern struct strm_low * __attribute__((nonnull))
+strm_low_find(const struct strm_arr * const a, const uint_t n);
+
+
+static inline struct q_stream * __attribute__((nonnull, no_instrument_function))
+strm_tbl_get(const struct strm_tbl * const t, const dint_t id)
+{
+    const struct strm_arr * const a = &t->a[id & 3];
+    const uint_t n = (uint_t)id >> 2;
+    const uint_t i = n - a->base;
+    // numbers below base wrap around and hence also fail this check
+    if (likely(i < a->len))
+        return a->s[i];
+
+    const struct strm_low * const l =
+        unlikely(a->low_cnt) && n < a->base ? strm_low_find(a, n) : 0;
+    return l ? l->s : 0;
+}
+
+
+static inline uint_t __attribute__((nonnull, no_instrument_function))
+strm_tbl_cnt(const struct strm_tbl * const t)
+{
+    return t->a[0].cnt + t->a[1].cnt + t->a[2].cnt + t->a[3].cnt;
+}
+
+
+/// Iterate over all streams in @p t, by type and then in stream-ID order.
+/// @p code may free the current stream, but must not insert new ones or
+/// use "break".
+///
+#define strm_tbl_foreach(t, strm, code)                                        \
+    for (uint_t _typ = 0; _typ < 4; _typ++)                                    \
+        for (uint_t _i = 0; _i < (t)->a[_typ].low_len + (t)->a[_typ].len;     \
+             _i++)                                                             \
+            if (((strm) = _i < (t)->a[_typ].low_len                            \
+                              ? (t)->a[_typ].low[_i].s                         \
+                              : (t)->a[_typ].s[_i - (t)->a[_typ].low_len]) !=  \
+                0) {                                                           \
+                code;                                                          \
+            }
+
+
+extern void __attribute__((nonnull))
+strm_tbl_put(struct strm_tbl * const t, struct q_stream * const s);
+
+extern void __attribute__((nonnull))
+strm_tbl_del(struct strm_tbl * const t, const dint_t id);
+
+extern void __attribute__((nonnull)) strm_tbl_free(struct strm_tbl * const t);
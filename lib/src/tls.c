@@ -199,7 +199,9 @@ SPLAY_GENERATE(tickets_by_peer, tls_ticket, node, tls_ticket_cmp)
 // first entry is client default, if not otherwise specified
 static const ptls_iovec_t alpn[] = {
     {(uint8_t[ALPN_LEN]){"hq-" DRAFT_VERSION_STRING}, 5},
-    {(uint8_t[ALPN_LEN]){"hq-interop"}, 10}};
+    {(uint8_t[ALPN_LEN]){"hq-interop"}, 10},
+    {(uint8_t[ALPN_LEN]){"h3-" DRAFT_VERSION_STRING}, 5},
+    {(uint8_t[ALPN_LEN]){"h3"}, 2}};
 static const size_t alpn_cnt = sizeof(alpn) / sizeof(alpn[0]);
 
 
@@ -224,7 +226,9 @@ static const size_t alpn_cnt = sizeof(alpn) / sizeof(alpn[0]);
 #define TP_SCID_R 0x10  ///< retry_source_connection_id
 #define TP_MAX (TP_SCID_R + 1)
 
+#define TP_MDFS 0x20  // max_datagram_frame_size (RFC 9221)
 #define TP_QBG 0x2ab2 // grease_quic_bit
+#define TP_FEC 0xfec0 // quant-private FEC extension
 #define TP_QR 3127
 
 
@@ -277,9 +281,8 @@ static int setup_cipher(ptls_cipher_context_t ** hp_ctx,
             goto Exit;
         }
     }
-    ensure(aead_ctx, "aead_ctx is zero");
-    if ((*aead_ctx = ptls_aead_new(aead, hash, is_enc, secret,
-                                   AEAD_BASE_LABEL)) == NULL) {
+    if (aead_ctx && (*aead_ctx = ptls_aead_new(aead, hash, is_enc, secret,
+                                               AEAD_BASE_LABEL)) == NULL) {
         ret = PTLS_ERROR_NO_MEMORY;
         goto Exit;
     }
@@ -297,7 +300,7 @@ static int setup_cipher(ptls_cipher_context_t ** hp_ctx,
     ret = 0;
 Exit:
     if (ret != 0) {
-        if (*aead_ctx != NULL) {
+        if (aead_ctx && *aead_ctx != NULL) {
             ptls_aead_free(*aead_ctx);
             *aead_ctx = NULL;
         }
@@ -518,6 +521,22 @@ static int chk_tp(ptls_t * tls __attribute__((unused)),
                 c->tp_peer.grease_quic_bit = true;
                 break;
 
+            case TP_FEC:
+                warn(INF, "\t" BLD YEL "quant_fec" NRM " = true");
+                c->tp_peer.fec = true;
+                break;
+
+            case TP_MDFS:;
+                uint64_t mdfs = 0;
+                const uint8_t * mdfs_pos = pos;
+                dec_chk(v, &mdfs, &mdfs_pos,
+                        unknown_len < (uint64_t)(end - pos) ? pos + unknown_len
+                                                            : end);
+                c->tp_peer.max_dgram_frm = (uint_t)mdfs;
+                warn(INF, "\tmax_datagram_frame_size = %" PRIu " [bytes]",
+                     c->tp_peer.max_dgram_frm);
+                break;
+
             case TP_QR:
                 warn(INF,
                      "\t" BLD YEL "quantum_ready" NRM " w/len %" PRIu ") = %s",
@@ -790,7 +809,7 @@ static int chk_tp(ptls_t * tls __attribute__((unused)),
 
     // apply these parameter to all current non-crypto streams
     struct q_stream * s;
-    kh_foreach_value(&c->strms_by_id, s, apply_stream_limits(s));
+    strm_tbl_foreach(&c->strms, s, apply_stream_limits(s));
 
     return 0;
 }
@@ -853,7 +872,8 @@ void init_tp(struct q_conn * const c)
                            TP_IMD,    TP_IMSD_BL,  TP_IMSD_BR, TP_IMSD_U,
                            TP_IMSB,   TP_IMSU,     TP_ADE,     TP_MAD,
                            TP_DMIG,   TP_PRFA,     TP_ACIL,    TP_SCID_I,
-                           TP_SCID_R, grease_type, TP_QR,      TP_QBG};
+                           TP_SCID_R, grease_type, TP_QR,      TP_QBG,
+                           TP_MDFS,   TP_FEC};
     const size_t tp_cnt = sizeof(tp_order) / sizeof(tp_order[0]);
 
     // modern version of Fisher-Yates
@@ -1091,6 +1111,21 @@ void init_tp(struct q_conn * const c)
                          TP_QR, MIN_INI_LEN,
                          hex2str(ped(c->w)->scratch, MIN_INI_LEN,
                                  (char[16]){""}, 16));
+#endif
+                }
+            } else if (tp_order[j] == TP_MDFS) {
+                if (c->tp_mine.max_dgram_frm) {
+                    enc_tp(&pos, end, TP_MDFS, c->tp_mine.max_dgram_frm);
+#ifdef DEBUG_EXTRA
+                    warn(INF, "\tmax_datagram_frame_size = %" PRIu " [bytes]",
+                         c->tp_mine.max_dgram_frm);
+#endif
+                }
+            } else if (tp_order[j] == TP_FEC) {
+                if (c->tp_mine.fec) {
+                    enc_tp_empty(&pos, end, TP_FEC);
+#ifdef DEBUG_EXTRA
+                    warn(WRN, "\t" BLD YEL "quant_fec" NRM " = true");
 #endif
                 }
             } else if (tp_order[j] == TP_QBG) {
@@ -1409,6 +1444,9 @@ void free_tls(struct q_conn * const c, const bool keep_alpn)
     if (c->tls.t)
         ptls_free(c->tls.t);
     ptls_clear_memory(c->tls.secret, sizeof(c->tls.secret));
+#ifndef NO_MIGRATION
+    ptls_clear_memory(c->tls.hp_secret, sizeof(c->tls.hp_secret));
+#endif
     free_prot(c);
     if (keep_alpn == false) {
         if (c->tls.alpn.base != alpn[0].base)
@@ -1437,6 +1475,12 @@ int tls_io(struct q_stream * const s, struct w_iov * const iv)
     size_t epoch_off[5] = {0};
     ptls_buffer_t tls_io;
 
+#ifndef NO_MIGRATION
+    if (unlikely(c->tls.t == 0))
+        // imported conns have no TLS session to feed post-handshake msgs to
+        return 0;
+#endif
+
     unpoison_scratch(ped(c->w)->scratch, ped(c->w)->scratch_len);
     ptls_buffer_init(&tls_io, ped(c->w)->scratch, ped(c->w)->scratch_len);
 
@@ -1682,7 +1726,12 @@ static int update_traffic_key_cb(ptls_update_traffic_key_t * const self
         break;
 
     case ep_data:
+        c->tls.cs = cipher;
         memcpy(c->tls.secret[is_enc], secret, cipher->hash->digest_size);
+#ifndef NO_MIGRATION
+        // the HP key is never updated, keep its secret around for exports
+        memcpy(c->tls.hp_secret[is_enc], secret, cipher->hash->digest_size);
+#endif
         ctx = is_enc ? &pn->data.out_1rtt[pn->data.out_kyph]
                      : &pn->data.in_1rtt[pn->data.in_kyph];
         break;
@@ -1893,6 +1942,15 @@ done_verify_certs:;
     ped->rid_ctx =
         ptls_aead_new(cs->aead, cs->hash, 1, retry_secret, AEAD_BASE_LABEL);
     ensure(ped->rid_ctx, "could not make rit ctx");
+
+    // SRTs derived from a static key remain valid across restarts
+    if (conf && conf->srt_key)
+        ptls_calc_hash(cs->hash, ped->srt_key, conf->srt_key,
+                       strlen(conf->srt_key));
+    else {
+        warn(DBG, "no srt key given, SRTs will not survive a restart");
+        rand_bytes(ped->srt_key, sizeof(ped->srt_key));
+    }
 }
 
 
@@ -1903,6 +1961,7 @@ void free_tls_ctx(struct per_engine_data * const ped)
     dispose_cipher(&ped->enc_tick_tok);
 #endif
     ptls_aead_free(ped->rid_ctx);
+    ptls_clear_memory(ped->srt_key, sizeof(ped->srt_key));
 
 #if !defined(PARTICLE) && !defined(RIOT_VERSION)
     // free ticket cache
@@ -1990,8 +2049,26 @@ uint16_t enc_aead(const struct w_iov * const v,
         .input = &xv->buf[pkt_nr_pos + MAX_PKT_NR_LEN]};
 
     const uint16_t plen = v->len - hdr_len + AEAD_LEN;
-    ptls_aead_encrypt_s(ctx->aead, &xv->buf[hdr_len], &v->buf[hdr_len],
-                        plen - AEAD_LEN, m->hdr.nr, v->buf, hdr_len, &supp);
+    if (likely(m->strm_data_ref == 0))
+        ptls_aead_encrypt_s(ctx->aead, &xv->buf[hdr_len], &v->buf[hdr_len],
+                            plen - AEAD_LEN, m->hdr.nr, v->buf, hdr_len, &supp);
+    else {
+        // gather the stream data from the app memory q_write_iov() was given
+        const uint16_t sde = m->strm_data_pos + m->strm_data_len;
+        ptls_iovec_t in[] = {
+            ptls_iovec_init(&v->buf[hdr_len], m->strm_data_pos - hdr_len),
+            ptls_iovec_init(m->strm_data_ref, m->strm_data_len),
+            ptls_iovec_init(&v->buf[sde], v->len - sde)};
+        ptls_aead_encrypt_v(ctx->aead, &xv->buf[hdr_len], in,
+                            sizeof(in) / sizeof(in[0]), m->hdr.nr, v->buf,
+                            hdr_len);
+
+        // the vectored variant doesn't compute the HP mask, so do it here
+        ptls_cipher_init(supp.ctx, supp.input);
+        memset(supp.output, 0, sizeof(supp.output));
+        ptls_cipher_encrypt(supp.ctx, supp.output, supp.output,
+                            sizeof(supp.output));
+    }
     xv->len = v->len + AEAD_LEN;
 
     // apply packet protection
@@ -2069,6 +2146,20 @@ bool verify_rtry_tok(struct q_conn * const c,
 #endif
 
 
+void mk_srt(const struct w_engine * const w,
+            const struct cid * const id,
+            uint8_t * const srt)
+{
+    // SRT = HMAC(srt_key, cid), truncated
+    const ptls_cipher_suite_t * const cs = &aes128gcmsha256;
+    uint8_t out[PTLS_MAX_DIGEST_SIZE];
+    ptls_hkdf_extract(cs->hash, out,
+                      ptls_iovec_init(ped(w)->srt_key, sizeof(ped(w)->srt_key)),
+                      ptls_iovec_init(id->id, id->len));
+    memcpy(srt, out, SRT_LEN);
+}
+
+
 void mk_rit(const struct q_conn * const c,
             const struct cid * const odcid,
             const uint8_t flags,
@@ -2143,10 +2234,38 @@ void maybe_flip_keys(struct q_conn * const c, const bool out)
     if (pnd->out_kyph != pnd->in_kyph)
         return;
 
-    const ptls_cipher_suite_t * const cs = ptls_get_cipher(c->tls.t);
+    const ptls_cipher_suite_t * const cs = c->tls.cs;
     if (likely(cs)) {
         flip_keys(c, out, cs);
         c->do_key_flip = false;
     } else
         warn(ERR, "cannot obtain cipher suite");
 }
+
+
+#ifndef NO_MIGRATION
+bool import_keys(struct q_conn * const c, const uint16_t cs_id)
+{
+    ptls_cipher_suite_t ** cs = ped(c->w)->tls_ctx.cipher_suites;
+    while (*cs && (*cs)->id != cs_id)
+        cs++;
+    if (unlikely(*cs == 0)) {
+        warn(ERR, "cipher suite 0x%04x not enabled", cs_id);
+        return false;
+    }
+
+    struct pn_data * const pnd = &c->pns[pn_data].data;
+    for (int is_enc = 0; is_enc <= 1; is_enc++) {
+        struct cipher_ctx * const ctx = is_enc ? pnd->out_1rtt : pnd->in_1rtt;
+        const bool kyph = is_enc ? pnd->out_kyph : pnd->in_kyph;
+        // HP always uses slot zero and the key derived from the first secret
+        if (setup_cipher(&ctx[0].header_protection, 0, (*cs)->aead,
+                         (*cs)->hash, is_enc, c->tls.hp_secret[is_enc]) ||
+            setup_cipher(0, &ctx[kyph].aead, (*cs)->aead, (*cs)->hash, is_enc,
+                         c->tls.secret[is_enc]))
+            return false;
+    }
+    c->tls.cs = *cs;
+    return true;
+}
+#endif
@@ -87,6 +87,10 @@ struct tls {
     ptls_t * t;
     ptls_iovec_t alpn;
     uint8_t secret[2][PTLS_MAX_DIGEST_SIZE];
+#ifndef NO_MIGRATION
+    uint8_t hp_secret[2][PTLS_MAX_DIGEST_SIZE]; ///< First 1-RTT secrets.
+#endif
+    ptls_cipher_suite_t * cs; ///< Cipher suite of the 1-RTT keys.
     ptls_raw_extension_t tp_ext[2];
     ptls_handshake_properties_t tls_hshk_prop;
     size_t max_early_data;
@@ -137,6 +141,11 @@ extern bool __attribute__((nonnull)) verify_rtry_tok(struct q_conn * const c,
                                                      const uint16_t tok_len);
 #endif
 
+extern void __attribute__((nonnull))
+mk_srt(const struct w_engine * const w,
+       const struct cid * const id,
+       uint8_t * const srt);
+
 extern void __attribute__((nonnull)) mk_rit(const struct q_conn * const c,
                                             const struct cid * const odcid,
                                             const uint8_t flags,
@@ -155,3 +164,8 @@ extern void __attribute__((nonnull))
 maybe_flip_keys(struct q_conn * const c, const bool out);
 
 extern void __attribute__((nonnull)) dispose_cipher(struct cipher_ctx * ctx);
+
+#ifndef NO_MIGRATION
+extern bool __attribute__((nonnull))
+import_keys(struct q_conn * const c, const uint16_t cs_id);
+#endif
@@ -48,6 +48,7 @@ QUANT_SRC+=\
 	lib/src/cid.c \
 	lib/src/conn.c \
 	lib/src/diet.c \
+	lib/src/fec.c \
 	lib/src/frame.c \
 	lib/src/loop.c \
 	lib/src/marshall.c \
@@ -56,6 +57,7 @@ QUANT_SRC+=\
 	lib/src/quic.c \
 	lib/src/recovery.c \
 	lib/src/stream.c \
+	lib/src/strm_tbl.c \
 	lib/src/tls.c \
 	test/minimal_transaction.c \
 	quant/config.c
@@ -68,7 +70,7 @@ EXTRA_CFLAGS+=${BUILD_FLAGS}
 else
 EXTRA_CFLAGS+=-DMINIMAL_CIPHERS -DNO_QINFO -DNO_SERVER \
 	-DNO_ERR_REASONS -DNO_OOO_0RTT \
-	-DNO_MIGRATION -DNO_SRT_MATCHING
+	-DNO_MIGRATION -DNO_SRT_MATCHING -DNO_ASYNC
 endif
 
 # -DDSTACK -finstrument-functions -DNDEBUG -DRELEASE_BUILD
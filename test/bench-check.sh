@@ -0,0 +1,119 @@
+#! /usr/bin/env bash
+
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Copyright (c) 2016-2022, NetApp, Inc.
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright notice,
+#    this list of conditions and the following disclaimer in the documentation
+#    and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+
+# Run the google benchmark binaries given as arguments with JSON output, store
+# the results per commit under the results directory and compare them against
+# a baseline. Exits non-zero if any benchmark got slower by more than the
+# threshold.
+#
+# Environment:
+#   BENCH_RESULTS    directory for per-commit results (default: ./bench-results)
+#   BENCH_BASELINE   baseline directory (default: $BENCH_RESULTS/baseline)
+#   BENCH_THRESHOLD  max. allowed slowdown in percent (default: 10)
+#   BENCH_ARGS       extra args for the benchmarks (e.g. repetitions)
+#   BENCH_SRC        source tree to derive the commit ID from (default: .)
+#   BENCH_UPDATE     if set, (re)write the baseline from this run
+
+set -e
+
+if [ $# -eq 0 ]; then
+    echo "usage: $0 bench-binary..."
+    exit 1
+fi
+
+if ! command -v jq > /dev/null; then
+    echo "jq not found"
+    exit 1
+fi
+
+results=${BENCH_RESULTS:-bench-results}
+baseline=${BENCH_BASELINE:-$results/baseline}
+threshold=${BENCH_THRESHOLD:-10}
+src=${BENCH_SRC:-.}
+
+commit=$(git -C "$src" rev-parse --short HEAD 2> /dev/null || echo unknown)
+if [ "$commit" != unknown ] && \
+   ! git -C "$src" diff --quiet HEAD -- 2> /dev/null; then
+    commit=$commit-dirty
+fi
+
+out=$results/$commit
+mkdir -p "$out"
+
+for b in "$@"; do
+    name=$(basename "$b")
+    echo "running $name"
+    # shellcheck disable=SC2086
+    "$b" --benchmark_out="$out/$name.json" --benchmark_out_format=json \
+        $BENCH_ARGS > /dev/null
+done
+
+if [ -n "$BENCH_UPDATE" ] || [ ! -d "$baseline" ]; then
+    mkdir -p "$baseline"
+    cp "$out"/*.json "$baseline"
+    echo "baseline in $baseline set from $commit"
+    exit 0
+fi
+
+# map benchmark name -> mean cpu_time over all (repeated) iteration runs
+times='def times: [.benchmarks[] |
+            select((.run_type // "iteration") == "iteration") |
+            {name: (.run_name // .name), t: .cpu_time}] |
+        group_by(.name) |
+        map({key: .[0].name, value: (map(.t) | add / length)}) |
+        from_entries;'
+
+ret=0
+for cur in "$out"/*.json; do
+    base=$baseline/$(basename "$cur")
+    if [ ! -s "$base" ]; then
+        echo "no baseline for $(basename "$cur" .json), skipping"
+        continue
+    fi
+
+    while IFS=$'\t' read -r name old new pct; do
+        if awk -v p="$pct" -v t="$threshold" 'BEGIN { exit !(p > t) }'; then
+            res=REGRESSION
+            ret=1
+        else
+            res=ok
+        fi
+        printf "%-48s %14.2f %14.2f %+8.2f%% %s\n" \
+            "$name" "$old" "$new" "$pct" "$res"
+    done < <(jq -rn --slurpfile b "$base" --slurpfile c "$cur" "$times"'
+                ($b[0] | times) as $bt | $c[0] | times | to_entries[] |
+                select($bt[.key] != null and $bt[.key] > 0) |
+                [.key, $bt[.key], .value, ((.value / $bt[.key] - 1) * 100)] |
+                @tsv')
+done
+
+if [ $ret -ne 0 ]; then
+    echo "performance regressed by more than $threshold% against $baseline"
+fi
+exit $ret
@@ -0,0 +1,57 @@
+#! /usr/bin/env bash
+
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Copyright (c) 2016-2022, NetApp, Inc.
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright notice,
+#    this list of conditions and the following disclaimer in the documentation
+#    and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+
+# Compare HTTP/3 and HTTP/0.9 ("hq") throughput of the example client and server
+# over loopback. Run from the build directory, i.e., where bin/client and
+# bin/server live and test/dummy.{crt,key} are reachable.
+#
+# Environment:
+#   BENCH_PORT  UDP port for the server (default: 4434)
+#   BENCH_SIZE  size of the synthetic object to fetch (default: 50000000)
+#   BENCH_REPS  number of fetches per protocol (default: 10)
+
+set -e
+
+port=${BENCH_PORT:-4434}
+size=${BENCH_SIZE:-50000000}
+reps=${BENCH_REPS:-10}
+
+bin/server -i lo -p "$port" -d . -t 0 -v 0 > /dev/null 2>&1 &
+server=$!
+trap 'kill $server 2> /dev/null' EXIT
+sleep 1
+
+for proto in hq h3; do
+    opts="-i lo -s /dev/null -v 0 -r $reps"
+    [ $proto = h3 ] && opts="$opts -3"
+    echo -n "$proto: "
+    # shellcheck disable=SC2086
+    bin/client $opts "https://localhost:$port/$size" 2> /dev/null | \
+        grep TOTAL
+done
@@ -130,8 +130,9 @@ BENCHMARK(BM_conn)->RangeMultiplier(2)->Range(1024, 1024 * 1024 * 32)
 
 // BENCHMARK_MAIN()
 
-int main(int argc __attribute__((unused)), char ** argv)
+int main(int argc, char ** argv)
 {
+    benchmark::Initialize(&argc, argv);
 #ifndef NDEBUG
     util_dlevel = WRN; // default to maximum compiled-in verbosity
 #endif
@@ -0,0 +1,159 @@
+// Copyright (c) 2014-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <arpa/inet.h>
+#include <cinttypes>
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+#include <quant/quant.hpp>
+
+
+// same as bench_conn.cc, but written against the C++ wrappers, which should
+// not cost anything over the plain C API
+
+
+static struct w_engine * w;
+static quant::conn *cc, *sc;
+
+
+static inline uint64_t io(const uint64_t len)
+{
+    // reserve a new stream
+    quant::stream cs = cc->reserve();
+    if (unlikely(!cs))
+        return 0;
+
+    // allocate buffers to transmit a packet
+    quant::chain o = cc->alloc(w, len);
+
+    // send the data
+    cs.write(o, true);
+
+    // read the data
+    while (true) {
+        struct q_conn * ready;
+        q_ready(w, 0, &ready);
+
+        if (ready == sc->get()) {
+            quant::chain i;
+            quant::stream ss(sc->read(i, true));
+            if (!ss)
+                continue;
+            if (!ss.peer_closed())
+                ss.release();
+            const uint64_t ilen = i.len();
+            ensure(ilen == len, "mismatch %" PRIu64 " %" PRIu64, len, ilen);
+            break;
+        }
+    }
+
+    o = cs.written();
+
+#ifndef NO_QINFO
+    struct q_conn_info cci = {0};
+    struct q_conn_info sci = {0};
+    q_info(cc->get(), &cci);
+    q_info(sc->get(), &sci);
+#endif
+
+    return len;
+}
+
+
+static void BM_conn_hpp(benchmark::State & state)
+{
+    const auto len = static_cast<uint64_t>(state.range(0));
+    for (auto _ : state) {
+        const uint64_t ilen = io(len);
+        if (ilen != len) {
+            state.SkipWithError("error");
+            return;
+        }
+    }
+    state.SetBytesProcessed(
+        static_cast<int64_t>(static_cast<uint64_t>(state.iterations()) * len));
+}
+
+
+BENCHMARK(BM_conn_hpp)->RangeMultiplier(2)->Range(1024, 1024 * 1024 * 32);
+
+
+int main(int argc, char ** argv)
+{
+    benchmark::Initialize(&argc, argv);
+#ifndef NDEBUG
+    util_dlevel = WRN; // default to maximum compiled-in verbosity
+#endif
+
+    // init
+    const int cwd = open(".", O_CLOEXEC);
+    ensure(cwd != -1, "cannot open");
+    ensure(chdir(dirname(argv[0])) == 0, "cannot chdir");
+    const struct q_conf conf = {nullptr,     nullptr, "dummy.crt",
+                                "dummy.key", nullptr, "dummy.ca.crt",
+                                nullptr,     1000000};
+    w = q_init("lo"
+#ifndef __linux__
+               "0"
+#endif
+               ,
+               &conf);
+    ensure(fchdir(cwd) == 0, "cannot fchdir");
+
+    // bind server socket
+    q_bind(w, 0, 55560);
+
+    // connect to server
+    struct sockaddr_in6 sip = {};
+    sip.sin6_family = AF_INET6;
+    sip.sin6_port = bswap16(55560);
+    inet_pton(sip.sin6_family, "::1", &sip.sin6_addr);
+    quant::conn c(q_connect(w,
+                            reinterpret_cast<struct sockaddr *>(&sip), // NOLINT
+                            "localhost", nullptr, nullptr, true, nullptr,
+                            nullptr));
+    ensure(c, "is zero");
+
+    // accept connection
+    struct q_conn * accepted;
+    q_ready(w, 0, &accepted);
+    quant::conn s(accepted);
+    ensure(s, "is zero");
+
+    cc = &c;
+    sc = &s;
+    benchmark::RunSpecifiedBenchmarks();
+
+    // close connections before the engine goes away
+    c.reset();
+    s.reset();
+    q_cleanup(w);
+}
@@ -66,7 +66,7 @@ again:
         free_iov(v, m);
 
     struct q_stream * s;
-    kh_foreach_value(&c->strms_by_id, s, { free_stream(s); });
+    strm_tbl_foreach(&c->strms, s, { free_stream(s); });
 
     for (epoch_t e = ep_init; e <= ep_data; e++)
         if (c->cstrms[e])
@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef NDEBUG
+#include <stdlib.h>
+#include <sys/param.h>
+#endif
+
+#include <quant/quant.h>
+
+#include "test_util.h"
+
+
+#define DATA_LEN (64 * 1024)
+
+
+static uint8_t data[DATA_LEN];
+static atomic_int done = 0;
+
+
+static void cb(void * const arg, const bool ok)
+{
+    ensure(ok, "async write failed");
+    atomic_fetch_add((atomic_int *)arg, 1);
+}
+
+
+static void * __attribute__((nonnull)) worker(void * const arg)
+{
+    // write half the data in two chunks from this thread
+    struct q_stream * const cs = arg;
+    ensure(q_write_async(cs, data, DATA_LEN / 2, false, cb, &done),
+           "q_write_async failed");
+    ensure(q_write_async(cs, &data[DATA_LEN / 2], DATA_LEN / 2, true, cb,
+                         &done),
+           "q_write_async failed");
+    return 0;
+}
+
+
+int main(int argc
+#ifdef NDEBUG
+         __attribute__((unused))
+#endif
+         ,
+         char * argv[])
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+    int ch;
+    while ((ch = getopt(argc, argv, "v:")) != -1)
+        if (ch == 'v')
+            util_dlevel = MIN(DLEVEL, MAX(0, (short)strtoul(optarg, 0, 10)));
+#endif
+
+    // init
+    struct w_engine * const w = test_init(argv[0], 0, true);
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)i;
+
+    // connect a client to a server
+    struct q_conn * cc;
+    struct q_conn * sc;
+    test_conn_pair(w, 55559, &cc, &sc);
+
+    // the engine thread sits in q_ready() below while the worker writes, so
+    // the data only gets sent if the worker's wakeups reach the event loop
+    struct q_stream * const cs = q_rsv_stream(cc, true);
+    pthread_t t;
+    ensure(pthread_create(&t, 0, worker, cs) == 0, "pthread_create");
+
+    struct w_iov_sq i = w_iov_sq_initializer(i);
+    struct q_stream * ss = 0;
+    while (ss == 0) {
+        struct q_conn * c;
+        do
+            q_ready(w, 0, &c);
+        while (c != sc);
+        ss = q_read(sc, &i, true);
+    }
+    pthread_join(t, 0);
+
+    ensure(atomic_load(&done) == 2, "callbacks ran %d times",
+           atomic_load(&done));
+    ensure(w_iov_sq_len(&i) == DATA_LEN, "len %" PRIu " != %u",
+           w_iov_sq_len(&i), DATA_LEN);
+    uint_t pos = 0;
+    struct w_iov * v;
+    sq_foreach (v, &i, next) {
+        ensure(memcmp(v->buf, &data[pos], v->len) == 0, "data mismatch");
+        pos += v->len;
+    }
+    q_free(&i);
+
+    // close connections
+    q_close_stream(ss);
+    q_close(cc, 0, 0);
+    q_close(sc, 0, 0);
+    q_cleanup(w);
+}
@@ -0,0 +1,162 @@
+// Copyright (c) 2014-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <arpa/inet.h>
+#include <cinttypes>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/param.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdlib>
+
+#include <quant/coro.hpp>
+
+
+// runs many concurrent coroutine clients against bin/server.c on one thread
+
+#define PORT "55561"
+#define OBJ_LEN 10000
+#define REQ "GET /10000\r\n" // asks for OBJ_LEN bytes
+#define NUM_BUFS 50000
+
+
+static uint32_t n_ok;
+
+
+static quant::co::task client(quant::co::loop & l,
+                              const struct sockaddr * const peer)
+{
+    quant::conn c = co_await l.connect(peer, "localhost");
+    if (!c)
+        co_return;
+
+    quant::stream s = c.reserve();
+    if (s) {
+        // the server closes the stream after sending the object
+        q_write_str(l.engine(), s.get(), REQ, sizeof(REQ) - 1, true);
+        const bool acked = co_await l.writable(c, s);
+
+        quant::chain rsp;
+        bool more = true;
+        while (more)
+            more = co_await l.read(c, s, rsp);
+        if (acked && rsp.len() == OBJ_LEN)
+            n_ok++;
+        s.reset();
+    }
+
+    co_await l.close(c);
+}
+
+
+int main(int argc, char * argv[])
+{
+    uint32_t n = 2000;
+#ifndef NDEBUG
+    util_dlevel = ERR;
+#endif
+    int ch;
+    while ((ch = getopt(argc, argv, "n:v:")) != -1)
+        if (ch == 'n')
+            n = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+#ifndef NDEBUG
+        else if (ch == 'v')
+            util_dlevel = static_cast<short>(
+                MIN(DLEVEL, strtoul(optarg, nullptr, 10)));
+#endif
+    ensure(optind < argc, "usage: %s [-n clients] [-v level] server", argv[0]);
+    const char * const srv = argv[optind];
+
+    // every client conn has its own socket, so raise the fd limit
+    struct rlimit rl;
+    ensure(getrlimit(RLIMIT_NOFILE, &rl) == 0, "getrlimit");
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    ensure(getrlimit(RLIMIT_NOFILE, &rl) == 0, "getrlimit");
+    if (rl.rlim_cur != RLIM_INFINITY && n > rl.rlim_cur - 64) {
+        n = static_cast<uint32_t>(rl.rlim_cur - 64);
+        warn(WRN, "fd limit only allows %" PRIu32 " clients", n);
+    }
+
+    const int cwd = open(".", O_CLOEXEC);
+    ensure(cwd != -1, "cannot open");
+    ensure(chdir(dirname(argv[0])) == 0, "cannot chdir");
+
+    // start the server
+    const pid_t pid = fork();
+    ensure(pid != -1, "fork");
+    if (pid == 0) {
+        execl(srv, srv, "-i",
+              "lo"
+#ifndef __linux__
+              "0"
+#endif
+              ,
+              "-p", PORT, "-c", "dummy.crt", "-k", "dummy.key", "-d", ".",
+              "-v", "1", nullptr);
+        die("cannot exec %s", srv);
+    }
+
+    const struct q_conf conf = {nullptr, nullptr,        nullptr, nullptr,
+                                nullptr, "dummy.ca.crt", nullptr, NUM_BUFS};
+    struct w_engine * const w = q_init("lo"
+#ifndef __linux__
+                                       "0"
+#endif
+                                       ,
+                                       &conf);
+    ensure(fchdir(cwd) == 0, "cannot fchdir");
+
+    // give the server a moment to bind, to not start with a PTO
+    usleep(250000);
+
+    struct sockaddr_in6 sip = {};
+    sip.sin6_family = AF_INET6;
+    sip.sin6_port = bswap16(static_cast<uint16_t>(strtoul(PORT, nullptr, 10)));
+    inet_pton(sip.sin6_family, "::1", &sip.sin6_addr);
+    const auto peer = reinterpret_cast<struct sockaddr *>(&sip); // NOLINT
+
+    quant::co::loop l(w);
+    for (uint32_t i = 0; i < n; i++)
+        client(l, peer);
+    l.run();
+
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    q_cleanup(w);
+
+    warn(NTE, "%" PRIu32 " of %" PRIu32 " clients succeeded", n_ok, n);
+    ensure(n_ok == n, "only %" PRIu32 " of %" PRIu32 " clients succeeded",
+           n_ok, n);
+    return 0;
+}
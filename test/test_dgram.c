@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef NDEBUG
+#include <stdlib.h>
+#include <sys/param.h>
+#endif
+
+#include <quant/quant.h>
+
+#include "test_util.h"
+
+
+#define DGRAM_CNT 3
+#define DGRAM_LEN 512
+
+
+static void fill_dgrams(struct w_engine * const w,
+                        struct q_conn * const c,
+                        struct w_iov_sq * const q,
+                        const char first)
+{
+    // each w_iov in the queue becomes one DATAGRAM
+    for (char fill = first; fill < first + DGRAM_CNT; fill++) {
+        struct w_iov_sq d = w_iov_sq_initializer(d);
+        q_alloc(w, &d, c, AF_INET6, DGRAM_LEN);
+        ensure(w_iov_sq_cnt(&d) == 1, "DATAGRAM split over bufs");
+        memset(sq_first(&d)->buf, fill, DGRAM_LEN);
+        sq_concat(q, &d);
+    }
+}
+
+
+static void read_dgrams(struct q_conn * const c, struct w_iov_sq * const q)
+{
+    while (w_iov_sq_cnt(q) < DGRAM_CNT)
+        ensure(q_read_dgram(c, q, true), "no DATAGRAM");
+}
+
+
+int main(int argc
+#ifdef NDEBUG
+         __attribute__((unused))
+#endif
+         ,
+         char * argv[])
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+    int ch;
+    while ((ch = getopt(argc, argv, "v:")) != -1)
+        if (ch == 'v')
+            util_dlevel = MIN(DLEVEL, MAX(0, (short)strtoul(optarg, 0, 10)));
+#endif
+
+    // init
+    __extension__ const struct q_conn_conf cc_conf = {
+        .max_datagram_frame_size = 1200};
+    struct w_engine * const w = test_init(argv[0], &cc_conf, false);
+
+    // connect a client to a server
+    struct q_conn * cc;
+    struct q_conn * sc;
+    test_conn_pair(w, 55556, &cc, &sc);
+
+    // a DATAGRAM larger than the negotiated limit must be refused
+    struct w_iov_sq o = w_iov_sq_initializer(o);
+    q_alloc(w, &o, cc, AF_INET6, 1);
+    sq_first(&o)->len = 1200;
+    ensure(q_write_dgram(cc, &o) == false, "oversized DATAGRAM accepted");
+    q_free(&o);
+
+    // client -> server
+    fill_dgrams(w, cc, &o, 'a');
+    ensure(q_write_dgram(cc, &o), "q_write_dgram failed");
+    ensure(sq_empty(&o), "DATAGRAMs not consumed");
+
+    struct w_iov_sq i = w_iov_sq_initializer(i);
+    read_dgrams(sc, &i);
+    char fill = 'a';
+    struct w_iov * v;
+    sq_foreach (v, &i, next) {
+        ensure(v->len == DGRAM_LEN, "len %u != %u", v->len, DGRAM_LEN);
+        for (uint16_t j = 0; j < v->len; j++)
+            ensure(v->buf[j] == fill, "data mismatch");
+        fill++;
+    }
+    q_free(&i);
+
+    // server -> client
+    fill_dgrams(w, sc, &o, 'A');
+    ensure(q_write_dgram(sc, &o), "q_write_dgram failed");
+    read_dgrams(cc, &i);
+    ensure(sq_first(&i)->buf[0] == 'A', "data mismatch");
+    q_free(&i);
+
+    // close connections
+    q_close(cc, 0, 0);
+    q_close(sc, 0, 0);
+    q_cleanup(w);
+}
@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef NDEBUG
+#include <sys/param.h>
+#endif
+
+#include <quant/quant.h>
+
+#include "test_util.h"
+
+
+#define PORT 55564
+#define HALF 65536 ///< Bytes sent before and after the export.
+
+
+static void write_half(struct w_engine * const w,
+                       struct q_conn * const c,
+                       struct q_stream * const s,
+                       const char fill,
+                       const bool fin)
+{
+    struct w_iov_sq o = w_iov_sq_initializer(o);
+    q_alloc(w, &o, c, q_conn_af(c), HALF);
+    struct w_iov * v;
+    sq_foreach (v, &o, next)
+        memset(v->buf, fill, v->len);
+    q_write(s, &o, fin);
+}
+
+
+static void wait_ready(struct w_engine * const w)
+{
+    struct q_conn * c;
+    q_ready(w, 0, &c);
+}
+
+
+static int client(const char * const prog)
+{
+    struct w_engine * const w = test_init(prog, 0, false);
+    struct sockaddr_in6 sip = {.sin6_family = AF_INET6,
+                               .sin6_port = bswap16(PORT)};
+    inet_pton(AF_INET6, "::1", &sip.sin6_addr);
+    struct q_conn * const c = q_connect(w, (const struct sockaddr *)&sip,
+                                        "localhost", 0, 0, true, 0, 0);
+    ensure(c, "is zero");
+
+    // send a request, then read the reply, which spans the server move
+    struct q_stream * const s = q_rsv_stream(c, true);
+    q_write_str(w, s, "GET", 3, true);
+
+    struct w_iov_sq i = w_iov_sq_initializer(i);
+    while (q_is_conn_closed(c) == false && q_read(c, &i, true) == 0)
+        wait_ready(w);
+
+    uint_t off = 0;
+    bool ok = w_iov_sq_len(&i) == 2 * HALF;
+    struct w_iov * v;
+    sq_foreach (v, &i, next)
+        for (uint16_t n = 0; n < v->len; n++, off++)
+            ok &= v->buf[n] == (off < HALF ? 'a' : 'b');
+
+    q_free(&i);
+    q_close(c, 0, 0);
+    q_cleanup(w);
+    return ok ? 0 : 1;
+}
+
+
+int main(int argc
+#ifdef NDEBUG
+         __attribute__((unused))
+#endif
+         ,
+         char * argv[])
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+    int ch;
+    while ((ch = getopt(argc, argv, "v:")) != -1)
+        if (ch == 'v')
+            util_dlevel = MIN(DLEVEL, MAX(0, (short)strtoul(optarg, 0, 10)));
+#endif
+
+#ifndef NO_MIGRATION
+    const pid_t pid = fork();
+    ensure(pid != -1, "fork");
+    if (pid == 0)
+        return client(argv[0]);
+
+    // accept the connection on the first engine and receive the request
+    struct w_engine * w = test_init(argv[0], 0, false);
+    q_bind(w, 0, PORT);
+    struct q_conn * c;
+    q_ready(w, 0, &c);
+    ensure(c, "is zero");
+
+    struct w_iov_sq i = w_iov_sq_initializer(i);
+    struct q_stream * s;
+    while ((s = q_read(c, &i, true)) == 0)
+        wait_ready(w);
+    q_free(&i);
+
+    // send the first half of the reply, then export once it was ACKed
+    write_half(w, c, s, 'a', false);
+    const uint_t sid = q_sid(s);
+    uint8_t buf[16384];
+    size_t len = sizeof(buf);
+    ensure(q_conn_export(c, buf, &len), "export failed");
+    q_cleanup(w);
+
+    // re-create the server on a second engine and continue the transfer
+    w = test_init(argv[0], 0, false);
+    q_bind(w, 0, PORT);
+    c = q_conn_import(w, buf, len);
+    ensure(c, "import failed");
+    s = q_sid_stream(c, sid);
+    ensure(s, "stream %" PRIu " missing after import", sid);
+    write_half(w, c, s, 'b', true);
+
+    // wait for the client to close
+    while (q_is_conn_closed(c) == false)
+        wait_ready(w);
+    q_close(c, 0, 0);
+    q_cleanup(w);
+
+    int status;
+    ensure(waitpid(pid, &status, 0) == pid, "waitpid");
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+#else
+    (void)argv;
+    return 0;
+#endif
+}
@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef NDEBUG
+#include <stdlib.h>
+#include <sys/param.h>
+#endif
+
+#include <quant/quant.h>
+
+#include "fec.h"
+#include "quic.h"
+#include "test_util.h"
+
+
+#define DATA_LEN (1024 * 1024)
+#define LOSS_PCT 3
+#define BLK_K 5  ///< Source symbols in the unit test block.
+#define BLK_LO 7 ///< Packet number of the first unit test symbol.
+
+
+// the symbols of the unit test block have different lengths, so that
+// recovery must undo the zero padding of the shorter ones
+#define sym_nr(i) (BLK_LO + (uint_t)(i))
+#define sym_sid(i) ((uint_t)(i) << 2)
+#define sym_off(i) ((uint_t)(i)*1000)
+#define sym_len(i) ((uint16_t)(100 + 37 * (i)))
+#define sym_fin(i) ((i) == BLK_K - 1)
+#define sym_byte(i, j) ((uint8_t)((i)*31 + (j)))
+
+
+static void add_sym(struct fec * const f, const uint8_t i, const bool rx)
+{
+    uint8_t data[FEC_SYM_MAX];
+    for (uint16_t j = 0; j < sym_len(i); j++)
+        data[j] = sym_byte(i, j);
+    (rx ? fec_rx_sym : fec_tx_sym)(f, sym_nr(i), sym_sid(i), sym_off(i),
+                                   sym_len(i), sym_fin(i), data);
+}
+
+
+static void check_xor(const uint8_t lost)
+{
+    static struct fec tx;
+    static struct fec rx;
+    memset(&tx, 0, sizeof(tx));
+    memset(&rx, 0, sizeof(rx));
+    tx.k = BLK_K;
+    for (uint8_t i = 0; i < FEC_RX_SYMS; i++)
+        rx.sym[i].nr = UINT_T_MAX;
+
+    // protect one block, and receive all but one of its symbols
+    for (uint8_t i = 0; i < BLK_K; i++) {
+        add_sym(&tx, i, false);
+        if (i != lost)
+            add_sym(&rx, i, true);
+    }
+    ensure(tx.rpr.cnt == BLK_K, "block not closed");
+
+    // the REPAIR must give back exactly the lost symbol
+    memcpy(&rx.rx, &tx.rpr, sizeof(rx.rx));
+    ensure(fec_recover(&rx), "sym %u not recovered", lost);
+    const struct fec_blk * const b = &rx.rx;
+    ensure(b->lo == sym_nr(lost), "nr %" PRIu, b->lo);
+    ensure(b->sid == sym_sid(lost), "sid %" PRIu, b->sid);
+    ensure(b->off == sym_off(lost), "off %" PRIu, b->off);
+    ensure((b->lf & UINT16_MAX) == sym_len(lost), "len %u", b->lf & UINT16_MAX);
+    ensure((b->lf >> 16 != 0) == sym_fin(lost), "fin %u", b->lf >> 16);
+    for (uint16_t j = 0; j < sym_len(lost); j++)
+        ensure(b->data[j] == sym_byte(lost, j), "data mismatch");
+
+    // neither a block missing two symbols, nor one with a pkt that had several
+    // STREAM frames, can be recovered
+    const uint8_t other = (uint8_t)((lost + 1) % BLK_K);
+    rx.sym[sym_nr(other) % FEC_RX_SYMS].nr = UINT_T_MAX;
+    memcpy(&rx.rx, &tx.rpr, sizeof(rx.rx));
+    ensure(fec_recover(&rx) == false, "recovered two lost syms");
+    add_sym(&rx, other, true);
+    add_sym(&rx, other, true);
+    memcpy(&rx.rx, &tx.rpr, sizeof(rx.rx));
+    ensure(fec_recover(&rx) == false, "recovered from a bad sym");
+}
+
+
+int main(int argc
+#ifdef NDEBUG
+         __attribute__((unused))
+#endif
+         ,
+         char * argv[])
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+    int ch;
+    while ((ch = getopt(argc, argv, "v:")) != -1)
+        if (ch == 'v')
+            util_dlevel = MIN(DLEVEL, MAX(0, (short)strtoul(optarg, 0, 10)));
+#endif
+
+    // XOR reconstruction of each symbol of a block
+    for (uint8_t i = 0; i < BLK_K; i++)
+        check_xor(i);
+
+    // init, with FEC on and some emulated loss in both directions
+    __extension__ const struct q_conn_conf cc_conf = {.enable_fec = true};
+    struct w_engine * const w = test_init(argv[0], &cc_conf, false);
+#ifndef NDEBUG
+    tx_loss_pct = LOSS_PCT;
+#endif
+
+    // connect a client to a server
+    struct q_conn * cc;
+    struct q_conn * sc;
+    test_conn_pair(w, 55557, &cc, &sc);
+
+    // send a known pattern
+    struct q_stream * const cs = q_rsv_stream(cc, true);
+    struct w_iov_sq o = w_iov_sq_initializer(o);
+    q_alloc(w, &o, cc, AF_INET6, DATA_LEN);
+    uint_t n = 0;
+    struct w_iov * v;
+    sq_foreach (v, &o, next)
+        for (uint16_t j = 0; j < v->len; j++)
+            v->buf[j] = (uint8_t)(n++ % 251);
+    q_write(cs, &o, true);
+
+    // read it back in full
+    struct w_iov_sq i = w_iov_sq_initializer(i);
+    struct q_stream * ss = 0;
+    while (ss == 0) {
+        struct q_conn * c;
+        do
+            q_ready(w, 0, &c);
+        while (c != sc);
+        ss = q_read(sc, &i, true);
+    }
+
+    ensure(w_iov_sq_len(&i) == DATA_LEN, "len %" PRIu " != %u",
+           w_iov_sq_len(&i), DATA_LEN);
+    n = 0;
+    sq_foreach (v, &i, next)
+        for (uint16_t j = 0; j < v->len; j++)
+            ensure(v->buf[j] == (uint8_t)(n++ % 251), "data mismatch");
+
+#ifndef NO_QINFO
+    struct q_conn_info ci;
+    q_info(sc, &ci);
+    warn(NTE, "%" PRIu " STREAM frames recovered by FEC",
+         ci.strm_frms_in_fec);
+#ifndef NDEBUG
+    ensure(ci.frm_cnt[1][0x20], "no REPAIR frames rx'ed");
+    ensure(ci.strm_frms_in_fec, "no STREAM frames recovered under loss");
+#endif
+#endif
+
+    q_close_stream(ss);
+    q_close_stream(cs);
+    q_free(&i);
+    q_free(&o);
+
+    // close connections
+    q_close(cc, 0, 0);
+    q_close(sc, 0, 0);
+    q_cleanup(w);
+}
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef NDEBUG
+#include <stdlib.h>
+#include <sys/param.h>
+#endif
+
+#include <quant/quant.h>
+
+#include "test_util.h"
+
+
+#define GEN_LEN (64 * 1024)
+
+
+static const uint8_t pat[] = "0123456789abcdef";
+
+
+static uint_t __attribute__((nonnull))
+rx(struct w_engine * const w,
+   struct q_conn * const sc,
+   const uint_t off,
+   const uint_t len,
+   const bool all)
+{
+    uint_t got = 0;
+    while (got < len) {
+        struct q_conn * c;
+        q_ready(w, 0, &c);
+        struct w_iov_sq i = w_iov_sq_initializer(i);
+        if (q_read(sc, &i, all) == 0)
+            continue;
+
+        struct w_iov * v;
+        sq_foreach (v, &i, next)
+            for (uint16_t j = 0; j < v->len; j++, got++)
+                ensure(v->buf[j] == pat[(off + got) % (sizeof(pat) - 1)] ||
+                           off + got >= GEN_LEN,
+                       "data mismatch at %" PRIu, off + got);
+        q_free(&i);
+    }
+    return got;
+}
+
+
+static void __attribute__((nonnull))
+wait_written(struct w_engine * const w, struct q_stream * const cs)
+{
+    while (q_notify_written(cs) == false) {
+        struct q_conn * c;
+        q_ready(w, 0, &c);
+    }
+}
+
+
+int main(int argc
+#ifdef NDEBUG
+         __attribute__((unused))
+#endif
+         ,
+         char * argv[])
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+    int ch;
+    while ((ch = getopt(argc, argv, "v:")) != -1)
+        if (ch == 'v')
+            util_dlevel = MIN(DLEVEL, MAX(0, (short)strtoul(optarg, 0, 10)));
+#endif
+
+    // init
+    struct w_engine * const w = test_init(argv[0], 0, false);
+
+    // connect a client to a server
+    struct q_conn * cc;
+    struct q_conn * sc;
+    test_conn_pair(w, 55566, &cc, &sc);
+
+    // generate some data, and make sure nothing else can be written meanwhile
+    struct q_stream * const cs = q_rsv_stream(cc, true);
+    ensure(q_write_gen(cs, pat, sizeof(pat) - 1, GEN_LEN, false),
+           "q_write_gen failed");
+    struct w_iov_sq o = w_iov_sq_initializer(o);
+    q_alloc(w, &o, cc, AF_INET6, 1);
+    sq_first(&o)->buf[0] = 'x';
+    ensure(q_write(cs, &o, true) == false, "q_write during q_write_gen");
+    ensure(rx(w, sc, 0, GEN_LEN, false) == GEN_LEN, "short generated data");
+
+    // once all generated data is ACK'ed, regular writes work again...
+    wait_written(w, cs);
+    struct w_iov * const ov = sq_first(&o);
+    ensure(q_write(cs, &o, true), "q_write after q_write_gen failed");
+    ensure(rx(w, sc, GEN_LEN, 1, true) == 1, "short data");
+
+    // ...and their buffers are kept for q_stream_get_written(), not freed
+    wait_written(w, cs);
+    struct w_iov_sq done = w_iov_sq_initializer(done);
+    q_stream_get_written(cs, &done);
+    ensure(w_iov_sq_cnt(&done) == 1 && sq_first(&done) == ov &&
+               ov->buf[0] == 'x',
+           "got %" PRIu " written bufs", w_iov_sq_cnt(&done));
+    q_free(&done);
+
+    // close connections
+    q_free_stream(cs);
+    q_close(cc, 0, 0);
+    q_close(sc, 0, 0);
+    q_cleanup(w);
+}
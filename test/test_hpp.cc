@@ -0,0 +1,90 @@
+// Copyright (c) 2014-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <arpa/inet.h>
+#include <cinttypes>
+
+#include <type_traits>
+
+#include <quant/quant.hpp>
+
+
+// the wrappers must be exactly as big as what they wrap
+static_assert(sizeof(quant::chain) == sizeof(struct w_iov_sq), "size");
+static_assert(sizeof(quant::stream) == sizeof(struct q_stream *), "size");
+static_assert(sizeof(quant::conn) == sizeof(struct q_conn *), "size");
+
+// they own their resource, so they must be move-only
+template <typename T> static constexpr bool move_only()
+{
+    return std::is_nothrow_move_constructible<T>::value &&
+           std::is_nothrow_move_assignable<T>::value &&
+           std::is_nothrow_destructible<T>::value &&
+           std::is_nothrow_default_constructible<T>::value &&
+           !std::is_copy_constructible<T>::value &&
+           !std::is_copy_assignable<T>::value;
+}
+
+static_assert(move_only<quant::chain>(), "chain");
+static_assert(move_only<quant::stream>(), "stream");
+static_assert(move_only<quant::conn>(), "conn");
+
+// handles can only be adopted explicitly
+static_assert(!std::is_convertible<struct q_stream *, quant::stream>::value,
+              "stream");
+static_assert(!std::is_convertible<struct q_conn *, quant::conn>::value,
+              "conn");
+
+// chains are forward ranges of w_iovs
+static_assert(
+    std::is_same<decltype(*std::declval<quant::chain &>().begin()),
+                 struct w_iov &>::value,
+    "chain");
+static_assert(std::is_same<std::iterator_traits<quant::chain::iterator>::
+                               iterator_category,
+                           std::forward_iterator_tag>::value,
+              "chain");
+
+
+int main()
+{
+    // moving empty handles must not touch the library
+    quant::chain a;
+    quant::chain b(std::move(a));
+    a = std::move(b);
+    ensure(a.empty() && b.empty(), "empty"); // NOLINT
+    ensure(a.begin() == a.end(), "empty");
+
+    quant::stream s;
+    quant::stream t(std::move(s));
+    ensure(!s && !t, "empty"); // NOLINT
+
+    quant::conn c;
+    quant::conn d(std::move(c));
+    d = std::move(c);
+    ensure(!c && !d, "empty"); // NOLINT
+
+    return 0;
+}
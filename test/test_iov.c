@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdbool.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef NDEBUG
+#include <stdlib.h>
+#include <sys/param.h>
+#endif
+
+#include <quant/quant.h>
+
+#include "test_util.h"
+
+
+#define DATA_LEN (256 * 1024)
+
+
+static uint8_t data[DATA_LEN];
+static int released = 0;
+
+
+static void cb(void * const arg, const bool ok)
+{
+    ensure(ok, "stream went away");
+    (*(int *)arg)++;
+}
+
+
+int main(int argc
+#ifdef NDEBUG
+         __attribute__((unused))
+#endif
+         ,
+         char * argv[])
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+    int ch;
+    while ((ch = getopt(argc, argv, "v:")) != -1)
+        if (ch == 'v')
+            util_dlevel = MIN(DLEVEL, MAX(0, (short)strtoul(optarg, 0, 10)));
+#endif
+
+    // init
+    struct w_engine * const w = test_init(argv[0], 0, false);
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)(i * 7);
+
+    // connect a client to a server
+    struct q_conn * cc;
+    struct q_conn * sc;
+    test_conn_pair(w, 55562, &cc, &sc);
+
+    // write straight from our memory, split oddly across packets
+    const struct iovec iov[] = {{data, 1},
+                                {&data[1], 0},
+                                {&data[1], 3000},
+                                {&data[3001], DATA_LEN - 3001}};
+    struct q_stream * const cs = q_rsv_stream(cc, true);
+    ensure(q_write_iov(cs, iov, sizeof(iov) / sizeof(iov[0]), true, cb,
+                       &released),
+           "q_write_iov failed");
+    ensure(q_write_iov(cs, iov, 1, false, 0, 0) == false,
+           "second q_write_iov succeeded");
+
+    struct w_iov_sq i = w_iov_sq_initializer(i);
+    struct q_stream * ss = 0;
+    while (ss == 0) {
+        struct q_conn * c;
+        do
+            q_ready(w, 0, &c);
+        while (c != sc);
+        ss = q_read(sc, &i, true);
+    }
+
+    ensure(w_iov_sq_len(&i) == DATA_LEN, "len %" PRIu " != %u",
+           w_iov_sq_len(&i), DATA_LEN);
+    uint_t pos = 0;
+    struct w_iov * v;
+    sq_foreach (v, &i, next) {
+        ensure(memcmp(v->buf, &data[pos], v->len) == 0, "data mismatch");
+        pos += v->len;
+    }
+    q_free(&i);
+
+    // the memory is handed back once the server has ACK'ed all of it
+    if (q_notify_written(cs) == false)
+        while (released == 0) {
+            struct q_conn * c;
+            q_ready(w, 0, &c);
+        }
+    ensure(released == 1, "released %d times", released);
+
+    // close connections
+    q_close_stream(ss);
+    q_free_stream(cs);
+    ensure(released == 1, "released again");
+    q_close(cc, 0, 0);
+    q_close(sc, 0, 0);
+    q_cleanup(w);
+}
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <quant/quant.h>
+
+#include "conn.h"
+#include "pn.h"
+#include "quic.h"
+#include "recovery.h"
+#include "test_util.h"
+
+
+#define DATA_LEN (64 * 1024)
+
+
+#ifndef NO_ECN
+static void __attribute__((nonnull))
+xfer(struct w_engine * const w,
+     struct q_conn * const cc,
+     struct q_conn * const sc)
+{
+    struct q_stream * const cs = q_rsv_stream(cc, true);
+    struct w_iov_sq o = w_iov_sq_initializer(o);
+    q_alloc(w, &o, cc, AF_INET6, DATA_LEN);
+    q_write(cs, &o, true);
+
+    struct w_iov_sq i = w_iov_sq_initializer(i);
+    struct q_stream * ss = 0;
+    while (ss == 0) {
+        struct q_conn * c;
+        do
+            q_ready(w, 0, &c);
+        while (c != sc);
+        ss = q_read(sc, &i, true);
+    }
+    ensure(w_iov_sq_len(&i) == DATA_LEN, "len %" PRIu " != %u",
+           w_iov_sq_len(&i), DATA_LEN);
+    q_free(&i);
+    q_close_stream(ss);
+    q_close_stream(cs);
+}
+
+
+static void __attribute__((nonnull))
+feedback(struct q_conn * const c,
+         const uint_t ect,
+         const uint_t ce,
+         const bool after_cut)
+{
+    // have this ACK end the CE observation window, and have it cover pkts
+    // sent before or after the last cwnd reduction
+    struct pn_space * const pn = &c->pns[pn_data];
+    c->rec.l4s_win = pn->lg_acked;
+    ecn_feedback(pn, ect, ce, c->rec.rec_start_t + (after_cut ? 1 : 0));
+}
+
+
+static uint32_t ewma(const uint32_t alpha, const uint_t ect, const uint_t ce)
+{
+    const uint32_t frac = (uint32_t)((ce << L4S_SHIFT) / (ect + ce));
+    return alpha - (alpha >> L4S_G_SHIFT) + (frac >> L4S_G_SHIFT);
+}
+#endif
+
+
+int main(int argc
+#ifdef NDEBUG
+         __attribute__((unused))
+#endif
+         ,
+         char * argv[])
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+    int ch;
+    while ((ch = getopt(argc, argv, "v:")) != -1)
+        if (ch == 'v')
+            util_dlevel = MIN(DLEVEL, MAX(0, (short)strtoul(optarg, 0, 10)));
+#endif
+
+#ifndef NO_ECN
+    // init, with L4S on
+    __extension__ const struct q_conn_conf cc_conf = {.enable_l4s = true};
+    struct w_engine * const w = test_init(argv[0], &cc_conf, false);
+
+    // connect a client to a server
+    struct q_conn * cc;
+    struct q_conn * sc;
+    test_conn_pair(w, 55565, &cc, &sc);
+
+    // the server must have seen ECT(1), unless the path bleached the marks
+    // and ACK-ECN validation turned ECN off
+    xfer(w, cc, sc);
+    if (cc->sockopt.enable_ecn) {
+        ensure(cc->rec.l4s && tx_ecn(cc) == ECN_ECT1, "not marking ECT(1)");
+        const uint_t * const rxed = sc->pns[pn_data].ecn_rxed;
+        ensure(rxed[ECN_ECT1] && rxed[ECN_ECT0] == 0,
+               "rx'ed %" PRIu " ECT(1), %" PRIu " ECT(0)", rxed[ECN_ECT1],
+               rxed[ECN_ECT0]);
+
+        // without L4S, conns mark ECT(0)
+        cc->rec.l4s = false;
+        ensure(tx_ecn(cc) == ECN_ECT0, "classic conn not marking ECT(0)");
+    } else
+        warn(WRN, "path does not pass ECN, not checking marks on the wire");
+
+    // the CE response doesn't depend on the path, so check it directly,
+    // starting from a large cwnd
+    cc->rec.l4s = true;
+    const uint_t min_wnd = (uint_t)kMinimumWindow(cc->rec.max_ups);
+    const uint_t cwnd = (uint_t)cc->rec.max_ups * 100;
+    cc->rec.cur.cwnd = cwnd;
+    cc->rec.l4s_alpha = 1 << L4S_SHIFT;
+
+    // rounds without CE let alpha decay, but leave cwnd alone
+    uint32_t alpha = cc->rec.l4s_alpha;
+    for (uint_t r = 0; r < 20; r++) {
+        feedback(cc, 100, 0, true);
+        alpha = ewma(alpha, 100, 0);
+    }
+    ensure(cc->rec.l4s_alpha == alpha, "alpha %u != %u", cc->rec.l4s_alpha,
+           alpha);
+    ensure(alpha < (1 << L4S_SHIFT) / 2, "alpha %u did not decay", alpha);
+    ensure(cc->rec.cur.cwnd == cwnd, "cwnd %" PRIu " changed w/o CE",
+           cc->rec.cur.cwnd);
+
+    // a round with 10% CE cuts cwnd by alpha / 2, i.e., by much less than half
+    feedback(cc, 90, 10, true);
+    alpha = ewma(alpha, 90, 10);
+    ensure(cc->rec.l4s_alpha == alpha, "alpha %u != %u", cc->rec.l4s_alpha,
+           alpha);
+    const uint_t cut = cwnd - ((cwnd * alpha) >> (L4S_SHIFT + 1));
+    ensure(cc->rec.cur.cwnd == cut, "cwnd %" PRIu " != %" PRIu,
+           cc->rec.cur.cwnd, cut);
+    ensure(cut > cwnd / kLossReductionDivisor, "cut %" PRIu " too deep", cut);
+
+    // CE on pkts sent before that reduction doesn't reduce cwnd again
+    feedback(cc, 90, 10, false);
+    ensure(cc->rec.cur.cwnd == cut, "cwnd %" PRIu " reduced twice",
+           cc->rec.cur.cwnd);
+
+    // persistent full CE drives alpha to one and cwnd to the minimum
+    for (uint_t r = 0; r < 200; r++)
+        feedback(cc, 0, 100, true);
+    ensure(cc->rec.l4s_alpha > (1 << L4S_SHIFT) * 9 / 10, "alpha %u",
+           cc->rec.l4s_alpha);
+    ensure(cc->rec.cur.cwnd == min_wnd, "cwnd %" PRIu " != %" PRIu,
+           cc->rec.cur.cwnd, min_wnd);
+
+    // without L4S, conns halve cwnd on any CE
+    cc->rec.l4s = false;
+    cc->rec.cur.cwnd = cwnd;
+    feedback(cc, 99, 1, true);
+    ensure(cc->rec.cur.cwnd == cwnd / kLossReductionDivisor,
+           "cwnd %" PRIu " not halved", cc->rec.cur.cwnd);
+
+    // close connections
+    q_close(cc, 0, 0);
+    q_close(sc, 0, 0);
+    q_cleanup(w);
+#else
+    (void)argv;
+#endif
+}
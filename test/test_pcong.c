@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef NDEBUG
+#include <stdlib.h>
+#include <sys/param.h>
+#else
+#include <stdio.h>
+#endif
+
+#include <quant/quant.h>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+#pragma clang diagnostic ignored "-Wdocumentation"
+#pragma clang diagnostic ignored "-Wcast-qual"
+#pragma clang diagnostic ignored "-Wundef"
+#pragma clang diagnostic ignored "-Wimplicit-function-declaration"
+#include "quic.h"
+#pragma clang diagnostic pop
+
+#include "test_util.h"
+
+
+#define DATA_LEN (64 * 1024)
+#define BLACKOUT_MS 500
+#define SKIP_RC 77 ///< Exit code ctest treats as a skipped test.
+
+
+static struct q_stream * __attribute__((nonnull))
+start_xfer(struct w_engine * const w, struct q_conn * const cc)
+{
+    struct q_stream * const cs = q_rsv_stream(cc, true);
+    struct w_iov_sq o = w_iov_sq_initializer(o);
+    q_alloc(w, &o, cc, AF_INET6, DATA_LEN);
+    q_write(cs, &o, true);
+    return cs;
+}
+
+
+static void __attribute__((nonnull))
+finish_xfer(struct w_engine * const w,
+            struct q_conn * const sc,
+            struct q_stream * const cs)
+{
+    struct w_iov_sq i = w_iov_sq_initializer(i);
+    struct q_stream * ss = 0;
+    while (ss == 0) {
+        struct q_conn * c;
+        do
+            q_ready(w, 0, &c);
+        while (c != sc);
+        ss = q_read(sc, &i, true);
+    }
+    ensure(w_iov_sq_len(&i) == DATA_LEN, "len %" PRIu " != %u",
+           w_iov_sq_len(&i), DATA_LEN);
+    q_free(&i);
+    q_close_stream(ss);
+    q_close_stream(cs);
+}
+
+
+int main(int argc
+#ifdef NDEBUG
+         __attribute__((unused))
+#endif
+         ,
+         char * argv[])
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+    int ch;
+    while ((ch = getopt(argc, argv, "v:")) != -1)
+        if (ch == 'v')
+            util_dlevel = MIN(DLEVEL, MAX(0, (short)strtoul(optarg, 0, 10)));
+#endif
+
+    // init
+    struct w_engine * const w = test_init(argv[0], 0, false);
+
+    // connect a client to a server
+    struct q_conn * cc;
+    struct q_conn * sc;
+    test_conn_pair(w, 55558, &cc, &sc);
+
+    // a clean transfer gets us RTT samples and must not look like a blackout
+    finish_xfer(w, sc, start_xfer(w, cc));
+#ifndef NO_QINFO
+    struct q_conn_info ci;
+    q_info(cc, &ci);
+    ensure(ci.pers_cong_cnt == 0, "persistent congestion without loss");
+#endif
+
+    int ret = 0;
+#ifndef NDEBUG
+    // black-hole the link for several PTOs while data is outstanding
+    tx_loss_pct = 100;
+    struct q_stream * const cs = start_xfer(w, cc);
+    q_ready(w, BLACKOUT_MS * NS_PER_MS, 0);
+    tx_loss_pct = 0;
+    finish_xfer(w, sc, cs);
+
+#ifndef NO_QINFO
+    q_info(cc, &ci);
+    ensure(ci.pers_cong_cnt, "no persistent congestion after blackout");
+    warn(NTE, "cwnd %" PRIu " after %" PRIu " PTOs", ci.cwnd, ci.pto_cnt);
+#endif
+#else
+    // loss emulation only exists in debug builds, have ctest report a skip
+    fprintf(stderr, "no loss emulation in release builds, blackout skipped\n");
+    ret = SKIP_RC;
+#endif
+
+    // close connections
+    q_close(cc, 0, 0);
+    q_close(sc, 0, 0);
+    q_cleanup(w);
+    return ret;
+}
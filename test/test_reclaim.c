@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <quant/quant.h>
+
+#include "conn.h"
+#include "diet.h"
+#include "stream.h"
+#include "strm_tbl.h"
+#include "test_util.h"
+
+
+#define BATCH 1000
+
+
+static void __attribute__((nonnull)) chk(const struct q_conn * const c)
+{
+    // everything was reclaimed, and the closed streams are one interval
+    ensure(strm_tbl_cnt(&c->strms) == 0, "%" PRIu " strms left",
+           strm_tbl_cnt(&c->strms));
+    ensure(diet_cnt(&c->clsd_strms) == 1, "%" PRIu " clsd_strms ivals",
+           diet_cnt(&c->clsd_strms));
+
+    // the table never grew much beyond the number of concurrent streams
+    ensure(c->strms.a[0].cap <= 2 * MAX(c->strm_win_max, INIT_MAX_BIDI_STREAMS),
+           "table cap %" PRIu, c->strms.a[0].cap);
+}
+
+
+int main(int argc, char * argv[])
+{
+    uint_t n = 10000; // "make soak" runs 10M
+#ifndef NDEBUG
+    util_dlevel = ERR; // there is way too much going on for more logging
+#endif
+    int ch;
+    while ((ch = getopt(argc, argv, "n:v:")) != -1)
+        if (ch == 'n')
+            n = (uint_t)strtoull(optarg, 0, 10);
+#ifndef NDEBUG
+        else if (ch == 'v')
+            util_dlevel = MIN(DLEVEL, MAX(0, (short)strtoul(optarg, 0, 10)));
+#endif
+
+    // init
+    struct w_engine * const w = test_init(argv[0], 0, false);
+
+    // connect a client to a server
+    struct q_conn * cc;
+    struct q_conn * sc;
+    test_conn_pair(w, 55563, &cc, &sc);
+
+    // run n tiny request/response exchanges, each on its own stream, and let
+    // both sides forget about the streams right away
+    uint_t opened = 0;
+    uint_t done = 0;
+    while (done < n) {
+        for (uint_t b = 0; b < BATCH && opened < n && q_strms_avail(cc, true);
+             b++, opened++) {
+            struct q_stream * const cs = q_rsv_stream(cc, true);
+            struct w_iov_sq o = w_iov_sq_initializer(o);
+            q_alloc(w, &o, cc, AF_INET6, 1);
+            sq_first(&o)->buf[0] = 'q';
+            q_write(cs, &o, true);
+            q_release_stream(cs);
+        }
+
+        struct q_conn * c;
+        q_ready(w, NS_PER_MS, &c);
+
+        struct w_iov_sq i = w_iov_sq_initializer(i);
+        struct q_stream * ss;
+        while ((ss = q_read(sc, &i, true)) != 0) {
+            ensure(w_iov_sq_len(&i) == 1, "len %" PRIu, w_iov_sq_len(&i));
+            q_free(&i);
+            q_write(ss, &i, true);
+            q_release_stream(ss);
+            done++;
+        }
+    }
+
+    // give the final ACKs a chance to arrive
+    for (uint_t t = 0; t < 100 && (strm_tbl_cnt(&cc->strms) ||
+                                   strm_tbl_cnt(&sc->strms));
+         t++) {
+        struct q_conn * c;
+        q_ready(w, 10 * NS_PER_MS, &c);
+    }
+    chk(cc);
+    chk(sc);
+
+    // close connections
+    q_close(cc, 0, 0);
+    q_close(sc, 0, 0);
+    q_cleanup(w);
+}
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <quant/quant.h>
+
+#include "bitset.h"
+#include "stream.h"
+#include "strm_tbl.h"
+
+
+#define N 2000
+bitset_define(values, N);
+
+static struct q_stream strm[N];
+
+
+static void chk(const struct strm_tbl * const t, const struct values * const v)
+{
+    uint_t cnt = 0;
+    dint_t prev = -1;
+    struct q_stream * s;
+    strm_tbl_foreach(t, s, {
+        ensure(bit_isset(N, (uint_t)s->id, v), "strm " FMT_SID " live", s->id);
+        ensure((s->id & 3) != (prev & 3) || s->id > prev, "ID order");
+        prev = s->id;
+        cnt++;
+    });
+    ensure(cnt == (uint_t)bit_count(N, v) && cnt == strm_tbl_cnt(t),
+           "incorrect count %" PRIu, cnt);
+}
+
+
+int main(void)
+{
+    w_init_rand();
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+#endif
+    struct strm_tbl t = {0};
+    struct values v = bitset_t_initializer(0);
+    for (uint_t i = 0; i < N; i++)
+        strm[i].id = (dint_t)i;
+
+    // randomly insert and remove streams, in all four types
+    for (uint_t r = 0; r < 50 * N; r++) {
+        const uint_t x = w_rand_uniform32(N);
+        if (bit_isset(N, x, &v)) {
+            ensure(strm_tbl_get(&t, (dint_t)x) == &strm[x], "found");
+            if (w_rand_uniform32(2)) {
+                strm_tbl_del(&t, (dint_t)x);
+                bit_clr(N, x, &v);
+            }
+        } else {
+            ensure(strm_tbl_get(&t, (dint_t)x) == 0, "not found");
+            strm_tbl_put(&t, &strm[x]);
+            bit_set(N, x, &v);
+        }
+        if (r % N == 0)
+            chk(&t, &v);
+    }
+    chk(&t, &v);
+
+    // remove all streams while iterating
+    struct q_stream * s;
+    strm_tbl_foreach(&t, s, {
+        strm_tbl_del(&t, s->id);
+        bit_clr(N, (uint_t)s->id, &v);
+    });
+    ensure(strm_tbl_cnt(&t) == 0, "incorrect count %" PRIu " != 0",
+           strm_tbl_cnt(&t));
+    strm_tbl_free(&t);
+
+    // a long-lived stream 0 must not let the table grow without bound while
+    // eight other streams at a time come and go
+    struct q_stream pin = {.id = 0};
+    strm_tbl_put(&t, &pin);
+    for (uint_t i = 1; i < 50 * N; i++) {
+        struct q_stream * const x = &strm[i % 8];
+        if (i > 8)
+            strm_tbl_del(&t, x->id);
+        x->id = (dint_t)(i << 2);
+        strm_tbl_put(&t, x);
+        ensure(strm_tbl_get(&t, 0) == &pin, "pinned strm found");
+    }
+    ensure(strm_tbl_cnt(&t) == 9, "incorrect count %" PRIu " != 9",
+           strm_tbl_cnt(&t));
+    ensure(t.a[0].cap <= 64, "table cap %" PRIu, t.a[0].cap);
+    dint_t prev = -1;
+    strm_tbl_foreach(&t, s, {
+        ensure(s->id > prev, "ID order");
+        prev = s->id;
+        strm_tbl_del(&t, s->id);
+    });
+    ensure(prev == (dint_t)((50 * N - 1) << 2), "last strm " FMT_SID, prev);
+    ensure(strm_tbl_cnt(&t) == 0, "incorrect count %" PRIu " != 0",
+           strm_tbl_cnt(&t));
+    strm_tbl_free(&t);
+
+    return 0;
+}
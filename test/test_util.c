@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <quant/quant.h>
+
+#include "test_util.h"
+
+
+struct w_engine * test_init(const char * const prog,
+                            const struct q_conn_conf * const conn_conf,
+                            const bool enable_async)
+{
+    // the dummy key and certs are next to the test binary
+    const int cwd = open(".", O_CLOEXEC);
+    ensure(cwd != -1, "cannot open");
+    char * const p = strdup(prog);
+    ensure(p, "strdup failed");
+    ensure(chdir(dirname(p)) == 0, "cannot chdir");
+    free(p);
+    __extension__ const struct q_conf conf = {.conn_conf = conn_conf,
+                                              .tls_cert = "dummy.crt",
+                                              .tls_key = "dummy.key",
+                                              .tls_ca_store = "dummy.ca.crt",
+                                              .enable_async = enable_async};
+    struct w_engine * const w = q_init("lo"
+#ifndef __linux__
+                                       "0"
+#endif
+                                       ,
+                                       &conf);
+    ensure(fchdir(cwd) == 0, "cannot fchdir");
+    close(cwd);
+    return w;
+}
+
+
+void test_conn_pair(struct w_engine * const w,
+                    const uint16_t port,
+                    struct q_conn ** const cc,
+                    struct q_conn ** const sc)
+{
+    // bind server socket
+    q_bind(w, 0, port);
+
+    // connect to server
+    struct sockaddr_in6 sip = {.sin6_family = AF_INET6,
+                               .sin6_port = bswap16(port)};
+    inet_pton(AF_INET6, "::1", &sip.sin6_addr);
+    *cc = q_connect(w, (const struct sockaddr *)&sip, "localhost", 0, 0, true,
+                    0, 0);
+    ensure(*cc, "is zero");
+
+    // accept connection
+    q_ready(w, 0, sc);
+    ensure(*sc, "is zero");
+}
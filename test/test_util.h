@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2022, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct q_conn;
+struct q_conn_conf;
+struct w_engine;
+
+
+/// Initialize a quant engine on the loopback interface, using the dummy TLS
+/// credentials that the build places next to the test binary.
+///
+/// @param      prog          The test binary, i.e., argv[0].
+/// @param      conn_conf     Connection configuration, or zero.
+/// @param      enable_async  Allow the q_*_async() calls.
+///
+/// @return     The engine.
+///
+extern struct w_engine * __attribute__((nonnull(1)))
+test_init(const char * const prog,
+          const struct q_conn_conf * const conn_conf,
+          const bool enable_async);
+
+
+/// Bind a server on [::1]:@p port, connect a client to it, and accept the
+/// connection on the server.
+///
+/// @param      w     The engine.
+/// @param      port  The server port.
+/// @param      cc    The client connection.
+/// @param      sc    The server connection.
+///
+extern void __attribute__((nonnull))
+test_conn_pair(struct w_engine * const w,
+               const uint16_t port,
+               struct q_conn ** const cc,
+               struct q_conn ** const sc);